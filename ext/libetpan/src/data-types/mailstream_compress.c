@@ -317,6 +317,27 @@ static carray * mailstream_low_compress_get_certificate_chain(mailstream_low * s
 #endif
 }
 
+int mailstream_low_compress_get_stats(mailstream_low * low,
+                                      unsigned long long * compressed_read,
+                                      unsigned long long * uncompressed_read,
+                                      unsigned long long * compressed_written,
+                                      unsigned long long * uncompressed_written)
+{
+#if HAVE_ZLIB
+  if ((low == NULL) || (low->driver != mailstream_compress_driver))
+    return -1;
+
+  compress_data * data = low->data;
+  * compressed_read = data->decompress_stream->total_in;
+  * uncompressed_read = data->decompress_stream->total_out;
+  * compressed_written = data->compress_stream->total_out;
+  * uncompressed_written = data->compress_stream->total_in;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
 int mailstream_low_compress_wait_idle(mailstream_low * low,
                                       struct mailstream_cancel * idle,
                                       int max_idle_delay)
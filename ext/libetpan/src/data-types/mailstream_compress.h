@@ -55,6 +55,18 @@ int mailstream_low_compress_wait_idle(mailstream_low * low,
                                       struct mailstream_cancel * idle,
                                       int max_idle_delay);
 
+/*
+  mailstream_low_compress_get_stats() returns the number of compressed and
+  uncompressed bytes read and written on a compressed stream.
+  Returns 0 on success, -1 if the stream is not compressed.
+*/
+LIBETPAN_EXPORT
+int mailstream_low_compress_get_stats(mailstream_low * low,
+                                      unsigned long long * compressed_read,
+                                      unsigned long long * uncompressed_read,
+                                      unsigned long long * compressed_written,
+                                      unsigned long long * uncompressed_written);
+
   /*
 LIBETPAN_EXPORT
 int mailstream_low_compress_setup_idle(mailstream_low * low);
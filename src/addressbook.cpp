@@ -112,15 +112,8 @@ bool AddressBook::ChangePass(const bool p_CacheEncrypt,
 {
   if (!p_CacheEncrypt) return true;
 
-  Util::RmDir(GetAddressBookTempDbDir());
-  Util::MkDir(GetAddressBookTempDbDir());
-  if (!CacheUtil::DecryptCacheDir(p_OldPass, GetAddressBookCacheDbDir(), GetAddressBookTempDbDir())) return false;
-
-  Util::RmDir(GetAddressBookCacheDbDir());
-  Util::MkDir(GetAddressBookCacheDbDir());
-  if (!CacheUtil::EncryptCacheDir(p_NewPass, GetAddressBookTempDbDir(), GetAddressBookCacheDbDir())) return false;
-
-  return true;
+  return CacheUtil::ReencryptCacheDir(p_OldPass, p_NewPass, GetAddressBookCacheDbDir(),
+                                      GetAddressBookCacheDir() + "reencrypt.journal");
 }
 
 void AddressBook::Add(const std::string& p_MsgId, const std::set<std::string>& p_Addresses)
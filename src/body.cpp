@@ -1,6 +1,6 @@
 // body.cpp
 //
-// Copyright (c) 2019-2023 Kristofer Berggren
+// Copyright (c) 2019-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
@@ -48,24 +48,33 @@ void Body::SetData(const std::string& p_Data)
   ParseIfNeeded();
 }
 
+// sets raw data of a body with deserialized metadata, text parts are extracted when needed
+void Body::SetRawData(std::string&& p_Data)
+{
+  m_Data = std::move(p_Data);
+  m_PartDatasParsed = false;
+}
+
 std::string Body::GetData() const
 {
   return m_Data;
 }
 
-std::string Body::GetTextPlain() const
+std::string Body::GetTextPlain()
 {
+  ParsePartsIfNeeded();
   if (!m_TextPlain.empty())
   {
     return m_TextPlain;
   }
   else
   {
+    ParseHtmlIfNeeded();
     return m_TextHtml;
   }
 }
 
-std::string Body::GetTextHtml() const
+std::string Body::GetTextHtml()
 {
   if (!m_TextHtml.empty())
   {
@@ -73,12 +82,14 @@ std::string Body::GetTextHtml() const
   }
   else
   {
+    ParsePartsIfNeeded();
     return m_TextPlain;
   }
 }
 
-std::string Body::GetHtml() const
+std::string Body::GetHtml()
 {
+  ParsePartsIfNeeded();
   if (!m_Html.empty())
   {
     return m_Html;
@@ -104,14 +115,7 @@ std::map<ssize_t, PartInfo> Body::GetPartInfos() const
 
 std::map<ssize_t, std::string> Body::GetPartDatas()
 {
-  if (!m_PartDatasParsed)
-  {
-    bool forceParse = true;
-    m_NumParts = 0;
-    m_PartInfos.clear();
-    m_PartDatas.clear();
-    ParseIfNeeded(forceParse);
-  }
+  ParsePartsIfNeeded();
   return m_PartDatas;
 }
 
@@ -144,21 +148,37 @@ void Body::Parse()
 {
   // @note: this function should not be called directly, only via ParseIfNeeded()
   LOG_DURATION();
+
+  // clear html-to-text result, in the event that it's a reparse due to version update
+  m_TextHtml.clear();
+  m_HtmlParsed = false;
+
+  ParseParts();
+
+  if (m_TextPlain.empty())
+  {
+    // always parse html if no text/plain part exists
+    ParseHtmlIfNeeded();
+  }
+
+  m_ParseVersion = GetCurrentParseVersion();
+}
+
+void Body::ParseParts()
+{
+  // @note: this function should not be called directly, only via Parse() or ParsePartsIfNeeded()
   struct mailmime* mime = NULL;
   size_t current_index = 0;
   mailmime_parse(m_Data.c_str(), m_Data.size(), &current_index, &mime);
 
-  // clear all parsed members, in the event that it's a reparse due to version update
+  // clear all parsed members, metadata is re-derived identically for current parse version
   m_NumParts = 0;
   m_PartInfos.clear();
   m_PartDatas.clear();
   m_TextPlainIndex = -1;
   m_TextHtmlIndex = -1;
-  m_TextHtml.clear();
   m_TextPlain.clear();
   m_Html.clear();
-  m_HtmlParsed = false;
-  m_PartDatasParsed = false;
 
   if (mime != NULL)
   {
@@ -169,13 +189,6 @@ void Body::Parse()
   ParseText();
   StoreHtml();
 
-  if (m_TextPlain.empty())
-  {
-    // always parse html if no text/plain part exists
-    ParseHtmlIfNeeded();
-  }
-
-  m_ParseVersion = GetCurrentParseVersion();
   m_PartDatasParsed = true;
 }
 
@@ -202,6 +215,7 @@ void Body::StoreHtml()
 
 void Body::ParseHtml()
 {
+  ParsePartsIfNeeded();
   if ((m_TextHtmlIndex != -1) && m_PartInfos.count(m_TextHtmlIndex) && !m_Html.empty())
   {
     const PartInfo& partInfo = m_PartInfos.at(m_TextHtmlIndex);
@@ -1,6 +1,6 @@
 // body.h
 //
-// Copyright (c) 2019-2021 Kristofer Berggren
+// Copyright (c) 2019-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
@@ -41,10 +41,11 @@ public:
   void FromMime(mailmime* p_Mime);
   void FromHeader(const std::string& p_Data);
   void SetData(const std::string& p_Data);
+  void SetRawData(std::string&& p_Data);
   std::string GetData() const;
-  std::string GetTextPlain() const;
-  std::string GetTextHtml() const;
-  std::string GetHtml() const;
+  std::string GetTextPlain();
+  std::string GetTextHtml();
+  std::string GetHtml();
   std::map<ssize_t, PartInfo> GetPartInfos() const;
   std::map<ssize_t, std::string> GetPartDatas();
   bool HasAttachments() const;
@@ -58,6 +59,13 @@ public:
     return true;
   }
 
+  inline bool IsParseCurrent() const
+  {
+    return (m_ParseVersion == GetCurrentParseVersion());
+  }
+
+  static size_t GetCurrentParseVersion();
+
   inline bool ParseHtmlIfNeeded()
   {
     if (m_HtmlParsed) return false;
@@ -66,9 +74,47 @@ public:
     return true;
   }
 
+  inline void ParsePartsIfNeeded()
+  {
+    if (m_PartDatasParsed) return;
+
+    ParseParts();
+  }
+
+  // serializes derived metadata only, raw data is stored separately (see SetRawData)
   template<class Archive>
-  void serialize(Archive& p_Archive)
+  void save(Archive& p_Archive) const
   {
+    // cache html-to-text conversion as it is costly, unless exceeding max size
+    const bool cacheTextHtml = m_HtmlParsed && (m_TextHtml.size() <= s_MaxCachedTextHtmlSize);
+    p_Archive(m_ParseVersion,
+              m_PartInfos,
+              m_NumParts,
+              m_TextPlainIndex,
+              m_TextHtmlIndex,
+              cacheTextHtml ? m_TextHtml : std::string(),
+              cacheTextHtml);
+  }
+
+  template<class Archive>
+  void load(Archive& p_Archive)
+  {
+    p_Archive(m_ParseVersion,
+              m_PartInfos,
+              m_NumParts,
+              m_TextPlainIndex,
+              m_TextHtmlIndex,
+              m_TextHtml,
+              m_HtmlParsed);
+    m_PartDatasParsed = false;
+  }
+
+  // loads format used before raw data and metadata were stored separately
+  template<class Archive>
+  void LoadLegacy(Archive& p_Archive)
+  {
+    std::string textPlain;
+    std::string html;
     p_Archive(m_Data,
               m_ParseVersion,
               m_PartInfos,
@@ -76,13 +122,15 @@ public:
               m_TextPlainIndex,
               m_TextHtmlIndex,
               m_TextHtml,
-              m_TextPlain,
-              m_Html,
+              textPlain,
+              html,
               m_HtmlParsed);
+    m_PartDatasParsed = false;
   }
 
 private:
   void Parse();
+  void ParseParts();
   void ParseText();
   void StoreHtml();
   void ParseHtml();
@@ -93,8 +141,6 @@ private:
   void ParseMimeContentType(struct mailmime_content* p_MimeContentType, bool& p_IsFormatFlowed);
   void RemoveInvalidHeaders();
 
-  size_t GetCurrentParseVersion();
-
 private:
   std::string m_Data;
 
@@ -110,6 +156,8 @@ private:
 
   std::map<ssize_t, std::string> m_PartDatas;
   bool m_PartDatasParsed = false;
+
+  static const size_t s_MaxCachedTextHtmlSize = 256 * 1024;
 };
 
 std::ostream& operator<<(std::ostream& p_Stream, const Body& p_Body);
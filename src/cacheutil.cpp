@@ -7,6 +7,12 @@
 
 #include "cacheutil.h"
 
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+
 #include "crypto.h"
 #include "loghelp.h"
 #include "util.h"
@@ -89,6 +95,115 @@ bool CacheUtil::EncryptCacheDir(const std::string& p_Pass, const std::string& p_
   return true;
 }
 
+bool CacheUtil::ReencryptCacheDir(const std::string& p_OldPass, const std::string& p_NewPass,
+                                  const std::string& p_Dir, const std::string& p_JournalPath)
+{
+  std::vector<std::string> paths;
+  const std::vector<std::string>& files = Util::ListDir(p_Dir);
+  for (const auto& file : files)
+  {
+    if (Util::GetFileExt(file) == ".tmp") continue;
+
+    paths.push_back(p_Dir + "/" + file);
+  }
+
+  return ReencryptFiles(p_OldPass, p_NewPass, paths, p_JournalPath);
+}
+
+// re-encrypts files in parallel, each first to a .tmp file which is moved into place once recorded in
+// the journal. an interrupted run resumes by completing journaled moves and skipping journaled files.
+bool CacheUtil::ReencryptFiles(const std::string& p_OldPass, const std::string& p_NewPass,
+                               const std::vector<std::string>& p_Paths, const std::string& p_JournalPath,
+                               std::function<bool(const std::string&, const std::string&)> p_Transcode)
+{
+  if (!p_Transcode)
+  {
+    p_Transcode = [&](const std::string& p_InPath, const std::string& p_OutPath)
+    {
+      return Crypto::AESReencryptFile(p_InPath, p_OutPath, p_OldPass, p_NewPass);
+    };
+  }
+
+  // journal starts with a token only decryptable with new pass, to detect resume with another new pass
+  static const std::string journalToken = "nmail-reencrypt";
+  std::set<std::string> donePaths;
+  if (Util::Exists(p_JournalPath))
+  {
+    std::ifstream journalStream(p_JournalPath);
+    std::string line;
+    std::getline(journalStream, line);
+    if (Crypto::AESDecrypt(Util::FromHex(line), p_NewPass) != journalToken)
+    {
+      LOG_ERROR("journal %s is from re-encryption with another password", p_JournalPath.c_str());
+      std::cerr << "interrupted password change must be resumed using the same new password\n";
+      return false;
+    }
+
+    while (std::getline(journalStream, line))
+    {
+      if (!line.empty())
+      {
+        donePaths.insert(line);
+      }
+    }
+
+    LOG_DEBUG("resume %s with %d done", p_JournalPath.c_str(), (int)donePaths.size());
+  }
+  else
+  {
+    Util::WriteFile(p_JournalPath, Util::ToHex(Crypto::AESEncrypt(journalToken, p_NewPass)) + "\n");
+  }
+
+  std::ofstream journalStream(p_JournalPath, std::ios::app);
+  std::mutex journalMutex;
+  std::vector<std::string> paths;
+  for (const auto& path : p_Paths)
+  {
+    if (donePaths.count(path) == 0)
+    {
+      paths.push_back(path);
+    }
+    else if (Util::Exists(path + ".tmp"))
+    {
+      // interrupted after journaling but before move
+      Util::Move(path + ".tmp", path);
+    }
+  }
+
+  std::atomic<bool> rv(true);
+  Util::ParallelFor(paths.size(), [&](size_t p_Index)
+  {
+    if (!rv) return;
+
+    const std::string& path = paths.at(p_Index);
+    const std::string tmpPath = path + ".tmp";
+    if (!p_Transcode(path, tmpPath))
+    {
+      LOG_WARNING("failed to re-encrypt %s", path.c_str());
+      Util::DeleteFile(tmpPath);
+      rv = false;
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> journalLock(journalMutex);
+      journalStream << path << "\n";
+      journalStream.flush();
+      std::cout << "." << std::flush;
+    }
+
+    Util::Move(tmpPath, path);
+  });
+
+  journalStream.close();
+  if (rv)
+  {
+    Util::DeleteFile(p_JournalPath);
+  }
+
+  return rv;
+}
+
 void CacheUtil::ReadVersionFromFile(const std::string& p_Path, int& p_Version)
 {
   std::string str = Util::FromHex(Util::ReadFile(p_Path));
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
+#include <vector>
 
 class CacheUtil
 {
@@ -18,6 +20,11 @@ public:
   static bool CommonInitCacheDir(const std::string& p_Dir, int p_Version, bool p_Encrypted);
   static bool DecryptCacheDir(const std::string& p_Pass, const std::string& p_SrcDir, const std::string& p_DstDir);
   static bool EncryptCacheDir(const std::string& p_Pass, const std::string& p_SrcDir, const std::string& p_DstDir);
+  static bool ReencryptCacheDir(const std::string& p_OldPass, const std::string& p_NewPass,
+                                const std::string& p_Dir, const std::string& p_JournalPath);
+  static bool ReencryptFiles(const std::string& p_OldPass, const std::string& p_NewPass,
+                             const std::vector<std::string>& p_Paths, const std::string& p_JournalPath,
+                             std::function<bool(const std::string&, const std::string&)> p_Transcode = nullptr);
   static void ReadVersionFromFile(const std::string& p_Path, int& p_Version);
   static void WriteVersionToFile(const std::string& p_Path, const int p_Version);
 };
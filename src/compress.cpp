@@ -0,0 +1,82 @@
+// compress.cpp
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "compress.h"
+
+#include <zlib.h>
+
+#include "loghelp.h"
+
+// compressed data is prefixed by its uncompressed size (32-bit little endian)
+static const size_t s_SizeLen = 4;
+
+std::string Compress::GetVersion()
+{
+  return std::string("zlib ") + zlibVersion();
+}
+
+// inflates into vector or string output buffer
+template<typename T>
+static bool InflateTo(const char* p_Data, size_t p_Size, T& p_Out)
+{
+  if (p_Size < s_SizeLen) return false;
+
+  uLongf size = 0;
+  for (size_t i = 0; i < s_SizeLen; ++i)
+  {
+    size |= ((uLongf)(unsigned char)p_Data[i]) << (8 * i);
+  }
+
+  p_Out.resize(size);
+  uLongf outLen = size;
+  int rv = uncompress((Bytef*)p_Out.data(), &outLen, (const Bytef*)p_Data + s_SizeLen, p_Size - s_SizeLen);
+  if ((rv != Z_OK) || (outLen != size))
+  {
+    LOG_WARNING("uncompress failed (%d)", rv);
+    p_Out.clear();
+    return false;
+  }
+
+  return true;
+}
+
+std::vector<char> Compress::Deflate(const std::vector<char>& p_Data)
+{
+  return Deflate(p_Data.data(), p_Data.size());
+}
+
+std::vector<char> Compress::Deflate(const char* p_Data, size_t p_Size)
+{
+  std::vector<char> out;
+  uLongf outLen = compressBound(p_Size);
+  out.resize(s_SizeLen + outLen);
+  for (size_t i = 0; i < s_SizeLen; ++i)
+  {
+    out[i] = (char)((p_Size >> (8 * i)) & 0xff);
+  }
+
+  int rv = compress2((Bytef*)out.data() + s_SizeLen, &outLen, (const Bytef*)p_Data, p_Size,
+                     Z_DEFAULT_COMPRESSION);
+  if (rv != Z_OK)
+  {
+    LOG_WARNING("compress failed (%d)", rv);
+    return std::vector<char>();
+  }
+
+  out.resize(s_SizeLen + outLen);
+  return out;
+}
+
+bool Compress::Inflate(const std::vector<char>& p_Data, std::vector<char>& p_Out)
+{
+  return InflateTo(p_Data.data(), p_Data.size(), p_Out);
+}
+
+bool Compress::Inflate(const char* p_Data, size_t p_Size, std::string& p_Out)
+{
+  return InflateTo(p_Data, p_Size, p_Out);
+}
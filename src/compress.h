@@ -0,0 +1,22 @@
+// compress.h
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Compress
+{
+public:
+  static std::string GetVersion();
+
+  static std::vector<char> Deflate(const std::vector<char>& p_Data);
+  static std::vector<char> Deflate(const char* p_Data, size_t p_Size);
+  static bool Inflate(const std::vector<char>& p_Data, std::vector<char>& p_Out);
+  static bool Inflate(const char* p_Data, size_t p_Size, std::string& p_Out);
+};
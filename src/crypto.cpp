@@ -326,3 +326,111 @@ bool Crypto::AESDecryptFile(const std::string& p_InPath, const std::string& p_Ou
 
   return true;
 }
+
+// decrypts with old pass and encrypts with new pass in a single stream pass, without intermediate plaintext file
+bool Crypto::AESReencryptFile(const std::string& p_InPath, const std::string& p_OutPath,
+                              const std::string& p_OldPass, const std::string& p_NewPass)
+{
+  std::ifstream inStream;
+  inStream.open(p_InPath, std::ios::binary);
+  if (!inStream.is_open()) return false;
+
+  inStream.seekg(0, std::ios::end);
+  std::streamsize inFileRemainingLen = inStream.tellg();
+  inStream.seekg(0, std::ios::beg);
+  if (inFileRemainingLen < 16) return false;
+
+  char header[8] = { 0 };
+  inStream.read(header, 8);
+  if (strncmp(header, "Salted__", 8) != 0) return false;
+
+  unsigned char oldSalt[8] = { 0 };
+  inStream.read((char*)oldSalt, 8);
+  inFileRemainingLen -= 16;
+
+  unsigned char oldKey[32] = { 0 };
+  unsigned char oldIv[32] = { 0 };
+  EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha1(), oldSalt, (unsigned char*)const_cast<char*>(p_OldPass.c_str()),
+                 p_OldPass.size(), 1, oldKey, oldIv);
+
+  unsigned char newSalt[8] = { 0 };
+  RAND_bytes(newSalt, sizeof(newSalt));
+
+  unsigned char newKey[32] = { 0 };
+  unsigned char newIv[32] = { 0 };
+  EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha1(), newSalt, (unsigned char*)const_cast<char*>(p_NewPass.c_str()),
+                 p_NewPass.size(), 1, newKey, newIv);
+
+  EVP_CIPHER_CTX* decCtx = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX* encCtx = EVP_CIPHER_CTX_new();
+  bool rv = (decCtx != NULL) && (encCtx != NULL) &&
+    (EVP_DecryptInit_ex(decCtx, EVP_aes_256_cbc(), NULL, oldKey, oldIv) == 1) &&
+    (EVP_EncryptInit_ex(encCtx, EVP_aes_256_cbc(), NULL, newKey, newIv) == 1);
+
+  if (rv)
+  {
+    std::ofstream outStream;
+    outStream.open(p_OutPath, std::ios::binary);
+    outStream.write("Salted__", 8);
+    outStream.write((char*)newSalt, 8);
+
+    const std::streamsize inBufLen = 64 * 1024;
+    std::vector<char> inBuf(inBufLen);
+    std::vector<char> plainBuf(inBufLen + EVP_MAX_BLOCK_LENGTH);
+    std::vector<char> outBuf(inBufLen + (2 * EVP_MAX_BLOCK_LENGTH));
+
+    // transcodes one chunk of plaintext to the output stream
+    auto encryptChunk = [&](int p_PlainLen) -> bool
+    {
+      int writeLen = 0;
+      if (EVP_EncryptUpdate(encCtx, (unsigned char*)outBuf.data(), &writeLen, (unsigned char*)plainBuf.data(),
+                            p_PlainLen) == 0)
+      {
+        return false;
+      }
+
+      outStream.write(outBuf.data(), writeLen);
+      return true;
+    };
+
+    while (rv && (inFileRemainingLen > 0))
+    {
+      std::streamsize readLen = std::min(inFileRemainingLen, inBufLen);
+      inStream.read(inBuf.data(), readLen);
+      if (inStream.gcount() != readLen)
+      {
+        rv = false;
+        break;
+      }
+
+      int plainLen = 0;
+      if (EVP_DecryptUpdate(decCtx, (unsigned char*)plainBuf.data(), &plainLen, (unsigned char*)inBuf.data(),
+                            readLen) == 0)
+      {
+        rv = false;
+        break;
+      }
+
+      rv = encryptChunk(plainLen);
+      inFileRemainingLen -= readLen;
+    }
+
+    int plainLen = 0;
+    rv = rv && (EVP_DecryptFinal_ex(decCtx, (unsigned char*)plainBuf.data(), &plainLen) == 1) &&
+      encryptChunk(plainLen);
+
+    int writeLen = 0;
+    rv = rv && (EVP_EncryptFinal_ex(encCtx, (unsigned char*)outBuf.data(), &writeLen) == 1);
+    if (rv)
+    {
+      outStream.write(outBuf.data(), writeLen);
+      outStream.flush();
+      rv = outStream.good();
+    }
+  }
+
+  if (decCtx != NULL) EVP_CIPHER_CTX_free(decCtx);
+  if (encCtx != NULL) EVP_CIPHER_CTX_free(encCtx);
+
+  return rv;
+}
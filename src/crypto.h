@@ -23,4 +23,6 @@ public:
 
   static bool AESEncryptFile(const std::string& p_InPath, const std::string& p_OutPath, const std::string& p_Pass);
   static bool AESDecryptFile(const std::string& p_InPath, const std::string& p_OutPath, const std::string& p_Pass);
+  static bool AESReencryptFile(const std::string& p_InPath, const std::string& p_OutPath,
+                               const std::string& p_OldPass, const std::string& p_NewPass);
 };
@@ -0,0 +1,933 @@
+// cryptovfs.cpp
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "cryptovfs.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <sqlite3.h>
+
+#include "loghelp.h"
+
+#ifndef SQLITE_IOERR_DATA
+#define SQLITE_IOERR_DATA (SQLITE_IOERR | (32<<8))
+#endif
+
+// File layout is a header (magic and key salt) followed by records, each stored as iv + length +
+// ciphertext + tag. Record boundaries follow how sqlite writes each file type, so that a write never
+// re-encrypts stored bytes outside its own range: db and journal files use fixed s_BlockSize records
+// (matching the db page size), and wal files use one record for the wal header and two records per
+// frame (frame header and page). The length is the number of valid bytes in the record, which is less
+// than its capacity only for the last record of a file. The record index and length are authenticated,
+// so records cannot be moved or truncated.
+static const char s_Magic[16] = "nmail-cryptvfs1";
+static const int s_SaltSize = 16;
+static const int s_HeaderSize = sizeof(s_Magic) + s_SaltSize;
+static const int s_BlockSize = 4096;
+static const int s_MaxRecordSize = 65536; // max sqlite page size
+static const int s_IvSize = 12;
+static const int s_LenSize = 4;
+static const int s_TagSize = 16;
+static const int s_RecordOverhead = s_IvSize + s_LenSize + s_TagSize;
+static const int s_WalHeaderSize = 32;
+static const int s_WalFrameHeaderSize = 24;
+static const int s_KeySize = 32;
+static const int s_KdfIterations = 100000;
+
+struct CryptoVfsData
+{
+  sqlite3_vfs m_Vfs;
+  sqlite3_vfs* m_RootVfs = nullptr;
+  std::string m_Name;
+  std::string m_Pass;
+  std::mutex m_KeysMutex;
+  std::map<std::string, std::string> m_Keys; // derived keys by file salt
+};
+
+// allocated by sqlite (szOsFile), followed by the underlying file of the root vfs
+struct CryptoFile
+{
+  sqlite3_file m_Base;
+  CryptoVfsData* m_VfsData;
+  sqlite3_file* m_RealFile;
+  EVP_CIPHER_CTX* m_Ctx;
+  bool m_HasKey;
+  unsigned char m_Key[s_KeySize];
+  bool m_IsMainDb;
+  bool m_IsWal;
+  int m_WalPageSize; // zero until read from or written to wal header
+  sqlite3_int64 m_StoredSize; // stored size for which m_Size is valid, or -1
+  sqlite3_int64 m_Size; // cached logical size
+  unsigned char* m_Plain; // record scratch buffers
+  unsigned char* m_Stored;
+};
+
+// location of a record, in logical and stored file offsets
+struct Record
+{
+  sqlite3_int64 m_Index = 0;
+  sqlite3_int64 m_Offset = 0;
+  int m_Capacity = 0;
+  sqlite3_int64 m_StoredOffset = 0;
+};
+
+static std::mutex s_VfsMutex;
+static std::map<std::string, std::unique_ptr<CryptoVfsData>> s_Vfss;
+static int s_VfsCount = 0;
+
+static void PutUint32(unsigned char* p_Buf, uint32_t p_Val)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    p_Buf[i] = (unsigned char)(p_Val >> (8 * i));
+  }
+}
+
+static uint32_t GetUint32(const unsigned char* p_Buf)
+{
+  uint32_t val = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    val |= ((uint32_t)p_Buf[i]) << (8 * i);
+  }
+  return val;
+}
+
+// additional authenticated data for a record is its index and valid length
+static void GetRecordAad(sqlite3_int64 p_Index, int p_Len, unsigned char* p_Aad)
+{
+  PutUint32(p_Aad, (uint32_t)(p_Index & 0xffffffff));
+  PutUint32(p_Aad + 4, (uint32_t)(p_Index >> 32));
+  PutUint32(p_Aad + 8, (uint32_t)p_Len);
+}
+
+static int LoadKey(CryptoFile* p_File, bool p_Create)
+{
+  if (p_File->m_HasKey) return SQLITE_OK;
+
+  sqlite3_file* realFile = p_File->m_RealFile;
+  sqlite3_int64 size = 0;
+  int rv = realFile->pMethods->xFileSize(realFile, &size);
+  if (rv != SQLITE_OK) return rv;
+
+  unsigned char header[s_HeaderSize];
+  if (size >= s_HeaderSize)
+  {
+    rv = realFile->pMethods->xRead(realFile, header, s_HeaderSize, 0);
+    if (rv != SQLITE_OK) return rv;
+
+    if (memcmp(header, s_Magic, sizeof(s_Magic)) != 0) return SQLITE_NOTADB;
+  }
+  else if ((size == 0) && p_Create)
+  {
+    memcpy(header, s_Magic, sizeof(s_Magic));
+    if (RAND_bytes(header + sizeof(s_Magic), s_SaltSize) != 1) return SQLITE_IOERR;
+
+    rv = realFile->pMethods->xWrite(realFile, header, s_HeaderSize, 0);
+    if (rv != SQLITE_OK) return rv;
+  }
+  else if (size == 0)
+  {
+    return SQLITE_OK; // header is written by first writer
+  }
+  else
+  {
+    return SQLITE_NOTADB;
+  }
+
+  CryptoVfsData* vfsData = p_File->m_VfsData;
+  const std::string salt((const char*)header + sizeof(s_Magic), s_SaltSize);
+  std::lock_guard<std::mutex> keysLock(vfsData->m_KeysMutex);
+  auto it = vfsData->m_Keys.find(salt);
+  if (it == vfsData->m_Keys.end())
+  {
+    std::string key(s_KeySize, 0);
+    if (PKCS5_PBKDF2_HMAC(vfsData->m_Pass.c_str(), vfsData->m_Pass.size(),
+                          (const unsigned char*)salt.c_str(), salt.size(), s_KdfIterations, EVP_sha256(),
+                          s_KeySize, (unsigned char*)key.data()) != 1)
+    {
+      return SQLITE_IOERR;
+    }
+
+    it = vfsData->m_Keys.insert(std::make_pair(salt, key)).first;
+  }
+
+  memcpy(p_File->m_Key, it->second.c_str(), s_KeySize);
+  p_File->m_HasKey = true;
+  return SQLITE_OK;
+}
+
+static int LoadWalPageSize(CryptoFile* p_File);
+
+static int GetRecord(CryptoFile* p_File, sqlite3_int64 p_Index, Record& p_Record)
+{
+  p_Record.m_Index = p_Index;
+  if (!p_File->m_IsWal)
+  {
+    p_Record.m_Offset = p_Index * s_BlockSize;
+    p_Record.m_Capacity = s_BlockSize;
+    p_Record.m_StoredOffset = s_HeaderSize + (p_Index * (s_BlockSize + s_RecordOverhead));
+    return SQLITE_OK;
+  }
+
+  if (p_Index == 0)
+  {
+    p_Record.m_Offset = 0;
+    p_Record.m_Capacity = s_WalHeaderSize;
+    p_Record.m_StoredOffset = s_HeaderSize;
+    return SQLITE_OK;
+  }
+
+  int rv = LoadWalPageSize(p_File);
+  if (rv != SQLITE_OK) return rv;
+
+  const int pageSize = p_File->m_WalPageSize;
+  const sqlite3_int64 frame = (p_Index - 1) / 2;
+  const bool isPage = ((p_Index - 1) % 2) == 1;
+  p_Record.m_Offset = s_WalHeaderSize + (frame * (s_WalFrameHeaderSize + pageSize)) +
+    (isPage ? s_WalFrameHeaderSize : 0);
+  p_Record.m_Capacity = isPage ? pageSize : s_WalFrameHeaderSize;
+  p_Record.m_StoredOffset = s_HeaderSize + s_WalHeaderSize + s_RecordOverhead +
+    (frame * (s_WalFrameHeaderSize + pageSize + (2 * s_RecordOverhead))) +
+    (isPage ? (s_WalFrameHeaderSize + s_RecordOverhead) : 0);
+  return SQLITE_OK;
+}
+
+// locates the record holding logical offset p_Offset
+static int LocateRecord(CryptoFile* p_File, sqlite3_int64 p_Offset, Record& p_Record)
+{
+  if (!p_File->m_IsWal) return GetRecord(p_File, p_Offset / s_BlockSize, p_Record);
+
+  if (p_Offset < s_WalHeaderSize) return GetRecord(p_File, 0, p_Record);
+
+  int rv = LoadWalPageSize(p_File);
+  if (rv != SQLITE_OK) return rv;
+
+  const int frameSize = s_WalFrameHeaderSize + p_File->m_WalPageSize;
+  const sqlite3_int64 frame = (p_Offset - s_WalHeaderSize) / frameSize;
+  const bool isPage = ((p_Offset - s_WalHeaderSize) % frameSize) >= s_WalFrameHeaderSize;
+  return GetRecord(p_File, 1 + (2 * frame) + (isPage ? 1 : 0), p_Record);
+}
+
+// reads and decrypts a record, p_Data must hold its capacity. p_Len is zero for a record beyond end of
+// file. Sqlite validates wal and journal content itself, so there an unauthenticated record, e.g. from
+// a torn write, reads as zeros. In the db file, which is always written in whole synced pages, any
+// unauthenticated or partially stored record is an error.
+static int ReadRecord(CryptoFile* p_File, const Record& p_Record, unsigned char* p_Data, int& p_Len)
+{
+  p_Len = 0;
+  unsigned char* stored = p_File->m_Stored;
+  const int storedSize = p_Record.m_Capacity + s_RecordOverhead;
+  sqlite3_file* realFile = p_File->m_RealFile;
+  int rv = realFile->pMethods->xRead(realFile, stored, storedSize, p_Record.m_StoredOffset);
+  if (rv == SQLITE_IOERR_SHORT_READ)
+  {
+    memset(p_Data, 0, p_Record.m_Capacity);
+    if (!p_File->m_IsMainDb) return SQLITE_OK;
+
+    sqlite3_int64 size = 0;
+    rv = realFile->pMethods->xFileSize(realFile, &size);
+    if (rv != SQLITE_OK) return rv;
+
+    if (size <= p_Record.m_StoredOffset) return SQLITE_OK;
+
+    LOG_WARNING("record %lld partially stored", (long long)p_Record.m_Index);
+    return SQLITE_IOERR_DATA;
+  }
+
+  if (rv != SQLITE_OK) return rv;
+
+  const unsigned char* iv = stored;
+  const unsigned char* ciphertext = stored + s_IvSize + s_LenSize;
+  unsigned char* tag = stored + s_IvSize + s_LenSize + p_Record.m_Capacity;
+  const uint32_t len = GetUint32(stored + s_IvSize);
+  unsigned char aad[12];
+  GetRecordAad(p_Record.m_Index, (int)len, aad);
+
+  EVP_CIPHER_CTX* ctx = p_File->m_Ctx;
+  int outLen = 0;
+  if ((len > (uint32_t)p_Record.m_Capacity) ||
+      (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, p_File->m_Key, iv) != 1) ||
+      (EVP_DecryptUpdate(ctx, nullptr, &outLen, aad, sizeof(aad)) != 1) ||
+      (EVP_DecryptUpdate(ctx, p_Data, &outLen, ciphertext, p_Record.m_Capacity) != 1) ||
+      (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, s_TagSize, tag) != 1) ||
+      (EVP_DecryptFinal_ex(ctx, p_Data + outLen, &outLen) != 1))
+  {
+    memset(p_Data, 0, p_Record.m_Capacity);
+    if (!p_File->m_IsMainDb)
+    {
+      LOG_DEBUG("record %lld authentication failed, read as zeros", (long long)p_Record.m_Index);
+      p_Len = p_Record.m_Capacity;
+      return SQLITE_OK;
+    }
+
+    LOG_WARNING("record %lld authentication failed", (long long)p_Record.m_Index);
+    return SQLITE_IOERR_DATA;
+  }
+
+  p_Len = (int)len;
+  return SQLITE_OK;
+}
+
+// encrypts and writes a full record, bytes in p_Data beyond p_Len must be zero
+static int WriteRecord(CryptoFile* p_File, const Record& p_Record, const unsigned char* p_Data, int p_Len)
+{
+  unsigned char* stored = p_File->m_Stored;
+  unsigned char* iv = stored;
+  unsigned char* ciphertext = stored + s_IvSize + s_LenSize;
+  unsigned char* tag = stored + s_IvSize + s_LenSize + p_Record.m_Capacity;
+  if (RAND_bytes(iv, s_IvSize) != 1) return SQLITE_IOERR_WRITE;
+
+  PutUint32(stored + s_IvSize, (uint32_t)p_Len);
+
+  unsigned char aad[12];
+  GetRecordAad(p_Record.m_Index, p_Len, aad);
+
+  EVP_CIPHER_CTX* ctx = p_File->m_Ctx;
+  int len = 0;
+  if ((EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, p_File->m_Key, iv) != 1) ||
+      (EVP_EncryptUpdate(ctx, nullptr, &len, aad, sizeof(aad)) != 1) ||
+      (EVP_EncryptUpdate(ctx, ciphertext, &len, p_Data, p_Record.m_Capacity) != 1) ||
+      (EVP_EncryptFinal_ex(ctx, ciphertext + len, &len) != 1) ||
+      (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, s_TagSize, tag) != 1))
+  {
+    return SQLITE_IOERR_WRITE;
+  }
+
+  if (p_File->m_IsWal && (p_Record.m_Index == 0) && (p_Len == s_WalHeaderSize))
+  {
+    // wal header stores page size big-endian at offset 8
+    p_File->m_WalPageSize = (int)(((uint32_t)p_Data[8] << 24) | ((uint32_t)p_Data[9] << 16) |
+                                  ((uint32_t)p_Data[10] << 8) | (uint32_t)p_Data[11]);
+  }
+
+  sqlite3_file* realFile = p_File->m_RealFile;
+  const int storedSize = p_Record.m_Capacity + s_RecordOverhead;
+  int rv = realFile->pMethods->xWrite(realFile, stored, storedSize, p_Record.m_StoredOffset);
+  if (rv != SQLITE_OK)
+  {
+    p_File->m_StoredSize = -1;
+    return rv;
+  }
+
+  // keep cached logical size valid when writing the last record
+  const sqlite3_int64 storedEnd = p_Record.m_StoredOffset + storedSize;
+  if ((p_File->m_StoredSize != -1) && (storedEnd >= p_File->m_StoredSize))
+  {
+    p_File->m_StoredSize = storedEnd;
+    p_File->m_Size = p_Record.m_Offset + p_Len;
+  }
+
+  return SQLITE_OK;
+}
+
+// wal page size, needed to locate frame records, is read from the wal header record
+static int LoadWalPageSize(CryptoFile* p_File)
+{
+  if (p_File->m_WalPageSize == 0)
+  {
+    Record record;
+    GetRecord(p_File, 0, record);
+    unsigned char header[s_WalHeaderSize];
+    int len = 0;
+    int rv = ReadRecord(p_File, record, header, len);
+    if (rv != SQLITE_OK) return rv;
+
+    if (len == s_WalHeaderSize)
+    {
+      p_File->m_WalPageSize = (int)(((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                                    ((uint32_t)header[10] << 8) | (uint32_t)header[11]);
+    }
+  }
+
+  const int pageSize = p_File->m_WalPageSize;
+  if ((pageSize < 512) || (pageSize > s_MaxRecordSize) || ((pageSize & (pageSize - 1)) != 0))
+  {
+    p_File->m_WalPageSize = 0;
+    return SQLITE_IOERR_SHORT_READ; // no valid wal header, so no frames
+  }
+
+  return SQLITE_OK;
+}
+
+// logical size is determined by the last fully stored record and its valid length, and is cached
+// until the stored size changes
+static int GetLogicalSize(CryptoFile* p_File, sqlite3_int64& p_Size)
+{
+  p_Size = 0;
+  sqlite3_file* realFile = p_File->m_RealFile;
+  sqlite3_int64 storedSize = 0;
+  int rv = realFile->pMethods->xFileSize(realFile, &storedSize);
+  if (rv != SQLITE_OK) return rv;
+
+  if (storedSize == p_File->m_StoredSize)
+  {
+    p_Size = p_File->m_Size;
+    return SQLITE_OK;
+  }
+
+  const sqlite3_int64 bodySize = storedSize - s_HeaderSize;
+  sqlite3_int64 lastIndex = -1;
+  if (!p_File->m_IsWal)
+  {
+    lastIndex = (bodySize / (s_BlockSize + s_RecordOverhead)) - 1;
+  }
+  else if (bodySize >= (s_WalHeaderSize + s_RecordOverhead))
+  {
+    lastIndex = 0;
+    rv = LoadWalPageSize(p_File);
+    if (rv == SQLITE_OK)
+    {
+      const sqlite3_int64 framesSize = bodySize - (s_WalHeaderSize + s_RecordOverhead);
+      const sqlite3_int64 storedFrameSize = s_WalFrameHeaderSize + p_File->m_WalPageSize + (2 * s_RecordOverhead);
+      const sqlite3_int64 frameCount = framesSize / storedFrameSize;
+      const bool hasFrameHeader = (framesSize % storedFrameSize) >= (s_WalFrameHeaderSize + s_RecordOverhead);
+      lastIndex = (2 * frameCount) + (hasFrameHeader ? 1 : 0);
+    }
+    else if (rv != SQLITE_IOERR_SHORT_READ)
+    {
+      return rv;
+    }
+  }
+
+  if (lastIndex >= 0)
+  {
+    Record record;
+    rv = GetRecord(p_File, lastIndex, record);
+    if (rv != SQLITE_OK) return rv;
+
+    unsigned char lenBuf[s_LenSize];
+    rv = realFile->pMethods->xRead(realFile, lenBuf, s_LenSize, record.m_StoredOffset + s_IvSize);
+    if (rv != SQLITE_OK) return rv;
+
+    const uint32_t len = GetUint32(lenBuf);
+    const bool isValidLen = (len > 0) && (len <= (uint32_t)record.m_Capacity);
+    p_Size = record.m_Offset + (isValidLen ? len : record.m_Capacity);
+  }
+
+  p_File->m_StoredSize = storedSize;
+  p_File->m_Size = p_Size;
+  return SQLITE_OK;
+}
+
+// writes data, read-modify-write is only needed for writes not covering full records
+static int WriteData(CryptoFile* p_File, const unsigned char* p_Buf, int p_Amount, sqlite3_int64 p_Offset)
+{
+  while (p_Amount > 0)
+  {
+    Record record;
+    int rv = LocateRecord(p_File, p_Offset, record);
+    if (rv != SQLITE_OK) return (rv == SQLITE_IOERR_SHORT_READ) ? SQLITE_IOERR_WRITE : rv;
+
+    const int recordOffset = (int)(p_Offset - record.m_Offset);
+    const int count = std::min(p_Amount, record.m_Capacity - recordOffset);
+    if (count == record.m_Capacity)
+    {
+      rv = WriteRecord(p_File, record, p_Buf, count);
+    }
+    else
+    {
+      unsigned char* data = p_File->m_Plain;
+      int len = 0;
+      rv = ReadRecord(p_File, record, data, len);
+      if (rv != SQLITE_OK) return rv;
+
+      memcpy(data + recordOffset, p_Buf, count);
+      rv = WriteRecord(p_File, record, data, std::max(len, recordOffset + count));
+    }
+
+    if (rv != SQLITE_OK) return rv;
+
+    p_Buf += count;
+    p_Offset += count;
+    p_Amount -= count;
+  }
+
+  return SQLITE_OK;
+}
+
+// extends logical size with stored zero records up to p_Offset, so that no record before a write
+// beyond end of file is left unwritten (and unauthenticated)
+static int WriteZeros(CryptoFile* p_File, sqlite3_int64 p_Offset)
+{
+  sqlite3_int64 size = 0;
+  int rv = GetLogicalSize(p_File, size);
+  if (rv != SQLITE_OK) return rv;
+
+  static const unsigned char zeros[s_MaxRecordSize] = { 0 };
+  while (size < p_Offset)
+  {
+    Record record;
+    rv = LocateRecord(p_File, size, record);
+    if (rv != SQLITE_OK) return (rv == SQLITE_IOERR_SHORT_READ) ? SQLITE_IOERR_WRITE : rv;
+
+    const int count = (int)std::min<sqlite3_int64>(p_Offset - size, record.m_Offset + record.m_Capacity - size);
+    rv = WriteData(p_File, zeros, count, size);
+    if (rv != SQLITE_OK) return rv;
+
+    size += count;
+  }
+
+  return SQLITE_OK;
+}
+
+static int FileClose(sqlite3_file* p_File)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  int rv = file->m_RealFile->pMethods->xClose(file->m_RealFile);
+  EVP_CIPHER_CTX_free(file->m_Ctx);
+  OPENSSL_cleanse(file->m_Key, s_KeySize);
+  if (file->m_Plain != nullptr)
+  {
+    OPENSSL_cleanse(file->m_Plain, s_MaxRecordSize);
+  }
+
+  delete[] file->m_Plain;
+  delete[] file->m_Stored;
+  return rv;
+}
+
+static int FileRead(sqlite3_file* p_File, void* p_Buf, int p_Amount, sqlite3_int64 p_Offset)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  int rv = LoadKey(file, false /* p_Create */);
+  if (rv != SQLITE_OK) return rv;
+
+  unsigned char* buf = (unsigned char*)p_Buf;
+  while (p_Amount > 0)
+  {
+    Record record;
+    rv = file->m_HasKey ? LocateRecord(file, p_Offset, record) : SQLITE_IOERR_SHORT_READ;
+    if (rv != SQLITE_OK)
+    {
+      if (rv == SQLITE_IOERR_SHORT_READ)
+      {
+        memset(buf, 0, p_Amount);
+      }
+
+      return rv;
+    }
+
+    const int recordOffset = (int)(p_Offset - record.m_Offset);
+    const int count = std::min(p_Amount, record.m_Capacity - recordOffset);
+
+    // decrypt full records directly into caller buffer
+    unsigned char* data = (count == record.m_Capacity) ? buf : file->m_Plain;
+    int len = 0;
+    rv = ReadRecord(file, record, data, len);
+    if (rv != SQLITE_OK) return rv;
+
+    if (len <= recordOffset)
+    {
+      memset(buf, 0, p_Amount);
+      return SQLITE_IOERR_SHORT_READ;
+    }
+
+    const int readCount = std::min(count, len - recordOffset);
+    if (data != buf)
+    {
+      memcpy(buf, data + recordOffset, readCount);
+    }
+
+    buf += readCount;
+    p_Offset += readCount;
+    p_Amount -= readCount;
+  }
+
+  return SQLITE_OK;
+}
+
+static int FileWrite(sqlite3_file* p_File, const void* p_Buf, int p_Amount, sqlite3_int64 p_Offset)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  int rv = LoadKey(file, true /* p_Create */);
+  if (rv != SQLITE_OK) return rv;
+
+  // wal frames are always appended contiguously, other files may be written beyond end of file
+  if (!file->m_IsWal)
+  {
+    rv = WriteZeros(file, p_Offset);
+    if (rv != SQLITE_OK) return rv;
+  }
+
+  return WriteData(file, (const unsigned char*)p_Buf, p_Amount, p_Offset);
+}
+
+static int FileTruncate(sqlite3_file* p_File, sqlite3_int64 p_Size)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  int rv = LoadKey(file, true /* p_Create */);
+  if (rv != SQLITE_OK) return rv;
+
+  sqlite3_int64 size = 0;
+  rv = GetLogicalSize(file, size);
+  if (rv != SQLITE_OK) return rv;
+
+  if (p_Size > size)
+  {
+    rv = WriteZeros(file, p_Size);
+    return (rv == SQLITE_IOERR_WRITE) ? SQLITE_IOERR_TRUNCATE : rv;
+  }
+
+  sqlite3_int64 storedSize = s_HeaderSize;
+  if (p_Size > 0)
+  {
+    Record record;
+    rv = LocateRecord(file, p_Size - 1, record);
+    if (rv != SQLITE_OK) return (rv == SQLITE_IOERR_SHORT_READ) ? SQLITE_IOERR_TRUNCATE : rv;
+
+    const int lastLen = (int)(p_Size - record.m_Offset);
+    if (lastLen < record.m_Capacity)
+    {
+      unsigned char* data = file->m_Plain;
+      int len = 0;
+      rv = ReadRecord(file, record, data, len);
+      if (rv != SQLITE_OK) return rv;
+
+      memset(data + lastLen, 0, record.m_Capacity - lastLen);
+      rv = WriteRecord(file, record, data, lastLen);
+      if (rv != SQLITE_OK) return rv;
+    }
+
+    storedSize = record.m_StoredOffset + record.m_Capacity + s_RecordOverhead;
+  }
+
+  if (file->m_IsWal && (p_Size < s_WalHeaderSize))
+  {
+    file->m_WalPageSize = 0;
+  }
+
+  file->m_StoredSize = -1;
+  sqlite3_file* realFile = file->m_RealFile;
+  return realFile->pMethods->xTruncate(realFile, storedSize);
+}
+
+static int FileSync(sqlite3_file* p_File, int p_Flags)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xSync(realFile, p_Flags);
+}
+
+static int FileSize(sqlite3_file* p_File, sqlite3_int64* p_Size)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  int rv = LoadKey(file, false /* p_Create */);
+  if (rv != SQLITE_OK) return rv;
+
+  *p_Size = 0;
+  return file->m_HasKey ? GetLogicalSize(file, *p_Size) : SQLITE_OK;
+}
+
+static int FileLock(sqlite3_file* p_File, int p_Lock)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xLock(realFile, p_Lock);
+}
+
+static int FileUnlock(sqlite3_file* p_File, int p_Lock)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xUnlock(realFile, p_Lock);
+}
+
+static int FileCheckReservedLock(sqlite3_file* p_File, int* p_ResOut)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xCheckReservedLock(realFile, p_ResOut);
+}
+
+static int FileControl(sqlite3_file* p_File, int p_Op, void* p_Arg)
+{
+  switch (p_Op)
+  {
+    case SQLITE_FCNTL_SIZE_HINT:
+    case SQLITE_FCNTL_CHUNK_SIZE:
+      return SQLITE_OK; // hints refer to logical size, which differs from stored size
+
+    default:
+      break;
+  }
+
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xFileControl(realFile, p_Op, p_Arg);
+}
+
+static int FileSectorSize(sqlite3_file* p_File)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return std::max(realFile->pMethods->xSectorSize(realFile), s_BlockSize);
+}
+
+static int FileDeviceCharacteristics(sqlite3_file* p_File)
+{
+  // writes not covering full records read-modify-write them, so are neither atomic nor powersafe
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xDeviceCharacteristics(realFile) &
+    (SQLITE_IOCAP_SEQUENTIAL | SQLITE_IOCAP_UNDELETABLE_WHEN_OPEN | SQLITE_IOCAP_IMMUTABLE);
+}
+
+static int FileShmMap(sqlite3_file* p_File, int p_Page, int p_PageSize, int p_Extend, void volatile** p_Mem)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xShmMap(realFile, p_Page, p_PageSize, p_Extend, p_Mem);
+}
+
+static int FileShmLock(sqlite3_file* p_File, int p_Offset, int p_Count, int p_Flags)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xShmLock(realFile, p_Offset, p_Count, p_Flags);
+}
+
+static void FileShmBarrier(sqlite3_file* p_File)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  realFile->pMethods->xShmBarrier(realFile);
+}
+
+static int FileShmUnmap(sqlite3_file* p_File, int p_DeleteFlag)
+{
+  sqlite3_file* realFile = ((CryptoFile*)p_File)->m_RealFile;
+  return realFile->pMethods->xShmUnmap(realFile, p_DeleteFlag);
+}
+
+// version 2 io methods, as memory mapped access (version 3) would bypass decryption
+static const sqlite3_io_methods s_IoMethods =
+{
+  2,
+  FileClose,
+  FileRead,
+  FileWrite,
+  FileTruncate,
+  FileSync,
+  FileSize,
+  FileLock,
+  FileUnlock,
+  FileCheckReservedLock,
+  FileControl,
+  FileSectorSize,
+  FileDeviceCharacteristics,
+  FileShmMap,
+  FileShmLock,
+  FileShmBarrier,
+  FileShmUnmap,
+  nullptr,
+  nullptr,
+};
+
+static sqlite3_vfs* RootVfs(sqlite3_vfs* p_Vfs)
+{
+  return ((CryptoVfsData*)p_Vfs->pAppData)->m_RootVfs;
+}
+
+static int VfsOpen(sqlite3_vfs* p_Vfs, const char* p_Name, sqlite3_file* p_File, int p_Flags, int* p_OutFlags)
+{
+  CryptoFile* file = (CryptoFile*)p_File;
+  memset(file, 0, sizeof(CryptoFile));
+  file->m_VfsData = (CryptoVfsData*)p_Vfs->pAppData;
+  file->m_RealFile = (sqlite3_file*)(file + 1);
+
+  int outFlags = 0;
+  sqlite3_vfs* rootVfs = RootVfs(p_Vfs);
+  int rv = rootVfs->xOpen(rootVfs, p_Name, file->m_RealFile, p_Flags, &outFlags);
+  if (rv != SQLITE_OK) return rv;
+
+  if (p_OutFlags != nullptr)
+  {
+    *p_OutFlags = outFlags;
+  }
+
+  file->m_IsMainDb = (p_Flags & SQLITE_OPEN_MAIN_DB) != 0;
+  file->m_IsWal = (p_Flags & SQLITE_OPEN_WAL) != 0;
+  file->m_StoredSize = -1;
+  file->m_Plain = new (std::nothrow) unsigned char[s_MaxRecordSize];
+  file->m_Stored = new (std::nothrow) unsigned char[s_MaxRecordSize + s_RecordOverhead];
+  file->m_Ctx = EVP_CIPHER_CTX_new();
+  const bool readOnly = (outFlags & SQLITE_OPEN_READONLY) != 0;
+  const bool isAllocated = (file->m_Ctx != nullptr) && (file->m_Plain != nullptr) && (file->m_Stored != nullptr);
+  rv = isAllocated ? LoadKey(file, !readOnly /* p_Create */) : SQLITE_NOMEM;
+  if (rv != SQLITE_OK)
+  {
+    FileClose(p_File);
+    return rv;
+  }
+
+  file->m_Base.pMethods = &s_IoMethods;
+  return SQLITE_OK;
+}
+
+static int VfsDelete(sqlite3_vfs* p_Vfs, const char* p_Name, int p_SyncDir)
+{
+  return RootVfs(p_Vfs)->xDelete(RootVfs(p_Vfs), p_Name, p_SyncDir);
+}
+
+static int VfsAccess(sqlite3_vfs* p_Vfs, const char* p_Name, int p_Flags, int* p_ResOut)
+{
+  return RootVfs(p_Vfs)->xAccess(RootVfs(p_Vfs), p_Name, p_Flags, p_ResOut);
+}
+
+static int VfsFullPathname(sqlite3_vfs* p_Vfs, const char* p_Name, int p_OutLen, char* p_Out)
+{
+  return RootVfs(p_Vfs)->xFullPathname(RootVfs(p_Vfs), p_Name, p_OutLen, p_Out);
+}
+
+static void* VfsDlOpen(sqlite3_vfs* p_Vfs, const char* p_Filename)
+{
+  return RootVfs(p_Vfs)->xDlOpen(RootVfs(p_Vfs), p_Filename);
+}
+
+static void VfsDlError(sqlite3_vfs* p_Vfs, int p_BufLen, char* p_Buf)
+{
+  RootVfs(p_Vfs)->xDlError(RootVfs(p_Vfs), p_BufLen, p_Buf);
+}
+
+typedef void (*SymbolFunc)(void);
+
+static SymbolFunc VfsDlSym(sqlite3_vfs* p_Vfs, void* p_Handle, const char* p_Symbol)
+{
+  return RootVfs(p_Vfs)->xDlSym(RootVfs(p_Vfs), p_Handle, p_Symbol);
+}
+
+static void VfsDlClose(sqlite3_vfs* p_Vfs, void* p_Handle)
+{
+  RootVfs(p_Vfs)->xDlClose(RootVfs(p_Vfs), p_Handle);
+}
+
+static int VfsRandomness(sqlite3_vfs* p_Vfs, int p_BufLen, char* p_Buf)
+{
+  return RootVfs(p_Vfs)->xRandomness(RootVfs(p_Vfs), p_BufLen, p_Buf);
+}
+
+static int VfsSleep(sqlite3_vfs* p_Vfs, int p_Microseconds)
+{
+  return RootVfs(p_Vfs)->xSleep(RootVfs(p_Vfs), p_Microseconds);
+}
+
+static int VfsCurrentTime(sqlite3_vfs* p_Vfs, double* p_Time)
+{
+  return RootVfs(p_Vfs)->xCurrentTime(RootVfs(p_Vfs), p_Time);
+}
+
+static int VfsGetLastError(sqlite3_vfs* p_Vfs, int p_BufLen, char* p_Buf)
+{
+  return RootVfs(p_Vfs)->xGetLastError(RootVfs(p_Vfs), p_BufLen, p_Buf);
+}
+
+static int VfsCurrentTimeInt64(sqlite3_vfs* p_Vfs, sqlite3_int64* p_Time)
+{
+  return RootVfs(p_Vfs)->xCurrentTimeInt64(RootVfs(p_Vfs), p_Time);
+}
+
+std::string CryptoVfs::Register(const std::string& p_Pass)
+{
+  std::lock_guard<std::mutex> vfsLock(s_VfsMutex);
+  sqlite3_vfs* rootVfs = sqlite3_vfs_find(nullptr);
+  if ((rootVfs == nullptr) || (rootVfs->iVersion < 2))
+  {
+    LOG_ERROR("no usable default sqlite vfs");
+    return "";
+  }
+
+  std::unique_ptr<CryptoVfsData> vfsData(new CryptoVfsData());
+  vfsData->m_RootVfs = rootVfs;
+  vfsData->m_Name = "nmail-crypto-" + std::to_string(++s_VfsCount);
+  vfsData->m_Pass = p_Pass;
+
+  sqlite3_vfs& vfs = vfsData->m_Vfs;
+  memset(&vfs, 0, sizeof(vfs));
+  vfs.iVersion = 2;
+  vfs.szOsFile = sizeof(CryptoFile) + rootVfs->szOsFile;
+  vfs.mxPathname = rootVfs->mxPathname;
+  vfs.zName = vfsData->m_Name.c_str();
+  vfs.pAppData = vfsData.get();
+  vfs.xOpen = VfsOpen;
+  vfs.xDelete = VfsDelete;
+  vfs.xAccess = VfsAccess;
+  vfs.xFullPathname = VfsFullPathname;
+  vfs.xDlOpen = VfsDlOpen;
+  vfs.xDlError = VfsDlError;
+  vfs.xDlSym = VfsDlSym;
+  vfs.xDlClose = VfsDlClose;
+  vfs.xRandomness = VfsRandomness;
+  vfs.xSleep = VfsSleep;
+  vfs.xCurrentTime = VfsCurrentTime;
+  vfs.xGetLastError = VfsGetLastError;
+  vfs.xCurrentTimeInt64 = VfsCurrentTimeInt64;
+
+  int rv = sqlite3_vfs_register(&vfs, 0 /* makeDflt */);
+  if (rv != SQLITE_OK)
+  {
+    LOG_ERROR("register sqlite vfs failed (%d)", rv);
+    return "";
+  }
+
+  const std::string name = vfsData->m_Name;
+  s_Vfss[name] = std::move(vfsData);
+  return name;
+}
+
+// all connections using the vfs must be closed before unregistering it
+void CryptoVfs::Unregister(const std::string& p_VfsName)
+{
+  std::lock_guard<std::mutex> vfsLock(s_VfsMutex);
+  auto it = s_Vfss.find(p_VfsName);
+  if (it == s_Vfss.end()) return;
+
+  sqlite3_vfs_unregister(&it->second->m_Vfs);
+  for (auto& key : it->second->m_Keys)
+  {
+    OPENSSL_cleanse((void*)key.second.data(), key.second.size());
+  }
+
+  s_Vfss.erase(it);
+}
+
+bool CryptoVfs::IsEncryptedFile(const std::string& p_Path)
+{
+  std::ifstream stream(p_Path, std::ios::binary);
+  char magic[sizeof(s_Magic)] = { 0 };
+  stream.read(magic, sizeof(magic));
+  return stream && (memcmp(magic, s_Magic, sizeof(s_Magic)) == 0);
+}
+
+// uri for opening or attaching a plain db file with default vfs (requires SQLITE_OPEN_URI)
+std::string CryptoVfs::GetPlainUri(const std::string& p_Path)
+{
+  static const char* hexDigits = "0123456789ABCDEF";
+  std::string uri = "file:";
+  for (const unsigned char ch : p_Path)
+  {
+    if (isalnum(ch) || (strchr("/-._~", ch) != nullptr))
+    {
+      uri += (char)ch;
+    }
+    else
+    {
+      uri += '%';
+      uri += hexDigits[ch >> 4];
+      uri += hexDigits[ch & 0xf];
+    }
+  }
+
+  sqlite3_vfs* rootVfs = sqlite3_vfs_find(nullptr);
+  if (rootVfs != nullptr)
+  {
+    uri += std::string("?vfs=") + rootVfs->zName;
+  }
+
+  return uri;
+}
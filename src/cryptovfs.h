@@ -0,0 +1,22 @@
+// cryptovfs.h
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <string>
+
+// SQLite VFS shim encrypting the files it opens (db, wal, journal) using AES-256-GCM in
+// records aligned with sqlite page and wal frame writes, so encrypted databases can be read and
+// written in place.
+class CryptoVfs
+{
+public:
+  static std::string Register(const std::string& p_Pass);
+  static void Unregister(const std::string& p_VfsName);
+  static bool IsEncryptedFile(const std::string& p_Path);
+  static std::string GetPlainUri(const std::string& p_Path);
+};
@@ -21,8 +21,65 @@
 
 static const std::string labelServerTime("X-Nmail-ServerTime: ");
 
+// flat header record, in host byte order:
+//   magic (8), format version (u32), parse version (u32), timestamp (i64), flags (u32),
+//   field count (u32), field end offsets into string arena (u32 * count), string arena
+static const char s_RecordMagic[8] = { 'N', 'M', 'H', 'D', 'R', 'R', 'E', 'C' };
+static const uint32_t s_RecordVersion = 1;
+static const uint32_t s_RecordFlagHasAttachments = 0x1;
+static const size_t s_RecordFixedSize = sizeof(s_RecordMagic) + (4 * sizeof(uint32_t)) + sizeof(int64_t);
+
+// string fields of header record, new fields may only be appended
+enum RecordField
+{
+  RecordFieldData = 0,
+  RecordFieldDate,
+  RecordFieldDateTime,
+  RecordFieldTime,
+  RecordFieldFrom,
+  RecordFieldShortFrom,
+  RecordFieldTo,
+  RecordFieldShortTo,
+  RecordFieldCc,
+  RecordFieldBcc,
+  RecordFieldReplyTo,
+  RecordFieldSubject,
+  RecordFieldMessageId,
+  RecordFieldUniqueId,
+  RecordFieldAddresses, // separated by nul
+  RecordFieldCount,
+};
+
+template<typename T>
+static T ReadValue(const char* p_Data, size_t p_Offset)
+{
+  T value;
+  memcpy(&value, p_Data + p_Offset, sizeof(T));
+  return value;
+}
+
+// returns view of string field in record validated by Header::FromRecord()
+static std::string_view GetRecordField(const std::string& p_Record, int p_Field)
+{
+  const char* data = p_Record.data();
+  const uint32_t fieldCount = ReadValue<uint32_t>(data, s_RecordFixedSize - sizeof(uint32_t));
+  const size_t arenaOffset = s_RecordFixedSize + (fieldCount * sizeof(uint32_t));
+  const uint32_t start =
+    (p_Field == 0) ? 0 : ReadValue<uint32_t>(data, s_RecordFixedSize + ((p_Field - 1) * sizeof(uint32_t)));
+  const uint32_t end = ReadValue<uint32_t>(data, s_RecordFixedSize + (p_Field * sizeof(uint32_t)));
+  return std::string_view(data + arenaOffset + start, end - start);
+}
+
+template<typename T>
+static void AppendValue(std::vector<char>& p_Record, const T& p_Value)
+{
+  const char* data = reinterpret_cast<const char*>(&p_Value);
+  p_Record.insert(p_Record.end(), data, data + sizeof(T));
+}
+
 void Header::SetData(const std::string& p_Data)
 {
+  Unpack();
   m_Data = p_Data;
   ParseIfNeeded();
 }
@@ -30,6 +87,7 @@ void Header::SetData(const std::string& p_Data)
 void Header::SetHeaderData(const std::string& p_HdrData, const std::string& p_StrData,
                            const time_t p_ServerTime)
 {
+  Unpack();
   m_Data =
     labelServerTime + std::to_string(p_ServerTime) + "\n" +
     p_HdrData +
@@ -39,22 +97,28 @@ void Header::SetHeaderData(const std::string& p_HdrData, const std::string& p_St
 
 std::string Header::GetData() const
 {
-  return m_Data;
+  return std::string(GetField(RecordFieldData, m_Data));
 }
 
 std::string Header::GetDate() const
 {
-  return m_Date;
+  return std::string(GetField(RecordFieldDate, m_Date));
+}
+
+std::string Header::GetTime() const
+{
+  return std::string(GetField(RecordFieldTime, m_Time));
 }
 
 std::string Header::GetDateTime() const
 {
-  return m_DateTime;
+  return std::string(GetField(RecordFieldDateTime, m_DateTime));
 }
 
 std::string Header::GetDateOrTime(const std::string& p_CurrentDate) const
 {
-  return (m_Date == p_CurrentDate) ? m_Time : m_Date;
+  const std::string_view date = GetField(RecordFieldDate, m_Date);
+  return std::string((date == p_CurrentDate) ? GetField(RecordFieldTime, m_Time) : date);
 }
 
 time_t Header::GetTimeStamp() const
@@ -64,57 +128,69 @@ time_t Header::GetTimeStamp() const
 
 std::string Header::GetFrom() const
 {
-  return m_From;
+  return std::string(GetField(RecordFieldFrom, m_From));
 }
 
 std::string Header::GetShortFrom() const
 {
-  return m_ShortFrom;
+  return std::string(GetField(RecordFieldShortFrom, m_ShortFrom));
 }
 
 std::string Header::GetTo() const
 {
-  return m_To;
+  return std::string(GetField(RecordFieldTo, m_To));
 }
 
 std::string Header::GetShortTo() const
 {
-  return m_ShortTo;
+  return std::string(GetField(RecordFieldShortTo, m_ShortTo));
 }
 
 std::string Header::GetCc() const
 {
-  return m_Cc;
+  return std::string(GetField(RecordFieldCc, m_Cc));
 }
 
 std::string Header::GetBcc() const
 {
-  return m_Bcc;
+  return std::string(GetField(RecordFieldBcc, m_Bcc));
 }
 
 std::string Header::GetReplyTo() const
 {
-  return m_ReplyTo;
+  return std::string(GetField(RecordFieldReplyTo, m_ReplyTo));
 }
 
 std::string Header::GetSubject() const
 {
-  return m_Subject;
+  return std::string(GetField(RecordFieldSubject, m_Subject));
 }
 
 std::string Header::GetUniqueId() const
 {
-  return m_UniqueId;
+  return std::string(GetField(RecordFieldUniqueId, m_UniqueId));
 }
 
 std::string Header::GetMessageId() const
 {
-  return m_MessageId;
+  return std::string(GetField(RecordFieldMessageId, m_MessageId));
 }
 
 std::set<std::string> Header::GetAddresses() const
 {
-  return m_Addresses;
+  if (!m_Record) return m_Addresses;
+
+  std::set<std::string> addresses;
+  const std::string_view field = GetRecordField(*m_Record, RecordFieldAddresses);
+  size_t pos = 0;
+  while (pos < field.size())
+  {
+    const size_t end = std::min(field.find('\0', pos), field.size());
+    addresses.insert(std::string(field.substr(pos, end - pos)));
+    pos = end + 1;
+  }
+
+  return addresses;
 }
 
 bool Header::GetHasAttachments() const
@@ -127,7 +203,7 @@ std::string Header::GetRawHeaderText(bool p_LocalHeaders)
   std::string& raw = m_RawHeaderText;
   if (!raw.empty()) return raw;
 
-  raw = m_Data;
+  raw = GetData();
   raw.erase(std::remove(raw.begin(), raw.end(), L'\r'), raw.end());
 
   // remove body structure header info
@@ -165,6 +241,8 @@ void Header::Parse()
 {
   // @note: this function should not be called directly, only via ParseIfNeeded()
   LOG_DURATION();
+  Unpack();
+
   time_t headerTimeStamp = 0;
   time_t serverTimeStamp = 0;
 
@@ -394,6 +472,120 @@ std::string Header::GroupToString(mailimf_group* p_Group, const bool p_Short)
   return str;
 }
 
+void Header::ToRecord(std::vector<char>& p_Record) const
+{
+  p_Record.clear();
+  if (m_Record)
+  {
+    p_Record.assign(m_Record->begin(), m_Record->end());
+    return;
+  }
+
+  std::string addresses;
+  for (const auto& address : m_Addresses)
+  {
+    if (!addresses.empty())
+    {
+      addresses += '\0';
+    }
+
+    addresses += address;
+  }
+
+  const std::string* fields[RecordFieldCount] =
+  {
+    &m_Data, &m_Date, &m_DateTime, &m_Time, &m_From, &m_ShortFrom, &m_To, &m_ShortTo, &m_Cc, &m_Bcc,
+    &m_ReplyTo, &m_Subject, &m_MessageId, &m_UniqueId, &addresses,
+  };
+
+  size_t arenaSize = 0;
+  for (const auto* field : fields)
+  {
+    arenaSize += field->size();
+  }
+
+  p_Record.reserve(s_RecordFixedSize + (RecordFieldCount * sizeof(uint32_t)) + arenaSize);
+  p_Record.insert(p_Record.end(), s_RecordMagic, s_RecordMagic + sizeof(s_RecordMagic));
+  AppendValue<uint32_t>(p_Record, s_RecordVersion);
+  AppendValue<uint32_t>(p_Record, m_ParseVersion);
+  AppendValue<int64_t>(p_Record, m_TimeStamp);
+  AppendValue<uint32_t>(p_Record, m_HasAttachments ? s_RecordFlagHasAttachments : 0);
+  AppendValue<uint32_t>(p_Record, RecordFieldCount);
+
+  uint32_t offset = 0;
+  for (const auto* field : fields)
+  {
+    offset += field->size();
+    AppendValue<uint32_t>(p_Record, offset);
+  }
+
+  for (const auto* field : fields)
+  {
+    p_Record.insert(p_Record.end(), field->begin(), field->end());
+  }
+}
+
+bool Header::FromRecord(const char* p_Data, size_t p_Size)
+{
+  if (!IsRecord(p_Data, p_Size)) return false;
+
+  // records of a newer format version may have more fields, but not fewer
+  const uint32_t fieldCount = ReadValue<uint32_t>(p_Data, s_RecordFixedSize - sizeof(uint32_t));
+  const size_t arenaOffset = s_RecordFixedSize + (fieldCount * sizeof(uint32_t));
+  if ((fieldCount < RecordFieldCount) || (arenaOffset > p_Size)) return false;
+
+  uint32_t prevOffset = 0;
+  for (uint32_t i = 0; i < fieldCount; ++i)
+  {
+    const uint32_t offset = ReadValue<uint32_t>(p_Data, s_RecordFixedSize + (i * sizeof(uint32_t)));
+    if ((offset < prevOffset) || (offset > (p_Size - arenaOffset))) return false;
+
+    prevOffset = offset;
+  }
+
+  *this = Header();
+  m_ParseVersion = ReadValue<uint32_t>(p_Data, sizeof(s_RecordMagic) + 4);
+  m_TimeStamp = (time_t)ReadValue<int64_t>(p_Data, sizeof(s_RecordMagic) + 8);
+  m_HasAttachments = (ReadValue<uint32_t>(p_Data, sizeof(s_RecordMagic) + 16) & s_RecordFlagHasAttachments) != 0;
+  m_Record = std::make_shared<const std::string>(p_Data, p_Size);
+  return true;
+}
+
+bool Header::IsRecord(const char* p_Data, size_t p_Size)
+{
+  // cereal archives of earlier versions start with data size, which cannot match the magic
+  return (p_Size >= s_RecordFixedSize) && (memcmp(p_Data, s_RecordMagic, sizeof(s_RecordMagic)) == 0);
+}
+
+// returns string field from record if set, otherwise specified member value
+std::string_view Header::GetField(int p_Field, const std::string& p_Value) const
+{
+  return m_Record ? GetRecordField(*m_Record, p_Field) : std::string_view(p_Value);
+}
+
+// copies record fields into members, before modifying them
+void Header::Unpack()
+{
+  if (!m_Record) return;
+
+  m_Data = GetData();
+  m_Date = GetDate();
+  m_DateTime = GetDateTime();
+  m_Time = std::string(GetField(RecordFieldTime, m_Time));
+  m_From = GetFrom();
+  m_ShortFrom = GetShortFrom();
+  m_To = GetTo();
+  m_ShortTo = GetShortTo();
+  m_Cc = GetCc();
+  m_Bcc = GetBcc();
+  m_ReplyTo = GetReplyTo();
+  m_Subject = GetSubject();
+  m_MessageId = GetMessageId();
+  m_UniqueId = GetUniqueId();
+  m_Addresses = GetAddresses();
+  m_Record.reset();
+}
+
 size_t Header::GetCurrentParseVersion()
 {
   static size_t parseVersion = 2; // update offset when parsing changes
@@ -8,8 +8,10 @@
 #pragma once
 
 #include <ctime>
+#include <memory>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Header
@@ -21,6 +23,7 @@ public:
   std::string GetData() const;
 
   std::string GetDate() const;
+  std::string GetTime() const;
   std::string GetDateTime() const;
   std::string GetDateOrTime(const std::string& p_CurrentDate) const;
   time_t GetTimeStamp() const;
@@ -46,8 +49,21 @@ public:
     return true;
   }
 
+  inline bool IsParseCurrent() const
+  {
+    return (m_ParseVersion == GetCurrentParseVersion());
+  }
+
+  static size_t GetCurrentParseVersion();
+
+  // flat record format used for caching, string fields are read in place from the record
+  void ToRecord(std::vector<char>& p_Record) const;
+  bool FromRecord(const char* p_Data, size_t p_Size);
+  static bool IsRecord(const char* p_Data, size_t p_Size);
+
+  // decodes header cached by earlier versions, see ToRecord() for current format
   template<class Archive>
-  void serialize(Archive& p_Archive)
+  void load(Archive& p_Archive)
   {
     p_Archive(m_Data,
               m_ParseVersion,
@@ -81,9 +97,12 @@ private:
                               const bool p_Short = false);
   std::string GroupToString(struct mailimf_group* p_Group,
                             const bool p_Short = false);
-  size_t GetCurrentParseVersion();
+  std::string_view GetField(int p_Field, const std::string& p_Value) const;
+  void Unpack();
 
 private:
+  std::shared_ptr<const std::string> m_Record;
+
   std::string m_Data;
 
   size_t m_ParseVersion = 0;
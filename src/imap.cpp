@@ -10,6 +10,7 @@
 #include "libetpan_help.h"
 #include <libetpan/imapdriver_tools.h>
 #include <libetpan/mailimap.h>
+#include <libetpan/mailstream_compress.h>
 
 #include "auth.h"
 #include "encoding.h"
@@ -22,11 +23,24 @@
 #include "sethelp.h"
 #include "util.h"
 
+// command line length reserved for tag, command, fetch attributes and folder name, besides the uid set
+static const size_t s_UidSetReserve = 512;
+
+// max number of fetches when locating expunged uids, and sequence range fetched at once instead of bisected
+static const int s_MaxUidProbes = 32;
+static const int64_t s_UidProbeRange = 64;
+
+// max total size and message count fetched by a single body fetch command
+static const uint64_t s_BodyChunkSize = 8 * 1024 * 1024;
+static const size_t s_BodyChunkCount = 256;
+
 Imap::Imap(const std::string& p_User, const std::string& p_Pass, const std::string& p_Host,
            const uint16_t p_Port, const int64_t p_Timeout,
            const bool p_CacheEncrypt, const bool p_CacheIndexEncrypt,
            const std::set<std::string>& p_FoldersExclude,
            const bool p_SniEnabled,
+           const uint32_t p_MaxLineLen,
+           const bool p_CompressEnabled,
            const std::function<void(const StatusUpdate&)>& p_StatusHandler)
   : m_User(p_User)
   , m_Pass(p_Pass)
@@ -37,6 +51,8 @@ Imap::Imap(const std::string& p_User, const std::string& p_Pass, const std::stri
   , m_CacheIndexEncrypt(p_CacheIndexEncrypt)
   , m_FoldersExclude(p_FoldersExclude)
   , m_SniEnabled(p_SniEnabled)
+  , m_MaxLineLen(p_MaxLineLen)
+  , m_CompressEnabled(p_CompressEnabled)
 {
   if (Log::GetTraceEnabled())
   {
@@ -49,10 +65,31 @@ Imap::Imap(const std::string& p_User, const std::string& p_Pass, const std::stri
 
   InitImap();
 
-  m_ImapCache.reset(new ImapCache(m_CacheEncrypt, m_Pass));
+  m_ImapCache.reset(new ImapCache(m_CacheEncrypt, m_Pass, p_StatusHandler));
   m_ImapIndex.reset(new ImapIndex(m_CacheIndexEncrypt, m_Pass, m_ImapCache, p_StatusHandler));
 }
 
+Imap::Imap(const Imap& p_Imap, const uint32_t p_ConnId)
+  : m_User(p_Imap.m_User)
+  , m_Pass(p_Imap.m_Pass)
+  , m_Host(p_Imap.m_Host)
+  , m_Port(p_Imap.m_Port)
+  , m_Timeout(p_Imap.m_Timeout)
+  , m_CacheEncrypt(p_Imap.m_CacheEncrypt)
+  , m_CacheIndexEncrypt(p_Imap.m_CacheIndexEncrypt)
+  , m_FoldersExclude(p_Imap.m_FoldersExclude)
+  , m_SniEnabled(p_Imap.m_SniEnabled)
+  , m_MaxLineLen(p_Imap.m_MaxLineLen)
+  , m_ConnId(p_ConnId)
+  , m_CompressEnabled(p_Imap.m_CompressEnabled)
+  , m_ImapCache(p_Imap.m_ImapCache)
+  , m_ImapIndex(p_Imap.m_ImapIndex)
+{
+  LOG_DEBUG_FUNC(STR(p_ConnId));
+
+  InitImap();
+}
+
 Imap::~Imap()
 {
   LOG_DEBUG_FUNC(STR());
@@ -154,9 +191,18 @@ bool Imap::Login()
   {
     std::lock_guard<std::mutex> imapLock(m_ImapMutex);
     m_SelectedFolder.clear();
+    m_QresyncEnabled = false;
+    m_Compressed = false;
+
+    {
+      std::lock_guard<std::mutex> compressStatsLock(m_CompressStatsMutex);
+      m_CompressStats.m_CompressedBytes += m_SessionCompressStats.m_CompressedBytes;
+      m_CompressStats.m_UncompressedBytes += m_SessionCompressStats.m_UncompressedBytes;
+      m_SessionCompressStats = CompressStats();
+    }
 
-    LOG_DEBUG("login connect: host=%s port=%d sni=%d dns=[%s]",
-              m_Host.c_str(), (int)m_Port, (int)m_SniEnabled,
+    LOG_DEBUG("login connect: id=%d host=%s port=%d sni=%d dns=[%s]",
+              (int)m_ConnId, m_Host.c_str(), (int)m_Port, (int)m_SniEnabled,
               ImapUtil::GetHostAddresses(m_Host).c_str());
 
     const int64_t connectStartMs = ImapUtil::GetTimeMs();
@@ -224,6 +270,16 @@ bool Imap::Login()
       retried = true;
       connected = LoginRetryAlternateIp(peerIp, serverId, connAddrs);
     }
+
+    if (connected && m_CompressEnabled && HasCapability("COMPRESS=DEFLATE"))
+    {
+      m_Compressed = EnableCompress();
+    }
+
+    if (connected && HasCapability("QRESYNC"))
+    {
+      m_QresyncEnabled = EnableQresync();
+    }
   }
 
   {
@@ -268,9 +324,19 @@ bool Imap::Logout()
     std::lock_guard<std::mutex> imapLock(m_ImapMutex);
     if (m_Imap != NULL)
     {
+      if (m_Compressed)
+      {
+        UpdateCompressStats();
+        std::lock_guard<std::mutex> compressStatsLock(m_CompressStatsMutex);
+        LOG_DEBUG("compress session: compressed %llu bytes uncompressed %llu bytes",
+                  (unsigned long long)m_SessionCompressStats.m_CompressedBytes,
+                  (unsigned long long)m_SessionCompressStats.m_UncompressedBytes);
+      }
+
       rv = LOG_IF_IMAP_LOGOUT_ERR(mailimap_logout(m_Imap));
     }
     m_SelectedFolder.clear();
+    m_Compressed = false;
 
     m_Connected = false;
   }
@@ -528,40 +594,22 @@ bool Imap::GetUids(const std::string& p_Folder, const bool p_Cached, std::set<ui
     return true;
   }
 
-  struct mailimap_set* set = mailimap_set_new_interval(1, 0);
-  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
-  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
-  clist* fetch_result = NULL;
-
-  int rv = LOG_IF_IMAP_ERR(mailimap_fetch(m_Imap, set, fetch_type, &fetch_result));
-  if (rv == MAILIMAP_NO_ERROR)
+  // fetch only uids above cached ones, and locate expunged ones by probing, before resorting to a full fetch
+  const std::set<uint32_t> cachedUids = m_ImapCache->GetUids(p_Folder);
+  bool rv = !cachedUids.empty() && GetUidsIncremental(cachedUids, p_Uids);
+  if (!rv)
   {
-    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
-    {
-      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
-
-      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
-      {
-        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(ait);
-        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
-
-        if (item->att_data.att_static->att_type != MAILIMAP_MSG_ATT_UID) continue;
-
-        p_Uids.insert(item->att_data.att_static->att_data.att_uid);
-        break;
-      }
-    }
-
-    mailimap_fetch_list_free(fetch_result);
+    p_Uids.clear();
+    rv = FetchUids(1, 0 /* '*' */, false /* p_ByUid */, p_Uids);
+  }
 
+  if (rv)
+  {
     m_ImapCache->SetUids(p_Folder, p_Uids);
     m_ImapIndex->SetUids(p_Folder, p_Uids);
   }
 
-  mailimap_fetch_type_free(fetch_type);
-  mailimap_set_free(set);
-
-  return (rv == MAILIMAP_NO_ERROR);
+  return rv;
 }
 
 bool Imap::GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
@@ -570,19 +618,13 @@ bool Imap::GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_U
 {
   LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Headers));
 
-  bool needFetch = false;
-  struct mailimap_set* set = mailimap_set_new_empty();
+  std::set<uint32_t> uidsNotCached;
 
   p_Headers = m_ImapCache->GetHeaders(p_Folder, p_Uids, p_Prefetch);
 
   if (!p_Cached)
   {
-    std::set<uint32_t> uidsNotCached = p_Uids - MapKey(p_Headers);
-    for (auto& uid : uidsNotCached)
-    {
-      mailimap_set_add_single(set, uid);
-      needFetch = true;
-    }
+    uidsNotCached = p_Uids - MapKey(p_Headers);
   }
 
   if (p_Prefetch)
@@ -593,21 +635,18 @@ bool Imap::GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_U
 
   if (p_Cached)
   {
-    mailimap_set_free(set);
     return true;
   }
 
   int rv = MAILIMAP_NO_ERROR;
 
-  if (needFetch)
+  if (!uidsNotCached.empty())
   {
-    clist* fetch_result = NULL;
     std::map<uint32_t, Header> cacheHeaders;
     std::lock_guard<std::mutex> imapLock(m_ImapMutex);
 
     if (!SelectFolder(p_Folder))
     {
-      mailimap_set_free(set);
       return false;
     }
 
@@ -617,9 +656,13 @@ bool Imap::GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_U
     mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_internaldate());
     mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_bodystructure());
 
-    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
-    if (rv == MAILIMAP_NO_ERROR)
+    std::vector<struct mailimap_set*> sets = NewUidSets(uidsNotCached);
+    for (auto& set : sets)
     {
+      clist* fetch_result = NULL;
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
+      if (rv != MAILIMAP_NO_ERROR) break;
+
       for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
       {
         struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
@@ -700,13 +743,13 @@ bool Imap::GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_U
       mailimap_fetch_list_free(fetch_result);
     }
 
+    ImapUtil::FreeUidSets(sets);
+
     m_ImapCache->SetHeaders(p_Folder, cacheHeaders);
 
     mailimap_fetch_type_free(fetch_type);
   }
 
-  mailimap_set_free(set);
-
   return (rv == MAILIMAP_NO_ERROR);
 }
 
@@ -726,89 +769,78 @@ bool Imap::GetFlags(const std::string& p_Folder, const std::set<uint32_t>& p_Uid
     return true;
   }
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
-  {
-    mailimap_set_add_single(set, uid);
-  }
-
   std::lock_guard<std::mutex> imapLock(m_ImapMutex);
 
   if (!SelectFolder(p_Folder))
   {
-    mailimap_set_free(set);
     return false;
   }
 
-  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
-  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
-  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
-
-  clist* fetch_result = NULL;
-
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
-  if (rv == MAILIMAP_NO_ERROR)
+  // with condstore only flags changed since last sync are fetched, and qresync also reports expunged uids
+  bool withModSeq = (HasCapability("CONDSTORE") || HasCapability("QRESYNC")) &&
+    (m_NoModSeqFolders.count(p_Folder) == 0);
+  uint64_t modSeq = withModSeq ? m_ImapCache->GetModSeq(p_Folder) : 0;
+  uint64_t highestModSeq = modSeq;
+  std::map<uint32_t, uint32_t> fetchedFlags;
+  std::set<uint32_t> vanishedUids;
+  std::set<uint32_t> fullUids = p_Uids;
+  int rv = MAILIMAP_NO_ERROR;
+  if (modSeq > 0)
   {
-    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    rv = FetchFlags(p_Uids, modSeq, true /* p_WithModSeq */, fetchedFlags, vanishedUids, highestModSeq);
+    if (rv == MAILIMAP_NO_ERROR)
     {
-      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
-
-      uint32_t uid = 0;
-      uint32_t flag = 0;
-      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
-      {
-        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(ait);
-
-        if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC)
-        {
-          if (item->att_data.att_dyn->att_list != NULL)
-          {
-            for (clistiter* dit = clist_begin(item->att_data.att_dyn->att_list); dit != NULL;
-                 dit = clist_next(dit))
-            {
-              struct mailimap_flag_fetch* flag_fetch =
-                (struct mailimap_flag_fetch*)clist_content(dit);
-              if (flag_fetch && flag_fetch->fl_flag)
-              {
-                switch (flag_fetch->fl_flag->fl_type)
-                {
-                  case MAILIMAP_FLAG_SEEN:
-                    flag |= Flag::Seen;
-                    break;
+      // uids without cached flags, e.g. discovered after sync state was stored, are fetched in full
+      const std::set<uint32_t> unchangedUids = p_Uids - MapKey(fetchedFlags) - vanishedUids;
+      p_Flags = m_ImapCache->GetFlags(p_Folder, unchangedUids);
+      fullUids = unchangedUids - MapKey(p_Flags);
+      LOG_DEBUG("folder %s changed %d vanished %d missing %d", p_Folder.c_str(), (int)fetchedFlags.size(),
+                (int)vanishedUids.size(), (int)fullUids.size());
+    }
+    else if (rv == MAILIMAP_ERROR_STREAM)
+    {
+      return false;
+    }
+    else
+    {
+      LOG_WARNING("folder %s changedsince fetch failed, fallback to full fetch", p_Folder.c_str());
+      m_ImapCache->SetModSeq(p_Folder, 0);
+      modSeq = 0;
+      highestModSeq = 0;
+    }
+  }
 
-                  default:
-                    break;
-                }
-              }
-            }
-          }
-        }
-        else if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
-        {
-          if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
-          {
-            uid = item->att_data.att_static->att_data.att_uid;
-          }
-        }
-      }
+  if (!fullUids.empty())
+  {
+    rv = FetchFlags(fullUids, 0, withModSeq, fetchedFlags, vanishedUids, highestModSeq);
+    if (withModSeq && (rv != MAILIMAP_NO_ERROR) && (rv != MAILIMAP_ERROR_STREAM))
+    {
+      // mailbox without persistent mod-sequences (NOMODSEQ) rejects fetching them
+      LOG_INFO("folder %s no modseq support", p_Folder.c_str());
+      m_NoModSeqFolders.insert(p_Folder);
+      withModSeq = false;
+      rv = FetchFlags(fullUids, 0, withModSeq, fetchedFlags, vanishedUids, highestModSeq);
+    }
+  }
 
-      if (uid == 0)
-      {
-        LOG_WARNING("skip flag uid = %d", uid);
-        continue;
-      }
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    p_Flags.insert(fetchedFlags.begin(), fetchedFlags.end());
+    m_ImapCache->SetFlags(p_Folder, fetchedFlags);
 
-      p_Flags[uid] = flag;
+    if (!vanishedUids.empty())
+    {
+      m_ImapCache->DeleteMessages(p_Folder, vanishedUids);
+      m_ImapIndex->DeleteMessages(p_Folder, vanishedUids);
     }
 
-    mailimap_fetch_list_free(fetch_result);
-
-    m_ImapCache->SetFlags(p_Folder, p_Flags);
+    // sync state is only advanced when all cached messages of the folder were covered
+    if (withModSeq && (highestModSeq > modSeq) && (m_ImapCache->GetUids(p_Folder) - p_Uids).empty())
+    {
+      m_ImapCache->SetModSeq(p_Folder, highestModSeq);
+    }
   }
 
-  mailimap_fetch_type_free(fetch_type);
-  mailimap_set_free(set);
-
   return (rv == MAILIMAP_NO_ERROR);
 }
 
@@ -818,18 +850,25 @@ bool Imap::GetBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uid
 {
   LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Bodys));
 
-  bool needFetch = false;
-  struct mailimap_set* set = mailimap_set_new_empty();
+  std::set<uint32_t> uidsNotCached;
 
   p_Bodys = m_ImapCache->GetBodys(p_Folder, p_Uids, p_Prefetch);
 
   if (!p_Cached)
   {
-    std::set<uint32_t> uidsNotCached = p_Uids - MapKey(p_Bodys);
-    for (auto& uid : uidsNotCached)
+    uidsNotCached = p_Uids - MapKey(p_Bodys);
+
+    // messages already cached in another folder are linked instead of fetched again
+    const std::set<uint32_t> uidsLinked = m_ImapCache->LinkBodys(p_Folder, uidsNotCached);
+    if (!uidsLinked.empty())
     {
-      mailimap_set_add_single(set, uid);
-      needFetch = true;
+      if (!p_Prefetch)
+      {
+        const std::map<uint32_t, Body> linkedBodys = m_ImapCache->GetBodys(p_Folder, uidsLinked, false);
+        p_Bodys.insert(linkedBodys.begin(), linkedBodys.end());
+      }
+
+      uidsNotCached = uidsNotCached - uidsLinked;
     }
   }
 
@@ -841,94 +880,114 @@ bool Imap::GetBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uid
 
   if (p_Cached)
   {
-    mailimap_set_free(set);
     return true;
   }
 
   int rv = MAILIMAP_NO_ERROR;
 
-  if (needFetch)
+  if (!uidsNotCached.empty())
   {
     std::lock_guard<std::mutex> imapLock(m_ImapMutex);
 
     if (!SelectFolder(p_Folder))
     {
-      mailimap_set_free(set);
       return false;
     }
 
+    // sizes are only needed to split multi-message fetches, a failed size fetch just yields count-bounded chunks
+    std::map<uint32_t, uint32_t> sizes;
+    if (uidsNotCached.size() > 1)
+    {
+      FetchSizes(uidsNotCached, sizes);
+    }
+
     struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
     struct mailimap_fetch_att* body_att =
       mailimap_fetch_att_new_body_peek_section(mailimap_section_new(NULL));
     mailimap_fetch_type_new_fetch_att_list_add(fetch_type, body_att);
     mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
 
-    clist* fetch_result = NULL;
+    // bodys are parsed and stored per chunk, so at most one chunk's response is held in memory
     std::map<uint32_t, Body> cacheBodys;
-
-    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
-    if (rv == MAILIMAP_NO_ERROR)
+    const std::vector<std::set<uint32_t>> chunks = SplitBySize(uidsNotCached, sizes);
+    for (const auto& chunk : chunks)
     {
-      for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+      std::vector<struct mailimap_set*> sets = NewUidSets(chunk);
+      for (auto& set : sets)
       {
-        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+        clist* fetch_result = NULL;
+        rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
+        if (rv != MAILIMAP_NO_ERROR) break;
 
-        uint32_t uid = 0;
-        Body body;
-        for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+        for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
         {
-          struct mailimap_msg_att_item* item =
-            (struct mailimap_msg_att_item*)clist_content(ait);
-
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
+          struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
 
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+          uint32_t uid = 0;
+          Body body;
+          for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
           {
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION)
-            {
-              std::string data(item->att_data.att_static->att_data.att_body_section->sec_body_part,
-                               item->att_data.att_static->att_data.att_body_section->sec_length);
-              body.SetData(data);
-            }
+            struct mailimap_msg_att_item* item =
+              (struct mailimap_msg_att_item*)clist_content(ait);
 
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+            if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
+
+            if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
             {
-              uid = item->att_data.att_static->att_data.att_uid;
+              if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION)
+              {
+                std::string data(item->att_data.att_static->att_data.att_body_section->sec_body_part,
+                                 item->att_data.att_static->att_data.att_body_section->sec_length);
+                body.SetData(data);
+              }
+
+              if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+              {
+                uid = item->att_data.att_static->att_data.att_uid;
+              }
             }
           }
-        }
 
-        if (uid == 0)
-        {
-          LOG_WARNING("skip body uid = %d", uid);
-          continue;
-        }
+          if (uid == 0)
+          {
+            LOG_WARNING("skip body uid = %d", uid);
+            continue;
+          }
 
-        if (body.GetData().empty())
-        {
-          LOG_WARNING("skip body = \"\"");
-          continue;
-        }
+          if (body.GetData().empty())
+          {
+            LOG_WARNING("skip body = \"\"");
+            continue;
+          }
 
-        if (!p_Prefetch)
-        {
-          p_Bodys[uid] = body;
+          if (!p_Prefetch)
+          {
+            p_Bodys[uid] = body;
+          }
+
+          cacheBodys[uid] = body;
         }
 
-        cacheBodys[uid] = body;
+        mailimap_fetch_list_free(fetch_result);
       }
 
-      mailimap_fetch_list_free(fetch_result);
-    }
+      ImapUtil::FreeUidSets(sets);
+
+      // store each completed chunk before fetching the next, keeping memory bounded and progress visible
+      if (!cacheBodys.empty())
+      {
+        LOG_DEBUG("store %d bodys", (int)cacheBodys.size());
+        m_ImapCache->SetBodys(p_Folder, cacheBodys);
+        m_ImapIndex->SetBodys(p_Folder, MapKey(cacheBodys));
+        cacheBodys.clear();
+      }
 
-    m_ImapCache->SetBodys(p_Folder, cacheBodys);
-    m_ImapIndex->SetBodys(p_Folder, MapKey(cacheBodys));
+      if (rv != MAILIMAP_NO_ERROR) break;
+    }
 
     mailimap_fetch_type_free(fetch_type);
   }
 
-  mailimap_set_free(set);
-
   return (rv == MAILIMAP_NO_ERROR);
 }
 
@@ -947,23 +1006,23 @@ bool Imap::SetFlagSeen(const std::string& p_Folder, const std::set<uint32_t>& p_
   struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
   mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
-  {
-    mailimap_set_add_single(set, uid);
-  }
-
   struct mailimap_store_att_flags* storeflags = p_Value
     ? mailimap_store_att_flags_new_add_flags(flaglist) : mailimap_store_att_flags_new_remove_flags(flaglist);
 
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
+  {
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
 
   if (storeflags != NULL)
   {
     mailimap_store_att_flags_free(storeflags);
   }
 
-  mailimap_set_free(set);
+  ImapUtil::FreeUidSets(sets);
 
   if (rv == MAILIMAP_NO_ERROR)
   {
@@ -988,18 +1047,18 @@ bool Imap::SetFlagDeleted(const std::string& p_Folder, const std::set<uint32_t>&
   struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
   mailimap_flag_list_add(flaglist, mailimap_flag_new_deleted());
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
-  {
-    mailimap_set_add_single(set, uid);
-  }
-
   struct mailimap_store_att_flags* storeflags = p_Value
     ? mailimap_store_att_flags_new_add_flags(flaglist) : mailimap_store_att_flags_new_remove_flags(flaglist);
 
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
+  {
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
 
-  mailimap_set_free(set);
+  ImapUtil::FreeUidSets(sets);
 
   if (storeflags != NULL)
   {
@@ -1021,16 +1080,16 @@ bool Imap::MoveMessages(const std::string& p_Folder, const std::set<uint32_t>& p
     return false;
   }
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  const std::string encDestFolder = EncodeFolderName(p_DestFolder);
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
   {
-    mailimap_set_add_single(set, uid);
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_move(m_Imap, set, encDestFolder.c_str()));
+    if (rv != MAILIMAP_NO_ERROR) break;
   }
 
-  const std::string encDestFolder = EncodeFolderName(p_DestFolder);
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_move(m_Imap, set, encDestFolder.c_str()));
-
-  mailimap_set_free(set);
+  ImapUtil::FreeUidSets(sets);
 
   if (rv == MAILIMAP_NO_ERROR)
   {
@@ -1053,16 +1112,16 @@ bool Imap::CopyMessages(const std::string& p_Folder, const std::set<uint32_t>& p
     return false;
   }
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  const std::string encDestFolder = EncodeFolderName(p_DestFolder);
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
   {
-    mailimap_set_add_single(set, uid);
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_copy(m_Imap, set, encDestFolder.c_str()));
+    if (rv != MAILIMAP_NO_ERROR) break;
   }
 
-  const std::string encDestFolder = EncodeFolderName(p_DestFolder);
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_copy(m_Imap, set, encDestFolder.c_str()));
-
-  mailimap_set_free(set);
+  ImapUtil::FreeUidSets(sets);
 
   return (rv == MAILIMAP_NO_ERROR);
 }
@@ -1347,6 +1406,434 @@ Imap::FolderInfo Imap::GetFolderInfo(const std::string& p_Folder)
   return folderInfo;
 }
 
+Imap::CompressStats Imap::GetCompressStats()
+{
+  // skip refresh rather than wait while a command is in progress on this connection
+  std::unique_lock<std::mutex> imapLock(m_ImapMutex, std::try_to_lock);
+  if (imapLock.owns_lock())
+  {
+    UpdateCompressStats();
+  }
+
+  std::lock_guard<std::mutex> compressStatsLock(m_CompressStatsMutex);
+  CompressStats compressStats = m_CompressStats;
+  compressStats.m_CompressedBytes += m_SessionCompressStats.m_CompressedBytes;
+  compressStats.m_UncompressedBytes += m_SessionCompressStats.m_UncompressedBytes;
+  return compressStats;
+}
+
+// must be called with imap lock held and folder selected
+int Imap::FetchFlags(const std::set<uint32_t>& p_Uids, const uint64_t p_ChangedSince, const bool p_WithModSeq,
+                     std::map<uint32_t, uint32_t>& p_Flags, std::set<uint32_t>& p_VanishedUids,
+                     uint64_t& p_HighestModSeq)
+{
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
+  if (p_WithModSeq)
+  {
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_modseq());
+  }
+
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
+  {
+    clist* fetch_result = NULL;
+    struct mailimap_qresync_vanished* vanished = NULL;
+
+    if (p_ChangedSince == 0)
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
+    }
+    else if (m_QresyncEnabled)
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch_qresync(m_Imap, set, fetch_type, p_ChangedSince,
+                                                      &fetch_result, &vanished));
+    }
+    else
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch_changedsince(m_Imap, set, fetch_type, p_ChangedSince,
+                                                           &fetch_result));
+    }
+
+    if ((rv == MAILIMAP_NO_ERROR) && (fetch_result != NULL))
+    {
+      for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+      {
+        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+        uint32_t uid = 0;
+        uint32_t flag = 0;
+        for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+        {
+          struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(ait);
+
+          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC)
+          {
+            if (item->att_data.att_dyn->att_list != NULL)
+            {
+              for (clistiter* dit = clist_begin(item->att_data.att_dyn->att_list); dit != NULL;
+                   dit = clist_next(dit))
+              {
+                struct mailimap_flag_fetch* flag_fetch =
+                  (struct mailimap_flag_fetch*)clist_content(dit);
+                if (flag_fetch && flag_fetch->fl_flag)
+                {
+                  switch (flag_fetch->fl_flag->fl_type)
+                  {
+                    case MAILIMAP_FLAG_SEEN:
+                      flag |= Flag::Seen;
+                      break;
+
+                    default:
+                      break;
+                  }
+                }
+              }
+            }
+          }
+          else if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+          {
+            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+            {
+              uid = item->att_data.att_static->att_data.att_uid;
+            }
+          }
+          else if (item->att_type == MAILIMAP_MSG_ATT_ITEM_EXTENSION)
+          {
+            struct mailimap_extension_data* ext_data = item->att_data.att_extension_data;
+            if ((ext_data != NULL) && (ext_data->ext_extension->ext_id == MAILIMAP_EXTENSION_CONDSTORE) &&
+                (ext_data->ext_type == MAILIMAP_CONDSTORE_TYPE_FETCH_DATA))
+            {
+              struct mailimap_condstore_fetch_mod_resp* mod_resp =
+                (struct mailimap_condstore_fetch_mod_resp*)ext_data->ext_data;
+              p_HighestModSeq = std::max(p_HighestModSeq, mod_resp->cs_modseq_value);
+            }
+          }
+        }
+
+        if (uid == 0)
+        {
+          LOG_WARNING("skip flag uid = %d", uid);
+          continue;
+        }
+
+        p_Flags[uid] = flag;
+      }
+
+      mailimap_fetch_list_free(fetch_result);
+    }
+
+    // on error libetpan frees fetch result and vanished uids itself
+    if ((rv == MAILIMAP_NO_ERROR) && (vanished != NULL))
+    {
+      // vanished ranges may span uids never cached, so only requested uids are checked against them
+      for (clistiter* it = clist_begin(vanished->qr_known_uids->set_list); it != NULL; it = clist_next(it))
+      {
+        struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(it);
+        for (auto uidIt = p_Uids.lower_bound(item->set_first);
+             (uidIt != p_Uids.end()) && (*uidIt <= item->set_last); ++uidIt)
+        {
+          p_VanishedUids.insert(*uidIt);
+        }
+      }
+
+      mailimap_qresync_vanished_free(vanished);
+    }
+
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
+
+  ImapUtil::FreeUidSets(sets);
+  mailimap_fetch_type_free(fetch_type);
+
+  return rv;
+}
+
+// must be called with imap lock held and folder selected, p_Last zero denotes '*'
+bool Imap::FetchUids(const uint32_t p_First, const uint32_t p_Last, const bool p_ByUid, std::set<uint32_t>& p_Uids)
+{
+  struct mailimap_set* set = mailimap_set_new_interval(p_First, p_Last);
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  clist* fetch_result = NULL;
+
+  int rv = p_ByUid ? LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result))
+                   : LOG_IF_IMAP_ERR(mailimap_fetch(m_Imap, set, fetch_type, &fetch_result));
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+      {
+        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(ait);
+        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
+
+        if (item->att_data.att_static->att_type != MAILIMAP_MSG_ATT_UID) continue;
+
+        p_Uids.insert(item->att_data.att_static->att_data.att_uid);
+        break;
+      }
+    }
+
+    mailimap_fetch_list_free(fetch_result);
+  }
+
+  mailimap_fetch_type_free(fetch_type);
+  mailimap_set_free(set);
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+// must be called with imap lock held and folder selected
+bool Imap::FetchSizes(const std::set<uint32_t>& p_Uids, std::map<uint32_t, uint32_t>& p_Sizes)
+{
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_rfc822_size());
+
+  int rv = MAILIMAP_NO_ERROR;
+  std::vector<struct mailimap_set*> sets = NewUidSets(p_Uids);
+  for (auto& set : sets)
+  {
+    clist* fetch_result = NULL;
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
+    if (rv != MAILIMAP_NO_ERROR) break;
+
+    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+      uint32_t uid = 0;
+      uint32_t size = 0;
+      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+      {
+        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(ait);
+        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
+
+        if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+        {
+          uid = item->att_data.att_static->att_data.att_uid;
+        }
+        else if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_RFC822_SIZE)
+        {
+          size = item->att_data.att_static->att_data.att_rfc822_size;
+        }
+      }
+
+      if (uid != 0)
+      {
+        p_Sizes[uid] = size;
+      }
+    }
+
+    mailimap_fetch_list_free(fetch_result);
+  }
+
+  ImapUtil::FreeUidSets(sets);
+  mailimap_fetch_type_free(fetch_type);
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+std::vector<std::set<uint32_t>> Imap::SplitBySize(const std::set<uint32_t>& p_Uids,
+                                                  const std::map<uint32_t, uint32_t>& p_Sizes)
+{
+  // uids without known size only count towards the message limit, a message larger than the
+  // byte limit gets a chunk of its own
+  std::vector<std::set<uint32_t>> chunks;
+  std::set<uint32_t> chunk;
+  uint64_t chunkSize = 0;
+  for (const auto& uid : p_Uids)
+  {
+    auto sit = p_Sizes.find(uid);
+    const uint64_t size = (sit != p_Sizes.end()) ? sit->second : 0;
+    if (!chunk.empty() && (((chunkSize + size) > s_BodyChunkSize) || (chunk.size() >= s_BodyChunkCount)))
+    {
+      chunks.push_back(chunk);
+      chunk.clear();
+      chunkSize = 0;
+    }
+
+    chunk.insert(uid);
+    chunkSize += size;
+  }
+
+  if (!chunk.empty())
+  {
+    chunks.push_back(chunk);
+  }
+
+  return chunks;
+}
+
+// must be called with imap lock held and folder freshly selected, returns false if a full fetch is needed
+bool Imap::GetUidsIncremental(const std::set<uint32_t>& p_CachedUids, std::set<uint32_t>& p_Uids)
+{
+  // uids are assigned in ascending order, so new messages all have uids above the cached ones
+  const uint32_t maxCachedUid = *p_CachedUids.rbegin();
+  const uint32_t uidNext = m_Imap->imap_selection_info->sel_uidnext;
+  std::set<uint32_t> newUids;
+  if ((uidNext == 0) || (uidNext > (maxCachedUid + 1)))
+  {
+    // a uid range fetch always includes the last message, even if below range
+    if (!FetchUids(maxCachedUid + 1, 0 /* '*' */, true /* p_ByUid */, newUids)) return false;
+
+    newUids.erase(newUids.begin(), newUids.upper_bound(maxCachedUid));
+  }
+
+  // message count is read after fetch, as it is updated by untagged exists responses
+  if (m_Imap->imap_selection_info->sel_has_exists == 0) return false;
+
+  const uint32_t exists = m_Imap->imap_selection_info->sel_exists;
+  if (exists < newUids.size()) return false;
+
+  const uint32_t oldCount = exists - newUids.size();
+  const std::vector<uint32_t> cachedUids(p_CachedUids.begin(), p_CachedUids.end());
+  if (oldCount > cachedUids.size()) return false;
+
+  std::set<uint32_t> expungedUids;
+  int probeCount = 0;
+  if ((oldCount < cachedUids.size()) &&
+      !FindExpungedUids(cachedUids, -1, 0, cachedUids.size(), oldCount + 1, probeCount, expungedUids))
+  {
+    LOG_DEBUG("incremental uids failed after %d probes", probeCount);
+    return false;
+  }
+
+  if ((cachedUids.size() - expungedUids.size()) != oldCount) return false;
+
+  p_Uids = p_CachedUids - expungedUids;
+  p_Uids.insert(newUids.begin(), newUids.end());
+  LOG_DEBUG("incremental uids new %d expunged %d probes %d",
+            (int)newUids.size(), (int)expungedUids.size(), probeCount);
+  return true;
+}
+
+// locates expunged uids between two cached uids known to be at given sequence numbers on server, by
+// bisecting on sequence numbers, with index -1 / seq 0 and index size / seq count + 1 as sentinels
+// must be called with imap lock held and folder selected
+bool Imap::FindExpungedUids(const std::vector<uint32_t>& p_CachedUids, int64_t p_BeginIndex, uint32_t p_BeginSeq,
+                            int64_t p_EndIndex, uint32_t p_EndSeq, int& p_ProbeCount,
+                            std::set<uint32_t>& p_ExpungedUids)
+{
+  const int64_t cachedBetween = p_EndIndex - p_BeginIndex - 1;
+  const int64_t serverBetween = p_EndSeq - p_BeginSeq - 1;
+  if (serverBetween > cachedBetween) return false;
+
+  if (serverBetween == cachedBetween) return true;
+
+  if (serverBetween == 0)
+  {
+    p_ExpungedUids.insert(p_CachedUids.begin() + p_BeginIndex + 1, p_CachedUids.begin() + p_EndIndex);
+    return true;
+  }
+
+  if (++p_ProbeCount > s_MaxUidProbes) return false;
+
+  if (serverBetween <= s_UidProbeRange)
+  {
+    std::set<uint32_t> serverUids;
+    if (!FetchUids(p_BeginSeq + 1, p_EndSeq - 1, false /* p_ByUid */, serverUids)) return false;
+
+    if (static_cast<int64_t>(serverUids.size()) != serverBetween) return false;
+
+    for (int64_t index = p_BeginIndex + 1; index < p_EndIndex; ++index)
+    {
+      if (serverUids.erase(p_CachedUids.at(index)) == 0)
+      {
+        p_ExpungedUids.insert(p_CachedUids.at(index));
+      }
+    }
+
+    // all server uids in range must be known from cache
+    return serverUids.empty();
+  }
+
+  const uint32_t midSeq = p_BeginSeq + static_cast<uint32_t>((serverBetween + 1) / 2);
+  std::set<uint32_t> midUids;
+  if (!FetchUids(midSeq, midSeq, false /* p_ByUid */, midUids) || (midUids.size() != 1)) return false;
+
+  auto begin = p_CachedUids.begin() + p_BeginIndex + 1;
+  auto end = p_CachedUids.begin() + p_EndIndex;
+  auto mid = std::lower_bound(begin, end, *midUids.begin());
+  if ((mid == end) || (*mid != *midUids.begin())) return false;
+
+  const int64_t midIndex = mid - p_CachedUids.begin();
+  return FindExpungedUids(p_CachedUids, p_BeginIndex, p_BeginSeq, midIndex, midSeq, p_ProbeCount, p_ExpungedUids) &&
+    FindExpungedUids(p_CachedUids, midIndex, midSeq, p_EndIndex, p_EndSeq, p_ProbeCount, p_ExpungedUids);
+}
+
+std::vector<struct mailimap_set*> Imap::NewUidSets(const std::set<uint32_t>& p_Uids)
+{
+  // zero max line length disables splitting
+  const size_t maxLen = (m_MaxLineLen > 0)
+    ? (std::max<size_t>(m_MaxLineLen, 2 * s_UidSetReserve) - s_UidSetReserve) : SIZE_MAX;
+  return ImapUtil::NewUidSets(p_Uids, maxLen);
+}
+
+// must be called with imap lock held, directly after authentication
+bool Imap::EnableCompress()
+{
+  int rv = LOG_IF_IMAP_ERR(mailimap_compress(m_Imap));
+  const bool enabled = (rv == MAILIMAP_NO_ERROR);
+  LOG_DEBUG("compress enabled = %d", (int)enabled);
+  return enabled;
+}
+
+// must be called with imap lock held
+void Imap::UpdateCompressStats()
+{
+#if defined(LIBETPAN_CUSTOM)
+  if (!m_Compressed || (m_Imap == NULL) || (m_Imap->imap_stream == NULL)) return;
+
+  unsigned long long compressedRead = 0;
+  unsigned long long uncompressedRead = 0;
+  unsigned long long compressedWritten = 0;
+  unsigned long long uncompressedWritten = 0;
+  if (mailstream_low_compress_get_stats(mailstream_get_low(m_Imap->imap_stream), &compressedRead, &uncompressedRead,
+                                        &compressedWritten, &uncompressedWritten) == 0)
+  {
+    std::lock_guard<std::mutex> compressStatsLock(m_CompressStatsMutex);
+    m_SessionCompressStats.m_CompressedBytes = compressedRead + compressedWritten;
+    m_SessionCompressStats.m_UncompressedBytes = uncompressedRead + uncompressedWritten;
+  }
+#endif
+}
+
+// must be called with imap lock held, directly after authentication
+bool Imap::EnableQresync()
+{
+  clist* cap_list = clist_new();
+  clist_append(cap_list, mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL, strdup("QRESYNC")));
+  struct mailimap_capability_data* cap_data = mailimap_capability_data_new(cap_list);
+  struct mailimap_capability_data* enabled_data = NULL;
+
+  bool enabled = false;
+  int rv = LOG_IF_IMAP_ERR(mailimap_enable(m_Imap, cap_data, &enabled_data));
+  if ((rv == MAILIMAP_NO_ERROR) && (enabled_data != NULL))
+  {
+    for (clistiter* it = clist_begin(enabled_data->cap_list); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_capability* cap = (struct mailimap_capability*)clist_content(it);
+      if ((cap->cap_type == MAILIMAP_CAPABILITY_NAME) && (Util::ToLower(cap->cap_data.cap_name) == "qresync"))
+      {
+        enabled = true;
+      }
+    }
+
+    mailimap_capability_data_free(enabled_data);
+  }
+
+  mailimap_capability_data_free(cap_data);
+
+  LOG_DEBUG("qresync enabled = %d", (int)enabled);
+  return enabled;
+}
+
 bool Imap::SelectFolder(const std::string& p_Folder, bool p_Force)
 {
   LOG_DEBUG_FUNC(STR(p_Folder, p_Force));
@@ -21,6 +21,12 @@
 class Imap
 {
 public:
+  struct CompressStats
+  {
+    uint64_t m_CompressedBytes = 0;
+    uint64_t m_UncompressedBytes = 0;
+  };
+
   struct FolderInfo
   {
     bool IsValid() const
@@ -49,7 +55,11 @@ public:
        const bool p_CacheEncrypt, const bool p_CacheIndexEncrypt,
        const std::set<std::string>& p_FoldersExclude,
        const bool p_SniEnabled,
+       const uint32_t p_MaxLineLen,
+       const bool p_CompressEnabled,
        const std::function<void(const StatusUpdate&)>& p_StatusHandler);
+  // additional connection to the same account, sharing cache and index with p_Imap
+  explicit Imap(const Imap& p_Imap, const uint32_t p_ConnId);
   virtual ~Imap();
 
   bool Login();
@@ -95,8 +105,22 @@ public:
   bool SetBodysCache(const std::string& p_Folder, const std::map<uint32_t, Body>& p_Bodys);
 
   FolderInfo GetFolderInfo(const std::string& p_Folder);
+  CompressStats GetCompressStats();
 
 private:
+  int FetchFlags(const std::set<uint32_t>& p_Uids, const uint64_t p_ChangedSince, const bool p_WithModSeq,
+                 std::map<uint32_t, uint32_t>& p_Flags, std::set<uint32_t>& p_VanishedUids,
+                 uint64_t& p_HighestModSeq);
+  bool FetchUids(const uint32_t p_First, const uint32_t p_Last, const bool p_ByUid, std::set<uint32_t>& p_Uids);
+  bool FetchSizes(const std::set<uint32_t>& p_Uids, std::map<uint32_t, uint32_t>& p_Sizes);
+  bool GetUidsIncremental(const std::set<uint32_t>& p_CachedUids, std::set<uint32_t>& p_Uids);
+  bool FindExpungedUids(const std::vector<uint32_t>& p_CachedUids, int64_t p_BeginIndex, uint32_t p_BeginSeq,
+                        int64_t p_EndIndex, uint32_t p_EndSeq, int& p_ProbeCount,
+                        std::set<uint32_t>& p_ExpungedUids);
+  std::vector<struct mailimap_set*> NewUidSets(const std::set<uint32_t>& p_Uids);
+  bool EnableQresync();
+  bool EnableCompress();
+  void UpdateCompressStats();
   bool SelectFolder(const std::string& p_Folder, bool p_Force = false);
   bool SelectedFolderIsEmpty();
   uint32_t GetUidValidity();
@@ -115,6 +139,8 @@ private:
   static std::vector<std::string> SplitQuery(const std::string& p_QueryStr);
   static std::vector<struct mailimap_search_key*> SearchKeysFromQuery(const std::string& p_QueryStr);
 
+  static std::vector<std::set<uint32_t>> SplitBySize(const std::set<uint32_t>& p_Uids,
+                                                     const std::map<uint32_t, uint32_t>& p_Sizes);
   static void Logger(struct mailimap* p_Imap, int p_LogType, const char* p_Buffer, size_t p_Size, void* p_UserData);
 
 private:
@@ -128,12 +154,23 @@ private:
   std::set<std::string> m_FoldersExclude;
   std::set<std::string> m_UidInvalidFolders;
   bool m_SniEnabled = false;
+  uint32_t m_MaxLineLen = 0;
+  uint32_t m_ConnId = 0;
+  bool m_CompressEnabled = true;
 
   std::mutex m_ImapMutex;
   struct mailimap* m_Imap = NULL;
 
   std::string m_SelectedFolder;
   bool m_SelectedFolderIsEmpty = true;
+  bool m_QresyncEnabled = false;
+  bool m_Compressed = false;
+
+  // byte counts of previous sessions and of the current session of this connection
+  std::mutex m_CompressStatsMutex;
+  CompressStats m_CompressStats;
+  CompressStats m_SessionCompressStats;
+  std::set<std::string> m_NoModSeqFolders;
 
   std::mutex m_ConnectedMutex;
   bool m_Connected = false;
@@ -151,5 +188,5 @@ private:
   std::shared_ptr<std::set<std::string>> m_Capabilities;
 
   std::shared_ptr<ImapCache> m_ImapCache;
-  std::unique_ptr<ImapIndex> m_ImapIndex;
+  std::shared_ptr<ImapIndex> m_ImapIndex;
 };
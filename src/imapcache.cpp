@@ -1,19 +1,24 @@
 // imapcache.cpp
 //
-// Copyright (c) 2020-2025 Kristofer Berggren
+// Copyright (c) 2020-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
-//
-// @todo: consider moving heavy set operations to worker thread
 
 #include "imapcache.h"
 
+#include <atomic>
+#include <fstream>
+
+#include <unistd.h>
+
 #include <sqlite_modern_cpp.h>
 
 #include "body.h"
 #include "cacheutil.h"
+#include "compress.h"
 #include "crypto.h"
+#include "cryptovfs.h"
 #include "flag.h"
 #include "header.h"
 #include "lockfile.h"
@@ -24,59 +29,501 @@
 #include "sethelp.h"
 #include "sqlitehelp.h"
 
+// max number of idle read connections kept open in the pool
+static const size_t s_ReadDbPoolSize = 4;
+
+// body data codecs, stored in bodys.codec
+static const int s_CodecNone = 0;
+static const int s_CodecZlib = 1;
+
+// number of bodys converted per batch by background conversion
+static const int s_ConvertBatchSize = 32;
+
+// number of rows checked per batch by background re-parse after parse version updates
+static const int s_ReparseBatchSize = 256;
+
+// max number of bodys evicted per batch when exceeding cache size limit
+static const int s_EvictBatchSize = 256;
+
+// delay between background batches, to yield to foreground cache access
+static const std::chrono::milliseconds s_BatchInterval(10);
+
+// interval between cache size limit checks, and duration without cache access considered idle
+static const std::chrono::milliseconds s_EvictInterval(10000);
+static const std::chrono::milliseconds s_IdleDelay(5000);
+
+// interval between idle maintenance runs, and max number of orphaned rows deleted per table per batch
+static const std::chrono::milliseconds s_MaintainInterval(3600 * 1000);
+static const int s_OrphanBatchSize = 256;
+
+// free pages required before idle incremental vacuum, and max number of pages released per batch
+static const int64_t s_VacuumMinFreePages = 1024;
+static const int64_t s_VacuumBatchPages = 256;
+
+// tables with per-message rows, and condition for rows whose message is no longer in uids
+static const std::vector<std::pair<std::string, std::string>> s_OrphanConditions =
+{
+  { "uids", "NOT EXISTS (SELECT 1 FROM folders f WHERE f.id = t.folder_id)" },
+  { "flags", "NOT EXISTS (SELECT 1 FROM uids u WHERE u.folder_id = t.folder_id AND u.uid = t.uid)" },
+  { "headers", "NOT EXISTS (SELECT 1 FROM uids u WHERE u.folder_id = t.folder_id AND u.uid = t.uid)" },
+  { "headerfields", "NOT EXISTS (SELECT 1 FROM uids u WHERE u.folder_id = t.folder_id AND u.uid = t.uid)" },
+  { "bodys", "NOT EXISTS (SELECT 1 FROM uids u WHERE u.folder_id = t.folder_id AND u.uid = t.uid)" },
+};
+
+// max number of queued header, flag and body writes before set operations block
+static const size_t s_MaxPendingWrites = 1000;
+
+// duration the writer waits for further queued writes to join a transaction (group commit)
+static const std::chrono::milliseconds s_WriteGroupWindow(200);
+
+// number of attempts to commit a batch of queued writes before it is dropped, and delay between them
+static const int s_MaxWriteAttempts = 3;
+static const std::chrono::milliseconds s_WriteRetryDelay(1000);
+
+// max number of bodys loaded at a time by export, and name of per-folder export manifest file
+static const size_t s_ExportBatchSize = 256;
+static const std::string s_ExportManifestName = ".nmail_export";
+
+// compresses raw body data, returns codec used
+static int PackBodyData(const std::string& p_Data, std::vector<char>& p_Packed)
+{
+  p_Packed = Compress::Deflate(p_Data.data(), p_Data.size());
+  if (p_Packed.empty())
+  {
+    p_Packed.assign(p_Data.begin(), p_Data.end());
+    return s_CodecNone;
+  }
+
+  return s_CodecZlib;
+}
+
+static bool UnpackBodyData(int p_Codec, const char* p_Packed, size_t p_PackedSize, std::string& p_Data)
+{
+  switch (p_Codec)
+  {
+    case s_CodecNone:
+      p_Data.assign(p_Packed, p_PackedSize);
+      return true;
+
+    case s_CodecZlib:
+      return Compress::Inflate(p_Packed, p_PackedSize, p_Data);
+
+    default:
+      LOG_WARNING("unsupported body codec %d", p_Codec);
+      return false;
+  }
+}
+
+// wrapper for decoding bodys stored before raw data and metadata were separated
+struct LegacyBody
+{
+  Body m_Body;
+
+  template<class Archive>
+  void serialize(Archive& p_Archive)
+  {
+    m_Body.LoadLegacy(p_Archive);
+  }
+};
+
+// decodes body from raw data and metadata columns, returns false if stored in legacy format
+static bool DecodeBody(std::string&& p_Data, const char* p_Meta, size_t p_MetaSize, Body& p_Body)
+{
+  if (p_MetaSize == 0)
+  {
+    p_Body = Serialization::FromBytes<LegacyBody>(p_Data.data(), p_Data.size()).m_Body;
+    return false;
+  }
+
+  p_Body = Serialization::FromBytes<Body>(p_Meta, p_MetaSize);
+  p_Body.SetRawData(std::move(p_Data));
+  return true;
+}
+
+// decodes header from flat record, returns false if stored in cereal format by earlier versions
+static bool DecodeHeader(const char* p_Data, size_t p_Size, Header& p_Header)
+{
+  if (Header::IsRecord(p_Data, p_Size))
+  {
+    p_Header.FromRecord(p_Data, p_Size); // left empty if invalid
+    return true;
+  }
+
+  p_Header = Serialization::FromBytes<Header>(p_Data, p_Size);
+  return false;
+}
+
+// returns blob column of current row, pointing into memory owned by sqlite until next step
+static std::string_view GetBlob(sqlite3_stmt* p_Stmt, int p_Col)
+{
+  const char* data = static_cast<const char*>(sqlite3_column_blob(p_Stmt, p_Col));
+  const int size = sqlite3_column_bytes(p_Stmt, p_Col);
+  return (data != nullptr) ? std::string_view(data, size) : std::string_view();
+}
+
+// compressed raw data, metadata and content hash of a body, prepared before leasing write connection
+struct PackedBody
+{
+  std::string m_Hash;
+  std::vector<char> m_Data;
+  int m_Codec = s_CodecNone;
+  int64_t m_Size = 0;
+  std::vector<char> m_Meta;
+};
+
+static void PackBody(const Body& p_Body, PackedBody& p_PackedBody)
+{
+  const std::string& rawData = p_Body.GetData();
+  p_PackedBody.m_Hash = Crypto::SHA256(rawData);
+  p_PackedBody.m_Codec = PackBodyData(rawData, p_PackedBody.m_Data);
+  p_PackedBody.m_Size = rawData.size();
+  Serialization::ToBytes(p_Body, p_PackedBody.m_Meta);
+}
+
+// inserts raw data into content-addressed bodydata, unless already stored for another message
+static void InsertBodyData(sqlite::database_binder& p_Insert, const PackedBody& p_PackedBody)
+{
+  p_Insert.reset();
+  p_Insert << p_PackedBody.m_Hash << p_PackedBody.m_Data << p_PackedBody.m_Codec << p_PackedBody.m_Size;
+  p_Insert.execute();
+}
+
+// inserts sortable and filterable header fields into headerfields
+static void InsertHeaderFields(sqlite::database_binder& p_Insert, int64_t p_FolderId, uint32_t p_Uid,
+                               const Header& p_Header)
+{
+  std::string fromName = p_Header.GetShortFrom();
+  Util::NormalizeName(fromName);
+  std::string toName = p_Header.GetShortTo();
+  Util::NormalizeName(toName);
+  std::string subject = p_Header.GetSubject();
+  Util::NormalizeSubject(subject, true /*p_ToLower*/);
+
+  // hash of raw header excluding local server time label, used to identify same message in other folders
+  const std::string& data = p_Header.GetData();
+  const size_t labelEnd = data.find('\n');
+  const std::string headerHash = Crypto::SHA256((labelEnd != std::string::npos) ? data.substr(labelEnd + 1) : data);
+
+  p_Insert.reset();
+  p_Insert << p_FolderId << p_Uid << (int64_t)p_Header.GetTimeStamp() << fromName << toName << subject
+           << p_Header.GetHasAttachments() << p_Header.GetMessageId() << headerHash;
+  p_Insert.execute();
+}
+
+// builds headerfields query for specified sort order and filters, see BindUidQuery() for parameters
+static std::string GetUidQuerySql(const std::string& p_Select, const ImapCache::UidQuery& p_Query,
+                                  bool p_Order)
+{
+  std::string sql = "SELECT " + p_Select + " FROM headerfields h "
+    "LEFT JOIN flags f ON f.folder_id = h.folder_id AND f.uid = h.uid "
+    "WHERE h.folder_id = ?";
+
+  if (p_Query.m_UnseenOnly)
+  {
+    sql += " AND f.flag IS NOT NULL AND (f.flag & ?) = 0";
+  }
+
+  if (p_Query.m_AttachmentsOnly)
+  {
+    sql += " AND h.has_attachments != 0";
+  }
+
+  if (!p_Query.m_FromName.empty())
+  {
+    sql += " AND h.from_name = ?";
+  }
+
+  if (!p_Query.m_ToName.empty())
+  {
+    sql += " AND h.to_name = ?";
+  }
+
+  if (!p_Query.m_Subject.empty())
+  {
+    sql += " AND h.subject = ?";
+  }
+
+  if (p_Order)
+  {
+    const std::string dir = p_Query.m_Ascending ? " ASC" : " DESC";
+    std::string orderBy;
+    switch (p_Query.m_SortField)
+    {
+      case ImapCache::SortFieldFrom:
+        orderBy = "h.from_name" + dir + ", ";
+        break;
+
+      case ImapCache::SortFieldTo:
+        orderBy = "h.to_name" + dir + ", ";
+        break;
+
+      case ImapCache::SortFieldSubject:
+        orderBy = "h.subject" + dir + ", ";
+        break;
+
+      case ImapCache::SortFieldUnseen:
+        orderBy = "(f.flag IS NOT NULL AND (f.flag & ?) = 0)" + dir + ", ";
+        break;
+
+      case ImapCache::SortFieldAttachments:
+        orderBy = "h.has_attachments" + dir + ", ";
+        break;
+
+      case ImapCache::SortFieldDate:
+      default:
+        break;
+    }
+
+    sql += " ORDER BY " + orderBy + "h.timestamp" + dir + ", h.uid" + dir;
+
+    if (p_Query.m_Limit > 0)
+    {
+      sql += " LIMIT " + std::to_string(p_Query.m_Limit) + " OFFSET " + std::to_string(p_Query.m_Offset);
+    }
+  }
+
+  sql += ";";
+  return sql;
+}
+
+static void BindUidQuery(sqlite::database_binder& p_Binder, int64_t p_FolderId, const ImapCache::UidQuery& p_Query,
+                         bool p_Order)
+{
+  p_Binder << p_FolderId;
+
+  if (p_Query.m_UnseenOnly)
+  {
+    p_Binder << Flag::Seen;
+  }
+
+  if (!p_Query.m_FromName.empty())
+  {
+    p_Binder << p_Query.m_FromName;
+  }
+
+  if (!p_Query.m_ToName.empty())
+  {
+    p_Binder << p_Query.m_ToName;
+  }
+
+  if (!p_Query.m_Subject.empty())
+  {
+    p_Binder << p_Query.m_Subject;
+  }
+
+  if (p_Order && (p_Query.m_SortField == ImapCache::SortFieldUnseen))
+  {
+    p_Binder << Flag::Seen;
+  }
+}
+
+// headers, flags and bodys of a folder queued for writing
+struct ImapCache::PendingWrites
+{
+  std::map<uint32_t, Header> m_Headers;
+  std::map<uint32_t, uint32_t> m_Flags;
+  std::map<uint32_t, Body> m_Bodys;
+};
+
+// begins a transaction which is rolled back on destruction unless committed, so that a failed
+// write does not leave the shared write connection inside an open transaction
+class DbTransaction
+{
+public:
+  explicit DbTransaction(const std::shared_ptr<sqlite::database>& p_Db)
+    : m_Db(p_Db)
+  {
+    *m_Db << "begin;";
+  }
+
+  ~DbTransaction()
+  {
+    if (m_Committed) return;
+
+    try
+    {
+      *m_Db << "rollback;";
+    }
+    catch (const sqlite::sqlite_exception& ex)
+    {
+      LOG_WARNING("failed to rollback transaction (%d)", ex.get_code());
+    }
+  }
+
+  void Commit()
+  {
+    *m_Db << "commit;";
+    m_Committed = true;
+  }
+
+private:
+  std::shared_ptr<sqlite::database> m_Db;
+  bool m_Committed = false;
+};
+
 struct ImapCache::DbConnection
 {
-  DbConnection(const std::string& p_DbPath)
+  DbConnection(const std::string& p_DbPath, bool p_ReadOnly, const std::string& p_VfsName)
     : m_DbPath(p_DbPath)
+    , m_VfsName(p_VfsName)
   {
-    OpenDb();
+    sqlite::sqlite_config config;
+    if (p_ReadOnly)
+    {
+      config.flags = sqlite::OpenFlags::READONLY;
+    }
+    else
+    {
+      config.flags = config.flags | sqlite::OpenFlags::URI; // allow attaching plain dbs with default vfs
+    }
+
+    if (!m_VfsName.empty())
+    {
+      config.zVfs = m_VfsName.c_str();
+    }
+
+    m_Database.reset(new sqlite::database(m_DbPath, config));
+    if (!p_ReadOnly)
+    {
+      if (!m_VfsName.empty())
+      {
+        // encrypted vfs stores 4096 byte records, keep pages aligned with them (only affects new dbs)
+        *m_Database << "PRAGMA page_size = 4096";
+      }
+
+      *m_Database << "PRAGMA journal_mode = WAL";
+      *m_Database << "PRAGMA synchronous = NORMAL";
+      *m_Database << "PRAGMA recursive_triggers = ON"; // fire bodydata cleanup also on replace
+    }
+
+    if (!m_VfsName.empty())
+    {
+      // keep temporary tables and statement journals off disk for encrypted cache
+      *m_Database << "PRAGMA temp_store = MEMORY";
+    }
+
+    *m_Database << "PRAGMA busy_timeout = 5000";
+    *m_Database << "CREATE TEMP TABLE IF NOT EXISTS uidset (uid INTEGER PRIMARY KEY);";
   }
 
-  void CloseDb()
+  ~DbConnection()
   {
-    m_Database.reset();
+    for (auto& statement : m_Statements)
+    {
+      if (!statement.second->used())
+      {
+        statement.second->used(true); // prevent reset binder from executing on destruction
+      }
+    }
   }
 
-  void OpenDb()
+  // returns cached prepared statement, reset and ready for binding
+  sqlite::database_binder& Prepare(const std::string& p_Sql)
   {
-    if (Util::GetReadOnly())
+    auto it = m_Statements.find(p_Sql);
+    if (it == m_Statements.end())
     {
-      sqlite::sqlite_config config;
-      config.flags = sqlite::OpenFlags::READONLY;
-      m_Database.reset(new sqlite::database(m_DbPath, config));
+      std::unique_ptr<sqlite::database_binder> statement(new sqlite::database_binder(*m_Database << p_Sql));
+      it = m_Statements.insert(std::make_pair(p_Sql, std::move(statement))).first;
     }
     else
     {
-      m_Database.reset(new sqlite::database(m_DbPath));
+      it->second->reset();
+    }
+
+    return *it->second;
+  }
+
+  // runs cached raw prepared statement with folder id bound, for rows with blob columns which are
+  // read in place using GetBlob() rather than copied into a vector for each row
+  void SelectRows(const std::string& p_Sql, int64_t p_FolderId, const std::function<void(sqlite3_stmt*)>& p_RowFunc)
+  {
+    auto it = m_RawStatements.find(p_Sql);
+    if (it == m_RawStatements.end())
+    {
+      sqlite3_stmt* stmt = nullptr;
+      const int rv = sqlite3_prepare_v2(m_Database->connection().get(), p_Sql.c_str(), -1, &stmt, nullptr);
+      if (rv != SQLITE_OK)
+      {
+        sqlite::errors::throw_sqlite_error(rv, p_Sql);
+      }
+
+      it = m_RawStatements.insert(std::make_pair(p_Sql, RawStatement(stmt, sqlite3_finalize))).first;
+    }
+
+    sqlite3_stmt* stmt = it->second.get();
+    sqlite3_bind_int64(stmt, 1, p_FolderId);
+    int rv = SQLITE_DONE;
+    try
+    {
+      while ((rv = sqlite3_step(stmt)) == SQLITE_ROW)
+      {
+        p_RowFunc(stmt);
+      }
+    }
+    catch (...)
+    {
+      sqlite3_reset(stmt);
+      throw;
     }
 
-    *m_Database << "PRAGMA synchronous = FULL";
-    *m_Database << "PRAGMA journal_mode = DELETE";
+    // reset to end the read transaction, keeping wal checkpoints unblocked
+    sqlite3_reset(stmt);
+    if (rv != SQLITE_DONE)
+    {
+      sqlite::errors::throw_sqlite_error(rv, p_Sql);
+    }
+  }
+
+  // loads uids into temp table uidset, to be used as "uid IN (SELECT uid FROM temp.uidset)"
+  void BindUids(const std::set<uint32_t>& p_Uids)
+  {
+    Prepare("SAVEPOINT uidset;").execute();
+    Prepare("DELETE FROM temp.uidset;").execute();
+    sqlite::database_binder& insert = Prepare("INSERT INTO temp.uidset (uid) VALUES (?);");
+    for (const auto& uid : p_Uids)
+    {
+      insert.reset();
+      insert << uid;
+      insert.execute();
+    }
+    Prepare("RELEASE uidset;").execute();
   }
 
   std::shared_ptr<sqlite::database> m_Database;
   std::string m_DbPath;
-  bool m_Dirty = false;
+  std::string m_VfsName;
+  std::map<std::string, std::unique_ptr<sqlite::database_binder>> m_Statements;
+
+  typedef std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> RawStatement;
+  std::map<std::string, RawStatement> m_RawStatements;
 };
 
-ImapCache::ImapCache(const bool p_CacheEncrypt, const std::string& p_Pass)
+ImapCache::ImapCache(const bool p_CacheEncrypt, const std::string& p_Pass,
+                     const std::function<void(const StatusUpdate&)>& p_StatusHandler /* = nullptr */)
   : m_CacheEncrypt(p_CacheEncrypt)
   , m_Pass(p_Pass)
+  , m_StatusHandler(p_StatusHandler)
 {
-  InitHeadersCache();
-  InitBodysCache();
-  InitUidFlagsCache();
-  InitValidityCache();
+  InitCache();
 
   m_Folders = GetFolders();
+
+  StartWriter();
+  StartBackground();
 }
 
 ImapCache::~ImapCache()
 {
-  CleanupHeadersCache();
-  CleanupBodysCache();
-  CleanupUidFlagsCache();
-  CleanupValidityCache();
+  StopWriter();
+  StopBackground();
+
+  if (!Util::GetReadOnly())
+  {
+    FlushAccessTimes();
+  }
+
+  CleanupCache();
 }
 
 bool ImapCache::ChangePass(const bool p_CacheEncrypt,
@@ -84,80 +531,64 @@ bool ImapCache::ChangePass(const bool p_CacheEncrypt,
 {
   if (!p_CacheEncrypt) return true;
 
-  std::string headersDir = GetCacheDbDir(HeadersDb);
-  std::vector<std::string> headerFiles = Util::ListDir(headersDir);
-  for (const auto& headerFile : headerFiles)
+  // include account db, whole-file encrypted db of earlier versions, and legacy per-folder dbs
+  std::vector<std::string> paths;
+  std::vector<std::string> dbDirs = { GetCacheDbDir() };
+  for (const auto& typeName : GetLegacyTypeNames())
   {
-    std::string path = headersDir + headerFile;
-    std::string tmpPath = path + ".tmp";
-    if (!Crypto::AESDecryptFile(path, tmpPath, p_OldPass)) return false;
-
-    if (!Crypto::AESEncryptFile(tmpPath, path, p_NewPass)) return false;
-
-    Util::DeleteFile(tmpPath);
-
-    std::cout << ".";
+    dbDirs.push_back(GetLegacyCacheDbDir(typeName));
   }
 
-  std::string bodysDir = GetCacheDbDir(BodysDb);
-  std::vector<std::string> bodyFiles = Util::ListDir(bodysDir);
-  for (const auto& bodyFile : bodyFiles)
+  for (const auto& dbDir : dbDirs)
   {
-    std::string path = bodysDir + bodyFile;
-    std::string tmpPath = path + ".tmp";
-    if (!Crypto::AESDecryptFile(path, tmpPath, p_OldPass)) return false;
-
-    if (!Crypto::AESEncryptFile(tmpPath, path, p_NewPass)) return false;
-
-    Util::DeleteFile(tmpPath);
+    std::vector<std::string> dbFiles = Util::ListDir(dbDir);
+    for (const auto& dbFile : dbFiles)
+    {
+      // skip interrupted transcodes, and sqlite transient files handled when copying account db
+      const std::string ext = Util::GetFileExt(dbFile);
+      if ((ext.rfind(".tmp", 0) == 0) || (ext.find("-wal") != std::string::npos) ||
+          (ext.find("-shm") != std::string::npos)) continue;
 
-    std::cout << ".";
+      paths.push_back(dbDir + dbFile);
+    }
   }
 
-  std::string uidFlagsDir = GetCacheDbDir(UidFlagsDb);
-  std::vector<std::string> uidFlagFiles = Util::ListDir(uidFlagsDir);
-  for (const auto& uidFlagFile : uidFlagFiles)
+  std::vector<std::string> foldersPaths = { GetFoldersPath(), GetLegacyCacheDir("headers") + "folders" };
+  for (const auto& path : foldersPaths)
   {
-    std::string path = uidFlagsDir + uidFlagFile;
-    std::string tmpPath = path + ".tmp";
-    if (!Crypto::AESDecryptFile(path, tmpPath, p_OldPass)) return false;
+    if (!Util::Exists(path)) continue;
 
-    if (!Crypto::AESEncryptFile(tmpPath, path, p_NewPass)) return false;
-
-    Util::DeleteFile(tmpPath);
-
-    std::cout << ".";
+    paths.push_back(path);
   }
 
-  std::string validityDir = GetCacheDbDir(ValidityDb);
-  std::vector<std::string> validityFiles = Util::ListDir(validityDir);
-  for (const auto& validityFile : validityFiles)
+  // account db is re-encrypted by copying it between vfs instances using old and new pass
+  const std::string oldVfsName = CryptoVfs::Register(p_OldPass);
+  const std::string newVfsName = CryptoVfs::Register(p_NewPass);
+  auto transcode = [&](const std::string& p_InPath, const std::string& p_OutPath)
   {
-    std::string path = validityDir + validityFile;
-    std::string tmpPath = path + ".tmp";
-    if (!Crypto::AESDecryptFile(path, tmpPath, p_OldPass)) return false;
-
-    if (!Crypto::AESEncryptFile(tmpPath, path, p_NewPass)) return false;
-
-    Util::DeleteFile(tmpPath);
+    if (CryptoVfs::IsEncryptedFile(p_InPath))
+    {
+      return CopyDb(p_InPath, oldVfsName, p_OutPath, newVfsName);
+    }
 
-    std::cout << ".";
-  }
+    return Crypto::AESReencryptFile(p_InPath, p_OutPath, p_OldPass, p_NewPass);
+  };
 
-  std::string path = GetHeadersFoldersPath();
-  std::string data = Crypto::AESDecrypt(Util::ReadFile(path), p_OldPass);
-  Util::WriteFile(path, Crypto::AESEncrypt(data, p_NewPass));
+  const bool rv =
+    CacheUtil::ReencryptFiles(p_OldPass, p_NewPass, paths, GetCacheDir() + "reencrypt.journal", transcode);
+  CryptoVfs::Unregister(oldVfsName);
+  CryptoVfs::Unregister(newVfsName);
 
   std::cout << "\n";
-  return true;
+  return rv;
 }
 
 // get all folders
 std::set<std::string> ImapCache::GetFolders()
 {
   LOG_DURATION();
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  return Serialization::FromString<std::set<std::string>>(ReadCacheFile(GetHeadersFoldersPath()));
+  std::lock_guard<std::mutex> foldersLock(m_FoldersMutex);
+  return Serialization::FromString<std::set<std::string>>(ReadCacheFile(GetFoldersPath()));
 }
 
 // set all folders
@@ -170,14 +601,13 @@ void ImapCache::SetFolders(const std::set<std::string>& p_Folders)
 
   std::set<std::string> deletedFolders;
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    std::lock_guard<std::mutex> foldersLock(m_FoldersMutex);
     deletedFolders = m_Folders - p_Folders;
-    WriteCacheFile(GetHeadersFoldersPath(), Serialization::ToString(p_Folders));
+    WriteCacheFile(GetFoldersPath(), Serialization::ToString(p_Folders));
   }
 
   for (const auto& deletedFolder : deletedFolders)
   {
-    // @todo: consider closing db and deleting file-system files instead
     ClearFolder(deletedFolder);
   }
 }
@@ -186,19 +616,22 @@ void ImapCache::SetFolders(const std::set<std::string>& p_Folders)
 std::set<uint32_t> ImapCache::GetUids(const std::string& p_Folder)
 {
   LOG_DURATION();
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, false /* p_Writable */);
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  std::set<uint32_t> uids;
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return uids;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
   std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-  std::set<uint32_t> uids;
   try
   {
-    auto lambda = [&](const std::vector<uint32_t>& data)
+    auto lambda = [&](const uint32_t& uid)
     {
-      uids = ToSet(data);
+      uids.insert(uids.end(), uid);
     };
 
-    *db << "SELECT uids.uids FROM uids LIMIT 1" >> lambda;
+    dbCon->Prepare("SELECT uid FROM uids WHERE folder_id = ?;") << folderId >> lambda;
   }
   catch (const sqlite::sqlite_exception& ex)
   {
@@ -215,74 +648,56 @@ void ImapCache::SetUids(const std::string& p_Folder, const std::set<uint32_t>& p
 
   if (Util::GetReadOnly()) return;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-
-  std::string delUidList;
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
 
   try
   {
-    std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
+    const int64_t folderId = GetFolderId(p_Folder, true /* p_Create */);
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
     std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
     std::set<uint32_t> oldUids;
-    auto lambda = [&](const std::vector<uint32_t>& data)
+    auto lambda = [&](const uint32_t& uid)
     {
-      oldUids = ToSet(data);
+      oldUids.insert(oldUids.end(), uid);
     };
 
-    *db << "SELECT uids.uids FROM uids LIMIT 1" >> lambda;
+    dbCon->Prepare("SELECT uid FROM uids WHERE folder_id = ?;") << folderId >> lambda;
 
-    if (p_Uids != oldUids)
+    // only write the difference, to keep cost proportional to number of changes
+    const std::set<uint32_t> addUids = p_Uids - oldUids;
+    const std::set<uint32_t> delUids = oldUids - p_Uids;
+    if (!addUids.empty() || !delUids.empty())
     {
-      *db << "begin;";
-      *db << "DELETE FROM uids;";
-      *db << "INSERT INTO uids (uids) VALUES (?);" << ToVector(p_Uids);
+      DbTransaction transaction(db);
+      sqlite::database_binder& insert = dbCon->Prepare("INSERT OR IGNORE INTO uids (folder_id, uid) VALUES (?, ?);");
+      for (const auto& uid : addUids)
+      {
+        insert.reset();
+        insert << folderId << uid;
+        insert.execute();
+      }
 
-      std::set<uint32_t> delUids = oldUids - p_Uids;
       if (!delUids.empty())
       {
-        std::stringstream sstream;
-        std::copy(delUids.begin(), delUids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-        delUidList = sstream.str();
-        delUidList.pop_back(); // assumes non-empty input set
-
-        *db << "DELETE FROM flags WHERE uid IN (" + delUidList + ");";
+        dbCon->BindUids(delUids);
+        *db << "DELETE FROM uids WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+        *db << "DELETE FROM flags WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+        *db << "DELETE FROM bodys WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+        *db << "DELETE FROM headers WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+        *db << "DELETE FROM headerfields WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);"
+            << folderId;
       }
 
-      *db << "commit;";
+      transaction.Commit();
+      FlagsWritten();
     }
   }
   catch (const sqlite::sqlite_exception& ex)
   {
     HANDLE_SQLITE_EXCEPTION(ex);
   }
-
-  if (!delUidList.empty())
-  {
-    try
-    {
-      std::shared_ptr<DbConnection> dbCon = GetDb(BodysDb, p_Folder, true /* p_Writable */);
-      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-
-      *db << "DELETE FROM bodys WHERE uid IN (" + delUidList + ");";
-    }
-    catch (const sqlite::sqlite_exception& ex)
-    {
-      HANDLE_SQLITE_EXCEPTION(ex);
-    }
-
-    try
-    {
-      std::shared_ptr<DbConnection> dbCon = GetDb(HeadersDb, p_Folder, true /* p_Writable */);
-      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-
-      *db << "DELETE FROM headers WHERE uid IN (" + delUidList + ");";
-    }
-    catch (const sqlite::sqlite_exception& ex)
-    {
-      HANDLE_SQLITE_EXCEPTION(ex);
-    }
-  }
 }
 
 // get specified headers
@@ -293,51 +708,73 @@ std::map<uint32_t, Header> ImapCache::GetHeaders(const std::string& p_Folder, co
   std::map<uint32_t, Header> headers;
   if (p_Uids.empty()) return headers;
 
-  std::map<uint32_t, Header> updateCacheHeaders;
+  // queued writes take precedence, they are copied before reading db as they are only dequeued
+  // once committed, and do not need to be read from db
+  std::set<uint32_t> dbUids = p_Uids;
+  {
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    for (const auto* writes : { &m_WritingWrites, &m_PendingWrites })
+    {
+      auto it = writes->find(p_Folder);
+      if (it == writes->end()) continue;
+
+      for (const auto& header : it->second.m_Headers)
+      {
+        if (p_Uids.count(header.first) == 0) continue;
+
+        headers[header.first] = p_Prefetch ? Header() : header.second;
+        dbUids.erase(header.first);
+      }
+    }
+  }
+
+  if (dbUids.empty()) return headers;
 
   try
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    std::shared_ptr<DbConnection> dbCon = GetDb(HeadersDb, p_Folder, false /* p_Writable */);
-    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    SetUsed();
+    const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+    if (folderId != -1)
+    {
+      std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-    std::stringstream sstream;
-    std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-    std::string uidlist = sstream.str();
-    uidlist.pop_back(); // assumes non-empty input set
+      dbCon->BindUids(dbUids);
 
-    if (!p_Prefetch)
-    {
-      auto lambda = [&](const uint32_t& uid, const std::vector<char>& data)
+      if (!p_Prefetch)
       {
-        Header header;
-        header = Serialization::FromBytes<Header>(data);
-        if (header.ParseIfNeeded())
+        auto lambda = [&](sqlite3_stmt* p_Stmt)
         {
-          updateCacheHeaders[uid] = header;
-        }
-
-        if (header.GetTimeStamp() != 0)
-        {
-          headers.insert(std::make_pair(uid, header));
-        }
-        else
-        {
-          LOG_WARNING("invalid cached header folder %s uid = %d",
-                      p_Folder.c_str(), uid);
-        }
-      };
+          const uint32_t uid = sqlite3_column_int64(p_Stmt, 0);
+          const std::string_view data = GetBlob(p_Stmt, 1);
+          // headers of earlier parse versions or formats are used as-is, see ReparseStale()
+          Header header;
+          DecodeHeader(data.data(), data.size(), header);
+          if (header.GetTimeStamp() != 0)
+          {
+            headers.insert(std::make_pair(uid, header));
+          }
+          else
+          {
+            LOG_WARNING("invalid cached header folder %s uid = %d",
+                        p_Folder.c_str(), uid);
+          }
+        };
 
-      *db << "SELECT uid, data FROM headers WHERE uid IN (" + uidlist + ");" >> lambda;
-    }
-    else
-    {
-      auto lambda = [&](const uint32_t& uid)
+        dbCon->SelectRows("SELECT uid, data FROM headers WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);",
+                          folderId, lambda);
+      }
+      else
       {
-        headers.insert(std::make_pair(uid, Header()));
-      };
+        auto lambda = [&](const uint32_t& uid)
+        {
+          headers.insert(std::make_pair(uid, Header()));
+        };
 
-      *db << "SELECT uid FROM headers WHERE uid IN (" + uidlist + ");" >> lambda;
+        dbCon->Prepare("SELECT uid FROM headers WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);")
+          << folderId >> lambda;
+      }
     }
   }
   catch (const sqlite::sqlite_exception& ex)
@@ -345,11 +782,6 @@ std::map<uint32_t, Header> ImapCache::GetHeaders(const std::string& p_Folder, co
     HANDLE_SQLITE_EXCEPTION(ex);
   }
 
-  if (!updateCacheHeaders.empty())
-  {
-    SetHeaders(p_Folder, updateCacheHeaders);
-  }
-
   return headers;
 }
 
@@ -361,25 +793,72 @@ void ImapCache::SetHeaders(const std::string& p_Folder, const std::map<uint32_t,
 
   if (Util::GetReadOnly()) return;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(HeadersDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  std::unique_lock<std::mutex> writeLock(m_WriteMutex);
+  WaitWriteQueue(writeLock);
+  PendingWrites& pendingWrites = m_PendingWrites[p_Folder];
+  for (const auto& header : p_Headers)
+  {
+    pendingWrites.m_Headers[header.first] = header.second;
+  }
+
+  m_PendingWriteCount += p_Headers.size();
+  m_WriteCondVar.notify_all();
+}
+
+// get uids of cached headers in specified sort order, without deserializing headers
+std::vector<uint32_t> ImapCache::GetSortedUids(const std::string& p_Folder, const UidQuery& p_Query)
+{
+  LOG_DURATION();
+  std::vector<uint32_t> uids;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return uids;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
 
   try
   {
-    *db << "begin;";
-    for (const auto& header : p_Headers)
+    sqlite::database_binder& query = dbCon->Prepare(GetUidQuerySql("h.uid", p_Query, true /*p_Order*/));
+    BindUidQuery(query, folderId, p_Query, true /*p_Order*/);
+    query >> [&](const uint32_t& uid)
     {
-      const uint32_t uid = header.first;
-      *db << "INSERT OR REPLACE INTO headers (uid, data) VALUES (?, ?);" << uid <<
-        Serialization::ToBytes(header.second);
-    }
-    *db << "commit;";
+      uids.push_back(uid);
+    };
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+
+  return uids;
+}
+
+// get number of cached headers matching filters, offset and limit are not applied
+int64_t ImapCache::GetSortedUidsCount(const std::string& p_Folder, const UidQuery& p_Query)
+{
+  int64_t count = 0;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return count;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+
+  try
+  {
+    sqlite::database_binder& query = dbCon->Prepare(GetUidQuerySql("COUNT(*)", p_Query, false /*p_Order*/));
+    BindUidQuery(query, folderId, p_Query, false /*p_Order*/);
+    query >> count;
   }
   catch (const sqlite::sqlite_exception& ex)
   {
     HANDLE_SQLITE_EXCEPTION(ex);
   }
+
+  return count;
 }
 
 // get specified flags
@@ -389,27 +868,49 @@ std::map<uint32_t, uint32_t> ImapCache::GetFlags(const std::string& p_Folder, co
   std::map<uint32_t, uint32_t> flags;
   if (p_Uids.empty()) return flags;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, false /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-
-  std::stringstream sstream;
-  std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-  std::string uidlist = sstream.str();
-  uidlist.pop_back(); // assumes non-empty input set
-
-  try
+  // queued writes take precedence, see GetHeaders()
+  std::set<uint32_t> dbUids = p_Uids;
   {
-    auto lambda = [&](const uint32_t& uid, const uint32_t& flag)
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    for (const auto* writes : { &m_WritingWrites, &m_PendingWrites })
     {
-      flags.insert(std::make_pair(uid, flag));
-    };
+      auto it = writes->find(p_Folder);
+      if (it == writes->end()) continue;
+
+      for (const auto& flag : it->second.m_Flags)
+      {
+        if (p_Uids.count(flag.first) == 0) continue;
 
-    *db << "SELECT uid, flag FROM flags WHERE uid IN (" + uidlist + ");" >> lambda;
+        flags[flag.first] = flag.second;
+        dbUids.erase(flag.first);
+      }
+    }
   }
-  catch (const sqlite::sqlite_exception& ex)
+
+  if (dbUids.empty()) return flags;
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId != -1)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+    try
+    {
+      dbCon->BindUids(dbUids);
+      auto lambda = [&](const uint32_t& uid, const uint32_t& flag)
+      {
+        flags.insert(std::make_pair(uid, flag));
+      };
+
+      dbCon->Prepare("SELECT uid, flag FROM flags WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);")
+        << folderId >> lambda;
+    }
+    catch (const sqlite::sqlite_exception& ex)
+    {
+      HANDLE_SQLITE_EXCEPTION(ex);
+    }
   }
 
   return flags;
@@ -419,26 +920,97 @@ std::map<uint32_t, uint32_t> ImapCache::GetFlags(const std::string& p_Folder, co
 void ImapCache::SetFlags(const std::string& p_Folder, const std::map<uint32_t, uint32_t>& p_Flags)
 {
   LOG_DURATION();
+  if (p_Flags.empty()) return;
 
   if (Util::GetReadOnly()) return;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  // read cached flags to only queue changed ones, the generation detects overlay commits and direct
+  // flag writes meanwhile
+  uint64_t writeGeneration = 0;
+  {
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    writeGeneration = m_WriteGeneration;
+  }
 
-  try
+  std::map<uint32_t, uint32_t> dbFlags;
   {
-    *db << "begin;";
-    for (const auto& flag : p_Flags)
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+    if (folderId != -1)
     {
-      *db << "INSERT OR REPLACE INTO flags (uid, flag) VALUES (?, ?);" << flag.first << flag.second;
+      std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+      try
+      {
+        std::set<uint32_t> uids;
+        for (const auto& flag : p_Flags)
+        {
+          uids.insert(uids.end(), flag.first);
+        }
+
+        dbCon->BindUids(uids);
+        auto lambda = [&](const uint32_t& uid, const uint32_t& flag)
+        {
+          dbFlags.insert(std::make_pair(uid, flag));
+        };
+
+        dbCon->Prepare("SELECT uid, flag FROM flags WHERE folder_id = ? AND "
+                       "uid IN (SELECT uid FROM temp.uidset);") << folderId >> lambda;
+      }
+      catch (const sqlite::sqlite_exception& ex)
+      {
+        HANDLE_SQLITE_EXCEPTION(ex);
+      }
     }
-    *db << "commit;";
   }
-  catch (const sqlite::sqlite_exception& ex)
+
+  std::unique_lock<std::mutex> writeLock(m_WriteMutex);
+  WaitWriteQueue(writeLock);
+  const bool dbFlagsCurrent = (writeGeneration == m_WriteGeneration);
+  auto cachedFlag = [&](uint32_t p_Uid, uint32_t& p_Flag)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    for (const auto* writes : { &m_PendingWrites, &m_WritingWrites })
+    {
+      auto it = writes->find(p_Folder);
+      if (it == writes->end()) continue;
+
+      auto flagIt = it->second.m_Flags.find(p_Uid);
+      if (flagIt == it->second.m_Flags.end()) continue;
+
+      p_Flag = flagIt->second;
+      return true;
+    }
+
+    if (!dbFlagsCurrent) return false;
+
+    auto flagIt = dbFlags.find(p_Uid);
+    if (flagIt == dbFlags.end()) return false;
+
+    p_Flag = flagIt->second;
+    return true;
+  };
+
+  std::map<uint32_t, uint32_t> changedFlags;
+  for (const auto& flag : p_Flags)
+  {
+    uint32_t cached = 0;
+    if (cachedFlag(flag.first, cached) && (cached == flag.second)) continue;
+
+    changedFlags.insert(changedFlags.end(), flag);
+  }
+
+  LOG_DEBUG("folder %s flags %d changed %d", p_Folder.c_str(), (int)p_Flags.size(), (int)changedFlags.size());
+  if (changedFlags.empty()) return;
+
+  PendingWrites& pendingWrites = m_PendingWrites[p_Folder];
+  for (const auto& flag : changedFlags)
+  {
+    pendingWrites.m_Flags[flag.first] = flag.second;
   }
+
+  m_PendingWriteCount += changedFlags.size();
+  m_WriteCondVar.notify_all();
 }
 
 // get specified bodys
@@ -449,42 +1021,78 @@ std::map<uint32_t, Body> ImapCache::GetBodys(const std::string& p_Folder, const
   std::map<uint32_t, Body> bodys;
   if (p_Uids.empty()) return bodys;
 
-  std::map<uint32_t, Body> updateCacheBodys;
+  // queued writes take precedence, see GetHeaders()
+  std::set<uint32_t> dbUids = p_Uids;
+  {
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    for (const auto* writes : { &m_WritingWrites, &m_PendingWrites })
+    {
+      auto it = writes->find(p_Folder);
+      if (it == writes->end()) continue;
+
+      for (const auto& body : it->second.m_Bodys)
+      {
+        if (p_Uids.count(body.first) == 0) continue;
+
+        bodys[body.first] = p_Prefetch ? Body() : body.second;
+        dbUids.erase(body.first);
+      }
+    }
+  }
+
+  if (dbUids.empty()) return bodys;
 
   try
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    std::shared_ptr<DbConnection> dbCon = GetDb(BodysDb, p_Folder, false /* p_Writable */);
-    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    SetUsed();
+    const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+    if (folderId != -1)
+    {
+      std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-    std::stringstream sstream;
-    std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-    std::string uidlist = sstream.str();
-    uidlist.pop_back(); // assumes non-empty input set
+      dbCon->BindUids(dbUids);
 
-    if (!p_Prefetch)
-    {
-      auto lambda = [&](const uint32_t& uid, const std::vector<char>& data)
+      if (!p_Prefetch)
       {
-        Body body;
-        body = Serialization::FromBytes<Body>(data);
-        if (body.ParseIfNeeded())
+        std::set<uint32_t> readUids;
+        auto lambda = [&](sqlite3_stmt* p_Stmt)
         {
-          updateCacheBodys[uid] = body;
-        }
-        bodys.insert(std::make_pair(uid, body));
-      };
+          const uint32_t uid = sqlite3_column_int64(p_Stmt, 0);
+          const std::string_view packedData = GetBlob(p_Stmt, 1);
+          const int codec = sqlite3_column_int(p_Stmt, 2);
+          const std::string_view meta = GetBlob(p_Stmt, 3);
+          std::string data;
+          if (!UnpackBodyData(codec, packedData.data(), packedData.size(), data))
+          {
+            LOG_WARNING("invalid cached body folder %s uid = %d", p_Folder.c_str(), uid);
+            return;
+          }
 
-      *db << "SELECT uid, data FROM bodys WHERE uid IN (" + uidlist + ");" >> lambda;
-    }
-    else
-    {
-      auto lambda = [&](const uint32_t& uid)
+          // bodys of earlier parse versions are used as-is, see ReparseStale()
+          Body body;
+          DecodeBody(std::move(data), meta.data(), meta.size(), body);
+          bodys.insert(std::make_pair(uid, body));
+          readUids.insert(readUids.end(), uid);
+        };
+
+        dbCon->SelectRows("SELECT b.uid, IFNULL(d.data, b.data), IFNULL(d.codec, b.codec), b.meta FROM bodys b "
+                          "LEFT JOIN bodydata d ON d.hash = b.hash "
+                          "WHERE b.folder_id = ? AND b.uid IN (SELECT uid FROM temp.uidset);", folderId, lambda);
+
+        SetAccessed(folderId, readUids);
+      }
+      else
       {
-        bodys.insert(std::make_pair(uid, Body()));
-      };
+        auto lambda = [&](const uint32_t& uid)
+        {
+          bodys.insert(std::make_pair(uid, Body()));
+        };
 
-      *db << "SELECT uid FROM bodys WHERE uid IN (" + uidlist + ");" >> lambda;
+        dbCon->Prepare("SELECT uid FROM bodys WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);")
+          << folderId >> lambda;
+      }
     }
   }
   catch (const sqlite::sqlite_exception& ex)
@@ -492,11 +1100,6 @@ std::map<uint32_t, Body> ImapCache::GetBodys(const std::string& p_Folder, const
     HANDLE_SQLITE_EXCEPTION(ex);
   }
 
-  if (!updateCacheBodys.empty())
-  {
-    SetBodys(p_Folder, updateCacheBodys);
-  }
-
   return bodys;
 }
 
@@ -508,24 +1111,76 @@ void ImapCache::SetBodys(const std::string& p_Folder, const std::map<uint32_t, B
 
   if (Util::GetReadOnly()) return;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(BodysDb, p_Folder, true /* p_Writable */);
+  std::unique_lock<std::mutex> writeLock(m_WriteMutex);
+  WaitWriteQueue(writeLock);
+  PendingWrites& pendingWrites = m_PendingWrites[p_Folder];
+  for (const auto& body : p_Bodys)
+  {
+    pendingWrites.m_Bodys[body.first] = body.second;
+  }
+
+  m_PendingWriteCount += p_Bodys.size();
+  m_WriteCondVar.notify_all();
+}
+
+// link bodys of messages already cached in other folders (e.g. gmail labels), identified by
+// message-id and header hash, returns uids linked which no longer need to be fetched
+std::set<uint32_t> ImapCache::LinkBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  LOG_DURATION();
+  std::set<uint32_t> linkedUids;
+  if (p_Uids.empty()) return linkedUids;
+
+  if (Util::GetReadOnly()) return linkedUids;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return linkedUids;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
   std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
   try
   {
-    *db << "begin;";
-    for (const auto& body : p_Bodys)
+    dbCon->BindUids(p_Uids);
+    DbTransaction transaction(db);
+    auto lambda = [&](const uint32_t& uid)
     {
-      *db << "INSERT OR REPLACE INTO bodys (uid, data) VALUES (?, ?);" << body.first <<
-        Serialization::ToBytes(body.second);
-    }
-    *db << "commit;";
+      linkedUids.insert(uid);
+    };
+
+    dbCon->Prepare("INSERT OR IGNORE INTO bodys (folder_id, uid, codec, size, meta, hash, accessed) "
+                   "SELECT h.folder_id, h.uid, b.codec, b.size, b.meta, b.hash, ? FROM headerfields h "
+                   "JOIN headerfields o ON o.message_id = h.message_id AND o.header_hash = h.header_hash "
+                   "AND o.folder_id != h.folder_id "
+                   "JOIN bodys b ON b.folder_id = o.folder_id AND b.uid = o.uid AND b.hash IS NOT NULL "
+                   "WHERE h.folder_id = ? AND h.uid IN (SELECT uid FROM temp.uidset) AND h.message_id != '' "
+                   "RETURNING uid;") << (int64_t)time(NULL) << folderId >> lambda;
+
+    const int64_t lookups = p_Uids.size();
+    const int64_t hits = linkedUids.size();
+    sqlite::database_binder& updateCounter =
+      dbCon->Prepare("INSERT INTO counters (name, value) VALUES (?, ?) "
+                     "ON CONFLICT (name) DO UPDATE SET value = value + excluded.value;");
+    updateCounter << "dedup_lookups" << lookups;
+    updateCounter.execute();
+    updateCounter.reset();
+    updateCounter << "dedup_hits" << hits;
+    updateCounter.execute();
+    transaction.Commit();
   }
   catch (const sqlite::sqlite_exception& ex)
   {
     HANDLE_SQLITE_EXCEPTION(ex);
   }
+
+  if (!linkedUids.empty())
+  {
+    LOG_DEBUG("linked %d of %d bodys in %s", linkedUids.size(), p_Uids.size(), p_Folder.c_str());
+  }
+
+  return linkedUids;
 }
 
 // checks cached uid validity and clears existing cache if invalid
@@ -535,15 +1190,13 @@ bool ImapCache::CheckUidValidity(const std::string& p_Folder, int p_Uid)
   bool rv = true;
   try
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
     int storedUid = -1;
 
-    const std::string commonFolder = "common";
-    const std::string dbFolder = Util::ToHex(p_Folder);
-    if (storedUid == -1)
+    const int64_t folderId = GetFolderId(p_Folder, !Util::GetReadOnly() /* p_Create */);
+    if (folderId != -1)
     {
-      std::shared_ptr<DbConnection> dbCon = GetDb(ValidityDb, commonFolder,
-                                                  false /* p_Writable */);
+      std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
       std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
       auto lambda = [&](const uint32_t& uid)
@@ -551,31 +1204,10 @@ bool ImapCache::CheckUidValidity(const std::string& p_Folder, int p_Uid)
         storedUid = uid;
       };
 
-      *db << "SELECT validity.uid FROM validity WHERE folder = '" + dbFolder + "'"
-        >> lambda;
-    }
-
-    // @todo: remove below when we update version in InitUidFlagsCache().
-    bool isLegacy = false;
-    if (storedUid == -1)
-    {
-      std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder,
-                                                  false /* p_Writable */);
-      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-
-      auto lambda = [&](const std::vector<int32_t>& vecdata)
-      {
-        if (vecdata.size() == 1)
-        {
-          storedUid = vecdata.at(0);
-        }
-      };
-
-      *db << "SELECT uidvalidity.uidvalidity FROM uidvalidity LIMIT 1" >> lambda;
-      isLegacy = (storedUid != -1);
+      dbCon->Prepare("SELECT uid FROM validity WHERE folder_id = ?;") << folderId >> lambda;
     }
 
-    if (isLegacy || (p_Uid != storedUid))
+    if (p_Uid != storedUid)
     {
       if (Util::GetReadOnly())
       {
@@ -583,23 +1215,15 @@ bool ImapCache::CheckUidValidity(const std::string& p_Folder, int p_Uid)
       }
       else
       {
-        std::shared_ptr<DbConnection> dbCon = GetDb(ValidityDb, commonFolder,
-                                                    true /* p_Writable */);
+        std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
         std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-        *db << "INSERT OR REPLACE INTO validity (folder, uid) VALUES (?, ?);"
-            << dbFolder << p_Uid;
+        *db << "INSERT OR REPLACE INTO validity (folder_id, uid) VALUES (?, ?);"
+            << folderId << p_Uid;
 
         if (storedUid != -1)
         {
-          if (p_Uid == storedUid) // isLegacy
-          {
-            LOG_INFO("folder %s uidvalidity migrated (%d)", p_Folder.c_str(), p_Uid);
-          }
-          else
-          {
-            LOG_INFO("folder %s uidvalidity updated (%d)", p_Folder.c_str(), p_Uid);
-          }
+          LOG_INFO("folder %s uidvalidity updated (%d)", p_Folder.c_str(), p_Uid);
         }
         else
         {
@@ -617,507 +1241,2253 @@ bool ImapCache::CheckUidValidity(const std::string& p_Folder, int p_Uid)
 
   if (!rv)
   {
-    ClearFolder(p_Folder);
+    ClearFolder(p_Folder);
+  }
+
+  return rv;
+}
+
+// get highest mod-sequence up to which all cached flags of folder are known to be current, zero if unknown
+uint64_t ImapCache::GetModSeq(const std::string& p_Folder)
+{
+  LOG_DURATION();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  int64_t modSeq = 0;
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return 0;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+  try
+  {
+    dbCon->Prepare("SELECT modseq FROM validity WHERE folder_id = ?;") << folderId >> [&](const int64_t& value)
+    {
+      modSeq = value;
+    };
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+
+  return static_cast<uint64_t>(modSeq);
+}
+
+// set highest mod-sequence, queued flags are written first so the stored value never runs ahead of them
+void ImapCache::SetModSeq(const std::string& p_Folder, uint64_t p_ModSeq)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_ModSeq));
+
+  if (Util::GetReadOnly()) return;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  try
+  {
+    *db << "UPDATE validity SET modseq = ? WHERE folder_id = ?;" << static_cast<int64_t>(p_ModSeq) << folderId;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// set specified uids seen flag
+void ImapCache::SetFlagSeen(const std::string& p_Folder, const std::set<uint32_t>& p_Uids, const bool p_Value)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
+
+  if (Util::GetReadOnly()) return;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, true /* p_Create */);
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    dbCon->BindUids(p_Uids);
+    *db << "UPDATE flags SET flag = ? WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);"
+        << (uint32_t)p_Value << folderId;
+    FlagsWritten();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// clear specified folder
+void ImapCache::ClearFolder(const std::string& p_Folder)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder));
+
+  if (Util::GetReadOnly()) return;
+
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  try
+  {
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    DbTransaction transaction(db);
+    *db << "DELETE FROM headers WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM headerfields WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM bodys WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM uids WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM flags WHERE folder_id = ?;" << folderId;
+    *db << "UPDATE validity SET modseq = 0 WHERE folder_id = ?;" << folderId;
+    transaction.Commit();
+    FlagsWritten();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// delete specified messages
+void ImapCache::DeleteMessages(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  FlushWrites();
+  DeleteUids(p_Folder, p_Uids);
+  DeleteFlags(p_Folder, p_Uids);
+  DeleteHeaders(p_Folder, p_Uids);
+  DeleteBodys(p_Folder, p_Uids);
+}
+
+// delete specified uids
+void ImapCache::DeleteUids(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+
+  if (Util::GetReadOnly()) return;
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    dbCon->BindUids(p_Uids);
+    *db << "DELETE FROM uids WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// delete specified flags
+void ImapCache::DeleteFlags(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+
+  if (Util::GetReadOnly()) return;
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    dbCon->BindUids(p_Uids);
+    *db << "DELETE FROM flags WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+    FlagsWritten();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// delete specified headers
+void ImapCache::DeleteHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+
+  if (Util::GetReadOnly()) return;
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    dbCon->BindUids(p_Uids);
+    DbTransaction transaction(db);
+    *db << "DELETE FROM headers WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+    *db << "DELETE FROM headerfields WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+    transaction.Commit();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// delete specified bodys
+void ImapCache::DeleteBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+
+  if (Util::GetReadOnly()) return;
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+  if (folderId == -1) return;
+
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    dbCon->BindUids(p_Uids);
+    *db << "DELETE FROM bodys WHERE folder_id = ? AND uid IN (SELECT uid FROM temp.uidset);" << folderId;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// export cached messages to Maildir, folders are exported in parallel and messages in batches to
+// bound memory use, incremental export only writes messages not already exported
+bool ImapCache::Export(const std::string& p_Path, bool p_Incremental)
+{
+  Util::MkDir(p_Path);
+  Util::MkDir(p_Path + "/new");
+  Util::MkDir(p_Path + "/tmp");
+  Util::MkDir(p_Path + "/cur");
+
+  FlushWrites();
+  const std::set<std::string> folderSet = GetFolders();
+  const std::vector<std::string> folders(folderSet.begin(), folderSet.end());
+  std::atomic<bool> rv(true);
+  Util::ParallelFor(folders.size(), [&](size_t p_Index)
+  {
+    const std::string& folder = folders.at(p_Index);
+    std::string folderName = folder;
+    Util::ReplaceString(folderName, "/", "_");
+    if (!ExportFolder(folder, p_Path + "/" + folderName, p_Incremental))
+    {
+      rv = false;
+    }
+  });
+
+  return rv;
+}
+
+bool ImapCache::ExportFolder(const std::string& p_Folder, const std::string& p_FolderPath, bool p_Incremental)
+{
+  LOG_DURATION();
+  Util::MkDir(p_FolderPath);
+  Util::MkDir(p_FolderPath + "/new");
+  Util::MkDir(p_FolderPath + "/tmp");
+  Util::MkDir(p_FolderPath + "/cur");
+
+  // unique names are derived from message timestamp, uid validity and uid, to be stable across exports
+  int64_t uidValidity = 0;
+  std::map<uint32_t, int64_t> timeStamps;
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    const int64_t folderId = GetFolderId(p_Folder, false /* p_Create */);
+    if (folderId == -1) return true;
+
+    try
+    {
+      std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+      dbCon->Prepare("SELECT uid FROM validity WHERE folder_id = ?;") << folderId >> [&](const int64_t& uid)
+      {
+        uidValidity = uid;
+      };
+      dbCon->Prepare("SELECT uid, timestamp FROM headerfields WHERE folder_id = ?;") << folderId
+        >> [&](const uint32_t& uid, const int64_t& timeStamp)
+      {
+        timeStamps[uid] = timeStamp;
+      };
+    }
+    catch (const sqlite::sqlite_exception& ex)
+    {
+      LOG_WARNING("failed to read export info for %s (%d)", p_Folder.c_str(), ex.get_code());
+      return false;
+    }
+  }
+
+  // maildir unique name must not contain slash or colon
+  static const std::string hostName = []()
+  {
+    char buf[256] = { 0 };
+    std::string name = (gethostname(buf, sizeof(buf) - 1) == 0) ? buf : "localhost";
+    Util::ReplaceString(name, "/", "\\057");
+    Util::ReplaceString(name, ":", "\\072");
+    return name;
+  }();
+
+  // manifest of previous export, with exported file name per uid
+  const std::string manifestPath = p_FolderPath + "/" + s_ExportManifestName;
+  std::map<uint32_t, std::string> oldNames;
+  const bool hasManifest = Util::Exists(manifestPath);
+  {
+    std::ifstream manifest(manifestPath);
+    int64_t manifestValidity = -1;
+    if ((manifest >> manifestValidity) && (manifestValidity == uidValidity))
+    {
+      uint32_t uid = 0;
+      std::string name;
+      while (manifest >> uid >> name)
+      {
+        oldNames[uid] = name;
+      }
+    }
+  }
+
+  const std::set<uint32_t> uids = GetUids(p_Folder);
+  const std::map<uint32_t, uint32_t> flags = GetFlags(p_Folder, uids);
+  std::map<uint32_t, std::string> newNames;
+  std::vector<uint32_t> writeUids;
+  int64_t renameCount = 0;
+  for (const auto& uid : uids)
+  {
+    auto flagIt = flags.find(uid);
+    const bool seen = (flagIt != flags.end()) && Flag::GetSeen(flagIt->second);
+    auto timeIt = timeStamps.find(uid);
+    const std::string uniqueName = std::to_string((timeIt != timeStamps.end()) ? timeIt->second : 0) +
+      ".nmail_" + std::to_string(uidValidity) + "_" + std::to_string(uid) + "." + hostName;
+    const std::string name = uniqueName + ":2," + (seen ? "S" : "");
+
+    auto oldIt = oldNames.find(uid);
+    if (p_Incremental && (oldIt != oldNames.end()) && (oldIt->second.rfind(uniqueName + ":", 0) == 0) &&
+        Util::Exists(p_FolderPath + "/cur/" + oldIt->second))
+    {
+      // already exported, only flags may have changed
+      if (oldIt->second != name)
+      {
+        Util::Move(p_FolderPath + "/cur/" + oldIt->second, p_FolderPath + "/cur/" + name);
+        ++renameCount;
+      }
+
+      newNames[uid] = name;
+      oldNames.erase(oldIt);
+      continue;
+    }
+
+    writeUids.push_back(uid);
+    newNames[uid] = name;
+  }
+
+  int64_t writeCount = 0;
+  for (size_t i = 0; i < writeUids.size(); i += s_ExportBatchSize)
+  {
+    const std::set<uint32_t> batchUids(writeUids.begin() + i,
+                                       writeUids.begin() + std::min(i + s_ExportBatchSize, writeUids.size()));
+    const std::map<uint32_t, Body> bodys = GetBodys(p_Folder, batchUids, false /*p_Prefetch*/);
+    for (const auto& uid : batchUids)
+    {
+      auto bodyIt = bodys.find(uid);
+      if (bodyIt == bodys.end())
+      {
+        // not cached, keep any previously exported file, or export once fetched
+        auto oldIt = oldNames.find(uid);
+        if ((oldIt != oldNames.end()) && Util::Exists(p_FolderPath + "/cur/" + oldIt->second))
+        {
+          newNames[uid] = oldIt->second;
+          oldNames.erase(oldIt);
+        }
+        else
+        {
+          newNames.erase(uid);
+        }
+
+        continue;
+      }
+
+      // deliver through tmp, so readers never see partially written files
+      const std::string& name = newNames.at(uid);
+      const std::string tmpPath = p_FolderPath + "/tmp/" + name.substr(0, name.find(':'));
+      Util::WriteFile(tmpPath, bodyIt->second.GetData());
+      Util::Move(tmpPath, p_FolderPath + "/cur/" + name);
+      ++writeCount;
+
+      if (!hasManifest)
+      {
+        // replace file exported by earlier versions
+        Util::DeleteFile(p_FolderPath + "/cur/" + std::to_string(uid) + ".eml");
+      }
+
+      auto oldIt = oldNames.find(uid);
+      if ((oldIt != oldNames.end()) && (oldIt->second == name))
+      {
+        oldNames.erase(oldIt);
+      }
+    }
+  }
+
+  // remove messages no longer in folder, or exported under a different name
+  for (const auto& oldName : oldNames)
+  {
+    Util::DeleteFile(p_FolderPath + "/cur/" + oldName.second);
+  }
+
+  std::string manifest = std::to_string(uidValidity) + "\n";
+  for (const auto& newName : newNames)
+  {
+    manifest += std::to_string(newName.first) + " " + newName.second + "\n";
+  }
+
+  const std::string tmpManifestPath = manifestPath + ".tmp";
+  Util::WriteFile(tmpManifestPath, manifest);
+  Util::Move(tmpManifestPath, manifestPath);
+
+  LOG_INFO("exported %s: %lld written, %lld renamed, %lld removed", p_Folder.c_str(), (long long)writeCount,
+           (long long)renameCount, (long long)oldNames.size());
+  return true;
+}
+
+ImapCache::Stats ImapCache::GetStats()
+{
+  Stats stats;
+  FlushWrites();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+  try
+  {
+    *db << "SELECT COUNT(*), TOTAL(codec != ?), TOTAL(size), "
+          "TOTAL(IFNULL(LENGTH(data), 0) + IFNULL(LENGTH(meta), 0)) FROM bodys;" << s_CodecNone
+        >> std::tie(stats.m_BodyCount, stats.m_BodyCompressedCount, stats.m_BodyDataSize, stats.m_BodyStoredSize);
+
+    // bodys sharing content-addressed data with another folder
+    int64_t bodyDataStoredSize = 0;
+    *db << "SELECT (SELECT COUNT(*) FROM bodys WHERE hash IS NOT NULL) - COUNT(*), TOTAL(LENGTH(data)) "
+          "FROM bodydata;" >> std::tie(stats.m_BodySharedCount, bodyDataStoredSize);
+    stats.m_BodyStoredSize += bodyDataStoredSize;
+    *db << "SELECT IFNULL((SELECT value FROM counters WHERE name = 'dedup_lookups'), 0), "
+          "IFNULL((SELECT value FROM counters WHERE name = 'dedup_hits'), 0);"
+        >> std::tie(stats.m_DedupLookups, stats.m_DedupHits);
+    *db << "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();" >> stats.m_DbSize;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+
+  return stats;
+}
+
+// check db integrity, delete orphaned rows and folders no longer present on server, and vacuum db
+ImapCache::MaintenanceReport ImapCache::Maintain()
+{
+  LOG_DEBUG_FUNC(STR());
+
+  MaintenanceReport report;
+  FlushWrites();
+  FlushAccessTimes();
+  const std::set<std::string> folders = GetFolders();
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+
+  try
+  {
+    {
+      std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+      std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+      int64_t pageSize = 0;
+      int64_t pageCount = 0;
+      int64_t freePages = 0;
+      *db << "SELECT page_size, page_count, freelist_count FROM pragma_page_size(), pragma_page_count(), "
+        "pragma_freelist_count();" >> std::tie(pageSize, pageCount, freePages);
+      report.m_DbSize = pageSize * pageCount;
+      report.m_FreeSize = pageSize * freePages;
+
+      std::map<int64_t, std::string> folderNames;
+      *db << "SELECT id, name FROM folders;" >> [&](const int64_t& id, const std::string& name)
+      {
+        folderNames[id] = name;
+      };
+
+      auto folderStats = [&](const int64_t& p_FolderId) -> MaintenanceReport::FolderStats&
+      {
+        auto it = folderNames.find(p_FolderId);
+        return report.m_Folders[(it != folderNames.end()) ? it->second : ("#" + std::to_string(p_FolderId))];
+      };
+
+      *db << "SELECT folder_id, COUNT(*) FROM uids GROUP BY folder_id;"
+          >> [&](const int64_t& folderId, const int64_t& count)
+      {
+        folderStats(folderId).m_UidCount = count;
+      };
+      *db << "SELECT folder_id, COUNT(*), TOTAL(LENGTH(data)) FROM headers GROUP BY folder_id;"
+          >> [&](const int64_t& folderId, const int64_t& count, const int64_t& size)
+      {
+        folderStats(folderId).m_HeaderCount = count;
+        folderStats(folderId).m_StoredSize += size;
+      };
+      *db << "SELECT folder_id, COUNT(*), TOTAL(IFNULL(LENGTH(data), 0) + IFNULL(LENGTH(meta), 0)) FROM bodys "
+        "GROUP BY folder_id;" >> [&](const int64_t& folderId, const int64_t& count, const int64_t& size)
+      {
+        folderStats(folderId).m_BodyCount = count;
+        folderStats(folderId).m_StoredSize += size;
+      };
+
+      std::vector<std::string> tables;
+      *db << "SELECT name FROM sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite_%';"
+          >> [&](const std::string& name)
+      {
+        tables.push_back(name);
+      };
+
+      for (const auto& table : tables)
+      {
+        *db << "SELECT COUNT(*) FROM \"" + table + "\";" >> report.m_Tables[table].m_RowCount;
+      }
+
+      try
+      {
+        // table size including its indices, dbstat is an optional sqlite compile-time feature
+        *db << "SELECT m.tbl_name, TOTAL(s.pgsize) FROM dbstat s JOIN sqlite_master m ON m.name = s.name "
+          "GROUP BY m.tbl_name;" >> [&](const std::string& table, const int64_t& size)
+        {
+          if (report.m_Tables.count(table) == 0) return;
+
+          report.m_Tables[table].m_Size = size;
+        };
+      }
+      catch (const sqlite::sqlite_exception& ex)
+      {
+        LOG_DEBUG("dbstat not available (%d)", ex.get_code());
+      }
+
+      *db << "PRAGMA integrity_check(100);" >> [&](const std::string& result)
+      {
+        if (result == "ok") return;
+
+        report.m_IntegrityErrors.push_back(result);
+      };
+      report.m_IntegrityChecked = true;
+
+      for (const auto& folderName : folderNames)
+      {
+        if (!folders.empty() && (folders.count(folderName.second) == 0))
+        {
+          report.m_StaleFolders.insert(folderName.second);
+        }
+      }
+
+      if (Util::GetReadOnly() || !report.m_IntegrityErrors.empty())
+      {
+        for (const auto& orphanCondition : s_OrphanConditions)
+        {
+          *db << "SELECT COUNT(*) FROM " + orphanCondition.first + " t WHERE " + orphanCondition.second + ";"
+              >> report.m_Orphans[orphanCondition.first];
+        }
+
+        return report;
+      }
+    }
+
+    // uids are checked first, so a single pass also covers rows of uids without folder
+    DeleteStaleFolders(report.m_StaleFolders);
+    DeleteOrphans(-1 /* p_Limit */, report.m_Orphans);
+
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+    // switching to incremental auto vacuum only takes effect on vacuum, it allows idle maintenance to
+    // release free pages without rewriting the whole db
+    LOG_INFO("vacuum db");
+    *db << "PRAGMA auto_vacuum = INCREMENTAL;";
+    *db << "VACUUM;";
+    *db << "PRAGMA wal_checkpoint(TRUNCATE);";
+    *db << "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();" >> report.m_VacuumedDbSize;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+
+  return report;
+}
+
+void ImapCache::InitCache()
+{
+  std::unique_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  static const int version = 1;
+  CacheUtil::CommonInitCacheDir(GetCacheDir(), version, m_CacheEncrypt);
+  Util::MkDir(GetCacheDbDir());
+  std::string dbPath = GetCacheDbDir() + GetDbName();
+  std::string vfsName;
+  if (m_CacheEncrypt)
+  {
+    Util::RmDir(GetTempDbDir());
+    Util::MkDir(GetTempDbDir());
+
+    m_VfsName = CryptoVfs::Register(m_Pass);
+    vfsName = m_VfsName;
+    if (Util::Exists(dbPath) && !CryptoVfs::IsEncryptedFile(dbPath))
+    {
+      // db encrypted as a whole file by earlier versions
+      const std::string tmpDbPath = GetTempDbDir() + GetDbName();
+      if (!Crypto::AESDecryptFile(dbPath, tmpDbPath, m_Pass))
+      {
+        Util::DeleteFile(tmpDbPath);
+      }
+
+      if (Util::GetReadOnly())
+      {
+        // use decrypted copy until converted by a read-write instance
+        dbPath = tmpDbPath;
+        vfsName.clear();
+      }
+      else
+      {
+        LOG_INFO("convert whole-file encrypted cache db");
+        const std::string newDbPath = dbPath + ".tmp";
+        if (Util::Exists(tmpDbPath) && CopyDb(tmpDbPath, "", newDbPath, m_VfsName))
+        {
+          Util::Move(newDbPath, dbPath);
+        }
+        else
+        {
+          LOG_WARNING("failed to convert cache db");
+          Util::DeleteFile(newDbPath);
+          Util::DeleteFile(dbPath);
+        }
+
+        Util::DeleteFile(tmpDbPath);
+      }
+    }
+  }
+
+  const bool isNewDb = !Util::Exists(dbPath);
+  if (Util::GetReadOnly() && isNewDb)
+  {
+    // create empty db to allow read-only connections to open it
+    DbConnection dbConnection(dbPath, false /* p_ReadOnly */, vfsName);
+  }
+
+  m_WriteDb = std::make_shared<DbConnection>(dbPath, Util::GetReadOnly(), vfsName);
+  if (!Util::GetReadOnly())
+  {
+    InitDb();
+    MigrateLegacyCache();
+  }
+}
+
+void ImapCache::CleanupCache()
+{
+  std::unique_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  CloseDbs();
+
+  if (!m_VfsName.empty())
+  {
+    CryptoVfs::Unregister(m_VfsName);
+    m_VfsName.clear();
+  }
+}
+
+// must be called with exclusive cachelock
+void ImapCache::InitDb()
+{
+  LOG_DEBUG_FUNC(STR());
+
+  // schema version of account db, stored as sqlite user_version
+  static const int dbVersion = 8;
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  try
+  {
+    int storedVersion = 0;
+    *db << "PRAGMA user_version;" >> storedVersion;
+    if (storedVersion == dbVersion) return;
+
+    int tableCount = 0;
+    *db << "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'folders';" >> tableCount;
+    if (tableCount == 0)
+    {
+      // must be set before creating tables, existing dbs are converted by Maintain()
+      *db << "PRAGMA auto_vacuum = INCREMENTAL;";
+      CreateTables();
+    }
+    else
+    {
+      // initial version did not set user_version
+      storedVersion = std::max(storedVersion, 1);
+      LOG_INFO("upgrade cache db version %d to %d", storedVersion, dbVersion);
+      UpgradeTables(storedVersion);
+    }
+
+    *db << "PRAGMA user_version = " + std::to_string(dbVersion) + ";";
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    HANDLE_SQLITE_EXCEPTION(ex);
+  }
+}
+
+// must be called with exclusive cachelock
+void ImapCache::CreateTables()
+{
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  *db << "CREATE TABLE IF NOT EXISTS folders (id INTEGER PRIMARY KEY, name TEXT UNIQUE);";
+  *db << "CREATE TABLE IF NOT EXISTS validity (folder_id INT, uid INT, modseq INT NOT NULL DEFAULT 0, "
+    "PRIMARY KEY (folder_id));";
+  *db << "CREATE TABLE IF NOT EXISTS uids (folder_id INT, uid INT, PRIMARY KEY (folder_id, uid)) WITHOUT ROWID;";
+  *db << "CREATE TABLE IF NOT EXISTS flags (folder_id INT, uid INT, flag INT, PRIMARY KEY (folder_id, uid));";
+  *db << "CREATE TABLE IF NOT EXISTS headers (folder_id INT, uid INT, data BLOB, PRIMARY KEY (folder_id, uid));";
+  *db << "CREATE TABLE IF NOT EXISTS bodys (folder_id INT, uid INT, data BLOB, "
+    "codec INT NOT NULL DEFAULT 0, size INT NOT NULL DEFAULT 0, meta BLOB, hash TEXT, accessed INT NOT NULL DEFAULT 0, "
+    "PRIMARY KEY (folder_id, uid));";
+  *db << "CREATE INDEX IF NOT EXISTS bodys_accessed ON bodys (accessed);";
+  CreateHeaderFieldsTable();
+  CreateBodyDataTables();
+}
+
+// must be called with exclusive cachelock
+void ImapCache::CreateHeaderFieldsTable()
+{
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  *db << "CREATE TABLE IF NOT EXISTS headerfields (folder_id INT, uid INT, timestamp INT, from_name TEXT, "
+    "to_name TEXT, subject TEXT, has_attachments INT, message_id TEXT, header_hash TEXT, "
+    "PRIMARY KEY (folder_id, uid)) WITHOUT ROWID;";
+  *db << "CREATE INDEX IF NOT EXISTS headerfields_timestamp ON headerfields (folder_id, timestamp);";
+  *db << "CREATE INDEX IF NOT EXISTS headerfields_from_name ON headerfields (folder_id, from_name);";
+  *db << "CREATE INDEX IF NOT EXISTS headerfields_to_name ON headerfields (folder_id, to_name);";
+  *db << "CREATE INDEX IF NOT EXISTS headerfields_subject ON headerfields (folder_id, subject);";
+  *db << "CREATE INDEX IF NOT EXISTS headerfields_message_id ON headerfields (message_id);";
+}
+
+// must be called with exclusive cachelock
+void ImapCache::CreateBodyDataTables()
+{
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  *db << "CREATE TABLE IF NOT EXISTS bodydata (hash TEXT PRIMARY KEY, data BLOB, "
+    "codec INT NOT NULL DEFAULT 0, size INT NOT NULL DEFAULT 0);";
+  *db << "CREATE INDEX IF NOT EXISTS bodys_hash ON bodys (hash);";
+
+  // remove body data no longer referenced by any folder
+  *db << "CREATE TRIGGER IF NOT EXISTS bodys_delete AFTER DELETE ON bodys WHEN OLD.hash IS NOT NULL BEGIN "
+    "DELETE FROM bodydata WHERE hash = OLD.hash AND NOT EXISTS (SELECT 1 FROM bodys WHERE hash = OLD.hash); END;";
+  *db << "CREATE TRIGGER IF NOT EXISTS bodys_update AFTER UPDATE OF hash ON bodys "
+    "WHEN OLD.hash IS NOT NULL AND OLD.hash IS NOT NEW.hash BEGIN "
+    "DELETE FROM bodydata WHERE hash = OLD.hash AND NOT EXISTS (SELECT 1 FROM bodys WHERE hash = OLD.hash); END;";
+
+  *db << "CREATE TABLE IF NOT EXISTS counters (name TEXT PRIMARY KEY, value INT NOT NULL DEFAULT 0);";
+}
+
+// must be called with exclusive cachelock
+void ImapCache::UpgradeTables(int p_FromVersion)
+{
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  DbTransaction transaction(db);
+
+  if (p_FromVersion < 2)
+  {
+    // uid list stored as one row per uid instead of a single blob per folder
+    std::map<int64_t, std::vector<uint32_t>> folderUids;
+    *db << "SELECT folder_id, uids FROM uids;" >> [&](const int64_t& folderId, const std::vector<uint32_t>& uids)
+    {
+      folderUids[folderId] = uids;
+    };
+
+    *db << "DROP TABLE uids;";
+    *db << "CREATE TABLE uids (folder_id INT, uid INT, PRIMARY KEY (folder_id, uid)) WITHOUT ROWID;";
+    sqlite::database_binder& insert =
+      m_WriteDb->Prepare("INSERT OR IGNORE INTO uids (folder_id, uid) VALUES (?, ?);");
+    for (const auto& uids : folderUids)
+    {
+      for (const auto& uid : uids.second)
+      {
+        insert.reset();
+        insert << uids.first << uid;
+        insert.execute();
+      }
+    }
+  }
+
+  if (p_FromVersion < 3)
+  {
+    // body data codec and uncompressed size, existing bodys are compressed in background
+    *db << "ALTER TABLE bodys ADD COLUMN codec INT NOT NULL DEFAULT 0;";
+    *db << "ALTER TABLE bodys ADD COLUMN size INT NOT NULL DEFAULT 0;";
+    *db << "UPDATE bodys SET size = LENGTH(data);";
+  }
+
+  if (p_FromVersion < 4)
+  {
+    // body metadata stored separately from raw data, existing bodys are converted in background
+    *db << "ALTER TABLE bodys ADD COLUMN meta BLOB;";
+  }
+
+  if (p_FromVersion < 5)
+  {
+    // sortable header fields, populated for existing headers in background
+    CreateHeaderFieldsTable();
+  }
+
+  if (p_FromVersion < 6)
+  {
+    // header fields with header hash, repopulated in background
+    if (p_FromVersion >= 5)
+    {
+      *db << "DROP TABLE headerfields;";
+      CreateHeaderFieldsTable();
+    }
+
+    // raw body data stored once per content hash, existing bodys are moved in background
+    *db << "ALTER TABLE bodys ADD COLUMN hash TEXT;";
+    CreateBodyDataTables();
+  }
+
+  if (p_FromVersion < 7)
+  {
+    // body last access time, for eviction when exceeding cache size limit
+    *db << "ALTER TABLE bodys ADD COLUMN accessed INT NOT NULL DEFAULT 0;";
+    *db << "CREATE INDEX IF NOT EXISTS bodys_accessed ON bodys (accessed);";
+  }
+
+  if (p_FromVersion < 8)
+  {
+    // highest mod-sequence of cached flags, for condstore incremental flag sync
+    *db << "ALTER TABLE validity ADD COLUMN modseq INT NOT NULL DEFAULT 0;";
+  }
+
+  transaction.Commit();
+}
+
+// must be called with exclusive cachelock
+void ImapCache::MigrateLegacyCache()
+{
+  bool hasLegacy = false;
+  bool isValid = true;
+  for (const auto& typeName : GetLegacyTypeNames())
+  {
+    const std::string legacyDir = GetLegacyCacheDir(typeName);
+    if (!Util::Exists(legacyDir)) continue;
+
+    hasLegacy = true;
+    static const std::map<std::string, int> legacyVersions =
+    {
+      { "headers", 2 },
+      { "messages", 2 },
+      { "uidflags", 2 },
+      { "validity", 1 },
+    };
+    const int legacyVersion = (legacyVersions.at(typeName) * 10) + (m_CacheEncrypt ? 1 : 0);
+    int storedVersion = -1;
+    CacheUtil::ReadVersionFromFile(legacyDir + "version", storedVersion);
+    isValid &= (storedVersion == legacyVersion);
+  }
+
+  if (!hasLegacy) return;
+
+  LOG_DURATION();
+  if (isValid)
+  {
+    LOG_INFO("migrate legacy cache");
+    const std::string legacyFoldersPath = GetLegacyCacheDir("headers") + "folders";
+    const std::set<std::string> folders =
+      Serialization::FromString<std::set<std::string>>(ReadCacheFile(legacyFoldersPath));
+    WriteCacheFile(GetFoldersPath(), Serialization::ToString(folders));
+
+    for (const auto& folder : folders)
+    {
+      const int64_t folderId = GetFolderId(folder, true /* p_Create */);
+      const std::string& dbName = GetLegacyDbName(folder);
+      std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+      MigrateLegacyDb("headers", dbName, [&]()
+      {
+        *db << "INSERT OR REPLACE INTO headers (folder_id, uid, data) "
+          "SELECT ?, uid, data FROM legacy.headers;" << folderId;
+      });
+      MigrateLegacyDb("messages", dbName, [&]()
+      {
+        *db << "INSERT OR REPLACE INTO bodys (folder_id, uid, data, codec, size) "
+          "SELECT ?, uid, data, ?, LENGTH(data) FROM legacy.bodys;" << folderId << s_CodecNone;
+      });
+      MigrateLegacyDb("uidflags", dbName, [&]()
+      {
+        std::vector<uint32_t> uids;
+        *db << "SELECT uids FROM legacy.uids LIMIT 1;" >> [&](const std::vector<uint32_t>& data)
+        {
+          uids = data;
+        };
+
+        sqlite::database_binder& insert =
+          m_WriteDb->Prepare("INSERT OR IGNORE INTO uids (folder_id, uid) VALUES (?, ?);");
+        for (const auto& uid : uids)
+        {
+          insert.reset();
+          insert << folderId << uid;
+          insert.execute();
+        }
+
+        *db << "INSERT OR REPLACE INTO flags (folder_id, uid, flag) "
+          "SELECT ?, uid, flag FROM legacy.flags;" << folderId;
+      });
+    }
+
+    // validity db is shared by all folders, keyed by hex-encoded folder name
+    const std::string validityDbName = GetLegacyDbName("common");
+    std::string validityDbPath = GetLegacyCacheDbDir("validity") + validityDbName;
+    if (m_CacheEncrypt && Util::Exists(validityDbPath))
+    {
+      const std::string tmpDbPath = GetTempDbDir() + validityDbName;
+      if (!Crypto::AESDecryptFile(validityDbPath, tmpDbPath, m_Pass))
+      {
+        Util::DeleteFile(tmpDbPath);
+      }
+
+      validityDbPath = tmpDbPath;
+    }
+
+    if (Util::Exists(validityDbPath))
+    {
+      try
+      {
+        std::map<std::string, int> validitys;
+        sqlite::database legacyDb(validityDbPath);
+        legacyDb << "SELECT folder, uid FROM validity;" >> [&](const std::string& folder, const int& uid)
+        {
+          validitys[Util::FromHex(folder)] = uid;
+        };
+
+        std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+        DbTransaction transaction(db);
+        for (const auto& validity : validitys)
+        {
+          if (folders.count(validity.first) == 0) continue;
+
+          *db << "INSERT OR REPLACE INTO validity (folder_id, uid) VALUES (?, ?);"
+              << GetFolderId(validity.first, true /* p_Create */) << validity.second;
+        }
+        transaction.Commit();
+      }
+      catch (const sqlite::sqlite_exception& ex)
+      {
+        LOG_WARNING("failed to migrate legacy validity db (%d)", ex.get_code());
+      }
+
+      if (m_CacheEncrypt)
+      {
+        Util::DeleteFile(validityDbPath);
+      }
+    }
+  }
+  else
+  {
+    LOG_INFO("skip migration of outdated legacy cache");
+  }
+
+  for (const auto& typeName : GetLegacyTypeNames())
+  {
+    Util::RmDir(GetLegacyCacheDir(typeName));
+  }
+}
+
+// must be called with exclusive cachelock
+bool ImapCache::MigrateLegacyDb(const std::string& p_TypeName, const std::string& p_DbName,
+                                const std::function<void()>& p_MigrateFunc)
+{
+  std::string dbPath = GetLegacyCacheDbDir(p_TypeName) + p_DbName;
+  if (!Util::Exists(dbPath)) return true;
+
+  if (m_CacheEncrypt)
+  {
+    const std::string tmpDbPath = GetTempDbDir() + p_TypeName + "_" + p_DbName;
+    if (!Crypto::AESDecryptFile(dbPath, tmpDbPath, m_Pass))
+    {
+      LOG_WARNING("failed to decrypt legacy %s db", p_TypeName.c_str());
+      Util::DeleteFile(tmpDbPath);
+      return false;
+    }
+
+    dbPath = tmpDbPath;
+  }
+
+  bool rv = true;
+  std::shared_ptr<sqlite::database> db = m_WriteDb->m_Database;
+  try
+  {
+    *db << "ATTACH DATABASE ? AS legacy;" << (m_CacheEncrypt ? CryptoVfs::GetPlainUri(dbPath) : dbPath);
+    try
+    {
+      DbTransaction transaction(db);
+      p_MigrateFunc();
+      transaction.Commit();
+    }
+    catch (const sqlite::sqlite_exception& ex)
+    {
+      LOG_WARNING("failed to migrate legacy %s db (%d)", p_TypeName.c_str(), ex.get_code());
+      rv = false;
+    }
+
+    *db << "DETACH DATABASE legacy;";
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to attach legacy %s db (%d)", p_TypeName.c_str(), ex.get_code());
+    rv = false;
+  }
+
+  if (m_CacheEncrypt)
+  {
+    Util::DeleteFile(dbPath);
+  }
+
+  return rv;
+}
+
+void ImapCache::StartWriter()
+{
+  if (Util::GetReadOnly()) return;
+
+  std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+  m_WriterRunning = true;
+  m_WriterThread = std::thread(&ImapCache::WriterProcess, this);
+}
+
+void ImapCache::StopWriter()
+{
+  {
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    m_WriterRunning = false;
+    m_WriteCondVar.notify_all();
+  }
+
+  if (m_WriterThread.joinable())
+  {
+    m_WriterThread.join();
+  }
+}
+
+// write-behind of headers, flags and bodys queued by set operations, writes queued within a short
+// window, or while a previous batch is committed, are coalesced into the next transaction
+void ImapCache::WriterProcess()
+{
+  LOG_DEBUG_FUNC(STR());
+
+  int failedAttempts = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> writeLock(m_WriteMutex);
+      if (failedAttempts > 0)
+      {
+        m_WriteCondVar.wait_for(writeLock, s_WriteRetryDelay, [&]() { return !m_WriterRunning; });
+      }
+
+      m_WriteCondVar.wait(writeLock, [&]() { return !m_PendingWrites.empty() || !m_WriterRunning; });
+      if (m_PendingWrites.empty()) break; // stopped with nothing left to write
+
+      m_WriteCondVar.wait_for(writeLock, s_WriteGroupWindow, [&]()
+      {
+        return !m_WriterRunning || (m_FlushWaiters > 0) || (m_PendingWriteCount >= s_MaxPendingWrites);
+      });
+
+      m_WritingWrites.swap(m_PendingWrites);
+      m_PendingWriteCount = 0;
+      m_WriteCondVar.notify_all();
+    }
+
+    const bool written = WriteQueued();
+
+    // release overlay only once committed, as readers copy it before reading db
+    std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+    if (written)
+    {
+      failedAttempts = 0;
+    }
+    else if (++failedAttempts < s_MaxWriteAttempts)
+    {
+      // requeue for retry, pending writes queued meanwhile are newer and take precedence
+      for (const auto& folderWrites : m_WritingWrites)
+      {
+        PendingWrites& pendingWrites = m_PendingWrites[folderWrites.first];
+        pendingWrites.m_Headers.insert(folderWrites.second.m_Headers.begin(), folderWrites.second.m_Headers.end());
+        pendingWrites.m_Flags.insert(folderWrites.second.m_Flags.begin(), folderWrites.second.m_Flags.end());
+        pendingWrites.m_Bodys.insert(folderWrites.second.m_Bodys.begin(), folderWrites.second.m_Bodys.end());
+        m_PendingWriteCount += folderWrites.second.m_Headers.size() + folderWrites.second.m_Flags.size() +
+          folderWrites.second.m_Bodys.size();
+      }
+    }
+    else
+    {
+      LOG_ERROR("dropping queued cache writes after %d failed attempts", failedAttempts);
+      failedAttempts = 0;
+    }
+
+    m_WritingWrites.clear();
+    ++m_WriteGeneration;
+    m_WriteCondVar.notify_all();
+  }
+}
+
+// must be called with writelock, blocks while write queue is full
+void ImapCache::WaitWriteQueue(std::unique_lock<std::mutex>& p_WriteLock)
+{
+  m_WriteCondVar.wait(p_WriteLock, [&]()
+  {
+    return (m_PendingWriteCount < s_MaxPendingWrites) || !m_WriterRunning;
+  });
+}
+
+// must not be called with a write connection, blocks until all queued writes are committed
+void ImapCache::FlushWrites()
+{
+  std::unique_lock<std::mutex> writeLock(m_WriteMutex);
+  ++m_FlushWaiters;
+  m_WriteCondVar.notify_all();
+  m_WriteCondVar.wait(writeLock, [&]() { return m_PendingWrites.empty() && m_WritingWrites.empty(); });
+  --m_FlushWaiters;
+}
+
+// must be called after committing direct writes to flags, bypassing the write queue, so that SetFlags
+// does not compare against flags it read before the write
+void ImapCache::FlagsWritten()
+{
+  std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+  ++m_WriteGeneration;
+}
+
+// write dequeued headers, flags and bodys of all folders in a single transaction, returns false on failure
+bool ImapCache::WriteQueued()
+{
+  LOG_DURATION();
+
+  // serialize metadata, hash and compress raw data before leasing write connection, m_WritingWrites is
+  // only modified by the writer thread so it can be read here without writelock
+  std::map<std::string, std::map<uint32_t, PackedBody>> packedFolderBodys;
+  for (const auto& folderWrites : m_WritingWrites)
+  {
+    for (const auto& body : folderWrites.second.m_Bodys)
+    {
+      PackBody(body.second, packedFolderBodys[folderWrites.first][body.first]);
+    }
+  }
+
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  SetUsed();
+
+  try
+  {
+    std::map<std::string, int64_t> folderIds;
+    for (const auto& folderWrites : m_WritingWrites)
+    {
+      folderIds[folderWrites.first] = GetFolderId(folderWrites.first, true /* p_Create */);
+    }
+
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+    sqlite::database_binder& insertHeader =
+      dbCon->Prepare("INSERT OR REPLACE INTO headers (folder_id, uid, data) VALUES (?, ?, ?);");
+    sqlite::database_binder& insertFields =
+      dbCon->Prepare("INSERT OR REPLACE INTO headerfields (folder_id, uid, timestamp, from_name, to_name, "
+                     "subject, has_attachments, message_id, header_hash) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    sqlite::database_binder& insertFlag =
+      dbCon->Prepare("INSERT OR REPLACE INTO flags (folder_id, uid, flag) VALUES (?, ?, ?);");
+    sqlite::database_binder& insertData =
+      dbCon->Prepare("INSERT OR IGNORE INTO bodydata (hash, data, codec, size) VALUES (?, ?, ?, ?);");
+    sqlite::database_binder& insertBody =
+      dbCon->Prepare("INSERT OR REPLACE INTO bodys (folder_id, uid, codec, size, meta, hash, accessed) "
+                     "VALUES (?, ?, ?, ?, ?, ?, ?);");
+    const int64_t now = time(NULL);
+    std::vector<char> headerBytes;
+    DbTransaction transaction(db);
+    for (const auto& folderWrites : m_WritingWrites)
+    {
+      const int64_t folderId = folderIds.at(folderWrites.first);
+      for (const auto& header : folderWrites.second.m_Headers)
+      {
+        const uint32_t uid = header.first;
+        header.second.ToRecord(headerBytes);
+        insertHeader.reset();
+        insertHeader << folderId << uid << headerBytes;
+        insertHeader.execute();
+        InsertHeaderFields(insertFields, folderId, uid, header.second);
+      }
+
+      for (const auto& flag : folderWrites.second.m_Flags)
+      {
+        insertFlag.reset();
+        insertFlag << folderId << flag.first << flag.second;
+        insertFlag.execute();
+      }
+
+      for (const auto& packedBody : packedFolderBodys[folderWrites.first])
+      {
+        InsertBodyData(insertData, packedBody.second);
+        insertBody.reset();
+        insertBody << folderId << packedBody.first << packedBody.second.m_Codec << packedBody.second.m_Size
+                   << packedBody.second.m_Meta << packedBody.second.m_Hash << now;
+        insertBody.execute();
+      }
+    }
+    transaction.Commit();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to write queued cache writes (%d)", ex.get_code());
+    return false;
+  }
+
+  return true;
+}
+
+void ImapCache::StartBackground()
+{
+  if (Util::GetReadOnly()) return;
+
+  std::lock_guard<std::mutex> backgroundLock(m_BackgroundMutex);
+  m_BackgroundRunning = true;
+  m_BackgroundThread = std::thread(&ImapCache::BackgroundProcess, this);
+}
+
+void ImapCache::StopBackground()
+{
+  {
+    std::lock_guard<std::mutex> backgroundLock(m_BackgroundMutex);
+    m_BackgroundRunning = false;
+    m_BackgroundCondVar.notify_one();
+  }
+
+  if (m_BackgroundThread.joinable())
+  {
+    m_BackgroundThread.join();
+  }
+}
+
+// background cache processing: one-time conversion of data stored by earlier versions, re-parse
+// after parse version updates, and enforcement of cache size limits, the latter two while idle.
+// all performed in batches
+void ImapCache::BackgroundProcess()
+{
+  LOG_DEBUG_FUNC(STR());
+
+  bool running = true;
+  int64_t headerCount = 0;
+  while (running && ConvertHeaderFields(headerCount))
+  {
+    running = BackgroundWait(s_BatchInterval);
+  }
+
+  if (headerCount > 0)
+  {
+    LOG_INFO("indexed %lld headers", (long long)headerCount);
+  }
+
+  int64_t bodyCount = 0;
+  int64_t savedSize = 0;
+  while (running && ConvertBodys(bodyCount, savedSize))
+  {
+    running = BackgroundWait(s_BatchInterval);
+  }
+
+  if (bodyCount > 0)
+  {
+    LOG_INFO("converted %lld bodys, saved %lld bytes", (long long)bodyCount, (long long)savedSize);
+  }
+
+  if (running)
+  {
+    running = ReparseStale();
+  }
+
+  std::chrono::steady_clock::time_point lastMaintain;
+  while (running)
+  {
+    running = BackgroundWait(s_EvictInterval);
+    if (!running || !IsIdle()) continue;
+
+    if (IsCacheSizeLimited())
+    {
+      FlushAccessTimes();
+
+      int64_t evictCount = 0;
+      while (running && IsIdle() && EvictBodys(evictCount))
+      {
+        running = BackgroundWait(s_BatchInterval);
+      }
+
+      if (evictCount > 0)
+      {
+        LOG_INFO("evicted %lld bodys", (long long)evictCount);
+      }
+    }
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ((lastMaintain != std::chrono::steady_clock::time_point()) && ((now - lastMaintain) < s_MaintainInterval))
+    {
+      continue;
+    }
+
+    lastMaintain = now;
+    std::map<std::string, int64_t> orphanCounts;
+    while (running && IsIdle() && CleanupOrphans(orphanCounts))
+    {
+      running = BackgroundWait(s_BatchInterval);
+    }
+
+    for (const auto& orphanCount : orphanCounts)
+    {
+      LOG_INFO("deleted %lld orphaned %s rows", (long long)orphanCount.second, orphanCount.first.c_str());
+    }
+
+    while (running && IsIdle() && IncrementalVacuum())
+    {
+      running = BackgroundWait(s_BatchInterval);
+    }
+  }
+}
+
+// populate headerfields for headers stored by earlier versions, returns true if more remain
+bool ImapCache::ConvertHeaderFields(int64_t& p_Count)
+{
+  std::map<std::pair<int64_t, uint32_t>, std::vector<char>> datas;
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    dbCon->Prepare("SELECT h.folder_id, h.uid, h.data FROM headers h WHERE NOT EXISTS "
+                   "(SELECT 1 FROM headerfields f WHERE f.folder_id = h.folder_id AND f.uid = h.uid) LIMIT ?;")
+      << s_ConvertBatchSize
+      >> [&](const int64_t& folderId, const uint32_t& uid, const std::vector<char>& data)
+    {
+      datas[std::make_pair(folderId, uid)] = data;
+    };
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to read headers for indexing (%d)", ex.get_code());
+    return false;
+  }
+
+  if (datas.empty()) return false;
+
+  std::map<std::pair<int64_t, uint32_t>, Header> headers;
+  for (const auto& data : datas)
+  {
+    Header header;
+    DecodeHeader(data.second.data(), data.second.size(), header);
+    header.ParseIfNeeded();
+    headers[data.first] = header;
+  }
+
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    sqlite::database_binder& insertFields =
+      dbCon->Prepare("INSERT OR IGNORE INTO headerfields (folder_id, uid, timestamp, from_name, to_name, "
+                     "subject, has_attachments, message_id, header_hash) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    sqlite::database_binder& removeStale =
+      dbCon->Prepare("DELETE FROM headerfields WHERE folder_id = ? AND uid = ? AND NOT EXISTS "
+                     "(SELECT 1 FROM headers WHERE folder_id = ? AND uid = ?);");
+    DbTransaction transaction(db);
+    for (const auto& header : headers)
+    {
+      InsertHeaderFields(insertFields, header.first.first, header.first.second, header.second);
+
+      // header may have been deleted since it was read
+      removeStale.reset();
+      removeStale << header.first.first << header.first.second << header.first.first << header.first.second;
+      removeStale.execute();
+    }
+    transaction.Commit();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to store header fields (%d)", ex.get_code());
+    return false;
+  }
+
+  p_Count += headers.size();
+  return true;
+}
+
+// convert bodys stored inline by earlier versions into content-addressed compressed raw data and
+// separate metadata, returns true if more remain
+bool ImapCache::ConvertBodys(int64_t& p_Count, int64_t& p_SavedSize)
+{
+  struct StoredBody
+  {
+    int m_Codec = s_CodecNone;
+    std::vector<char> m_Data;
+    std::vector<char> m_Meta;
+  };
+
+  std::map<std::pair<int64_t, uint32_t>, StoredBody> storedBodys;
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    dbCon->Prepare("SELECT folder_id, uid, codec, data, meta FROM bodys WHERE hash IS NULL LIMIT ?;")
+      << s_ConvertBatchSize
+      >> [&](const int64_t& folderId, const uint32_t& uid, const int& codec, const std::vector<char>& data,
+             const std::vector<char>& meta)
+    {
+      StoredBody& storedBody = storedBodys[std::make_pair(folderId, uid)];
+      storedBody.m_Codec = codec;
+      storedBody.m_Data = data;
+      storedBody.m_Meta = meta;
+    };
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to read bodys for conversion (%d)", ex.get_code());
+    return false;
+  }
+
+  if (storedBodys.empty()) return false;
+
+  std::map<std::pair<int64_t, uint32_t>, PackedBody> packedBodys;
+  std::set<std::pair<int64_t, uint32_t>> invalidBodys;
+  for (auto& storedBody : storedBodys)
+  {
+    std::string data;
+    if (!UnpackBodyData(storedBody.second.m_Codec, storedBody.second.m_Data.data(), storedBody.second.m_Data.size(),
+                        data))
+    {
+      invalidBodys.insert(storedBody.first);
+      continue;
+    }
+
+    Body body;
+    DecodeBody(std::move(data), storedBody.second.m_Meta.data(), storedBody.second.m_Meta.size(), body);
+    body.ParseIfNeeded();
+
+    PackedBody& packedBody = packedBodys[storedBody.first];
+    PackBody(body, packedBody);
+    p_SavedSize += (int64_t)(storedBody.second.m_Data.size() + storedBody.second.m_Meta.size()) -
+      (int64_t)(packedBody.m_Data.size() + packedBody.m_Meta.size());
+  }
+
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    // body may have been deleted or replaced since it was read
+    sqlite::database_binder& insertData =
+      dbCon->Prepare("INSERT OR IGNORE INTO bodydata (hash, data, codec, size) SELECT ?, ?, ?, ? "
+                     "WHERE EXISTS (SELECT 1 FROM bodys WHERE folder_id = ? AND uid = ? AND hash IS NULL);");
+    sqlite::database_binder& update =
+      dbCon->Prepare("UPDATE bodys SET data = NULL, codec = ?, size = ?, meta = ?, hash = ? "
+                     "WHERE folder_id = ? AND uid = ? AND hash IS NULL;");
+    sqlite::database_binder& remove =
+      dbCon->Prepare("DELETE FROM bodys WHERE folder_id = ? AND uid = ? AND hash IS NULL;");
+    DbTransaction transaction(db);
+    for (const auto& packedBody : packedBodys)
+    {
+      insertData.reset();
+      insertData << packedBody.second.m_Hash << packedBody.second.m_Data << packedBody.second.m_Codec
+                 << packedBody.second.m_Size << packedBody.first.first << packedBody.first.second;
+      insertData.execute();
+      update.reset();
+      update << packedBody.second.m_Codec << packedBody.second.m_Size << packedBody.second.m_Meta
+             << packedBody.second.m_Hash << packedBody.first.first << packedBody.first.second;
+      update.execute();
+    }
+
+    // undecodable bodys are removed, to be fetched from server again when needed
+    for (const auto& invalidBody : invalidBodys)
+    {
+      LOG_WARNING("remove invalid cached body folder_id %lld uid = %d",
+                  (long long)invalidBody.first, invalidBody.second);
+      remove.reset();
+      remove << invalidBody.first << invalidBody.second;
+      remove.execute();
+    }
+    transaction.Commit();
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to store converted bodys (%d)", ex.get_code());
+    return false;
+  }
+
+  p_Count += packedBodys.size();
+  return true;
+}
+
+// re-parse headers and bodys cached by an earlier parse version, in batches while idle. reads use
+// stale data until reached. progress is stored in counters to resume after restart, returns false if stopped.
+bool ImapCache::ReparseStale()
+{
+  const bool headersCurrent =
+    (GetCounter("header_parse_version", -1) == (int64_t)Header::GetCurrentParseVersion());
+  const bool bodysCurrent =
+    (GetCounter("body_parse_version", -1) == (int64_t)Body::GetCurrentParseVersion());
+  if (headersCurrent && bodysCurrent) return true;
+
+  int64_t headerCursor = headersCurrent ? INT64_MAX : GetCounter("header_reparse_cursor", 0);
+  int64_t bodyCursor = bodysCurrent ? INT64_MAX : GetCounter("body_reparse_cursor", 0);
+  int64_t total = 0;
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    *dbCon->m_Database << "SELECT (SELECT COUNT(*) FROM headers WHERE rowid > ?) + "
+      "(SELECT COUNT(*) FROM bodys WHERE rowid > ?);" << headerCursor << bodyCursor >> total;
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to count rows for re-parse (%d)", ex.get_code());
+    return true;
+  }
+
+  LOG_DEBUG("re-parse headers %s bodys %s rows %lld", headersCurrent ? "current" : "stale",
+            bodysCurrent ? "current" : "stale", (long long)total);
+
+  bool running = true;
+  bool headersDone = headersCurrent;
+  bool bodysDone = bodysCurrent;
+  int64_t count = 0;
+  while (running && !(headersDone && bodysDone))
+  {
+    if (!IsIdle())
+    {
+      ClearStatus(Status::FlagReparsing);
+      running = BackgroundWait(s_IdleDelay);
+      continue;
+    }
+
+    const bool ok = !headersDone ? ReparseHeaders(headerCursor, count, headersDone)
+                                 : ReparseBodys(bodyCursor, count, bodysDone);
+    if (!ok) break; // retried on next start
+
+    if (total > 0)
+    {
+      SetStatus(Status::FlagReparsing, (std::min(count, total) * 100.0) / (float)total);
+    }
+
+    running = BackgroundWait(s_BatchInterval);
+  }
+
+  ClearStatus(Status::FlagReparsing);
+  if (count > 0)
+  {
+    LOG_INFO("re-parse checked %lld cached headers and bodys", (long long)count);
+  }
+
+  return running;
+}
+
+// re-parse batch of headers after cursor, sets p_Done and stores parse version when none remain
+bool ImapCache::ReparseHeaders(int64_t& p_Cursor, int64_t& p_Count, bool& p_Done)
+{
+  struct StoredHeader
+  {
+    int64_t m_FolderId = 0;
+    uint32_t m_Uid = 0;
+    std::vector<char> m_Data;
+    Header m_Header;
+  };
+
+  std::vector<StoredHeader> storedHeaders;
+  try
+  {
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    dbCon->Prepare("SELECT rowid, folder_id, uid, data FROM headers WHERE rowid > ? ORDER BY rowid LIMIT ?;")
+      << p_Cursor << s_ReparseBatchSize
+      >> [&](const int64_t& rowId, const int64_t& folderId, const uint32_t& uid, const std::vector<char>& data)
+    {
+      p_Cursor = rowId;
+      StoredHeader storedHeader;
+      storedHeader.m_FolderId = folderId;
+      storedHeader.m_Uid = uid;
+      storedHeader.m_Data = data;
+      storedHeaders.push_back(std::move(storedHeader));
+    };
+  }
+  catch (const sqlite::sqlite_exception& ex)
+  {
+    LOG_WARNING("failed to read headers for re-parse (%d)", ex.get_code());
+    return false;
   }
 
-  return rv;
-}
+  p_Count += storedHeaders.size();
+  p_Done = storedHeaders.empty();
 
-// set specified uids seen flag
-void ImapCache::SetFlagSeen(const std::string& p_Folder, const std::set<uint32_t>& p_Uids, const bool p_Value)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
+  // headers stored in earlier format are re-encoded even if parse version is current
+  std::vector<StoredHeader> staleHeaders;
+  for (auto& storedHeader : storedHeaders)
+  {
+    const bool isCurrentFormat =
+      DecodeHeader(storedHeader.m_Data.data(), storedHeader.m_Data.size(), storedHeader.m_Header);
+    if (isCurrentFormat && storedHeader.m_Header.IsParseCurrent()) continue;
 
-  if (Util::GetReadOnly()) return;
+    staleHeaders.push_back(std::move(storedHeader));
+  }
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  if (staleHeaders.empty() && !p_Done) return true;
 
-  std::stringstream sstream;
-  std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-  std::string uidlist = sstream.str();
-  uidlist.pop_back(); // assumes non-empty input set
+  Util::ParallelFor(staleHeaders.size(), [&](size_t p_Index)
+  {
+    staleHeaders[p_Index].m_Header.ParseIfNeeded();
+  });
 
   try
   {
-    *db << "UPDATE flags SET flag = ? WHERE uid IN (" + uidlist + ");" << (uint32_t)p_Value;
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    sqlite::database_binder& update =
+      dbCon->Prepare("UPDATE headers SET data = ? WHERE folder_id = ? AND uid = ? AND data = ?;");
+    sqlite::database_binder& insertFields =
+      dbCon->Prepare("INSERT OR REPLACE INTO headerfields (folder_id, uid, timestamp, from_name, to_name, "
+                     "subject, has_attachments, message_id, header_hash) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    std::vector<char> headerBytes;
+    DbTransaction transaction(db);
+    for (const auto& staleHeader : staleHeaders)
+    {
+      // header may have been replaced or deleted since it was read
+      staleHeader.m_Header.ToRecord(headerBytes);
+      update.reset();
+      update << headerBytes << staleHeader.m_FolderId << staleHeader.m_Uid << staleHeader.m_Data;
+      update.execute();
+      if (sqlite3_changes(db->connection().get()) > 0)
+      {
+        InsertHeaderFields(insertFields, staleHeader.m_FolderId, staleHeader.m_Uid, staleHeader.m_Header);
+      }
+    }
+
+    if (p_Done)
+    {
+      *db << "INSERT OR REPLACE INTO counters (name, value) VALUES ('header_parse_version', ?);"
+          << (int64_t)Header::GetCurrentParseVersion();
+      *db << "DELETE FROM counters WHERE name = 'header_reparse_cursor';";
+    }
+    else
+    {
+      *db << "INSERT OR REPLACE INTO counters (name, value) VALUES ('header_reparse_cursor', ?);" << p_Cursor;
+    }
+    transaction.Commit();
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to store re-parsed headers (%d)", ex.get_code());
+    return false;
   }
+
+  return true;
 }
 
-// clear specified folder
-void ImapCache::ClearFolder(const std::string& p_Folder)
+// re-parse batch of bodys after cursor, sets p_Done and stores parse version when none remain. only
+// metadata is updated, as raw data is not changed by parsing.
+bool ImapCache::ReparseBodys(int64_t& p_Cursor, int64_t& p_Count, bool& p_Done)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder));
-
-  if (Util::GetReadOnly()) return;
-
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+  struct StoredBody
+  {
+    int64_t m_FolderId = 0;
+    uint32_t m_Uid = 0;
+    std::vector<char> m_Meta;
+    std::vector<char> m_NewMeta;
+    Body m_Body;
+  };
 
+  std::vector<StoredBody> staleBodys;
+  p_Done = true;
   try
   {
-    std::shared_ptr<DbConnection> dbCon = GetDb(HeadersDb, p_Folder, true /* p_Writable */);
-    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-    *db << "DELETE FROM headers;";
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    dbCon->Prepare("SELECT rowid, folder_id, uid, meta FROM bodys WHERE rowid > ? ORDER BY rowid LIMIT ?;")
+      << p_Cursor << s_ReparseBatchSize
+      >> [&](const int64_t& rowId, const int64_t& folderId, const uint32_t& uid, const std::vector<char>& meta)
+    {
+      p_Cursor = rowId;
+      p_Done = false;
+      ++p_Count;
+
+      // bodys without metadata are stored inline by earlier versions, and converted by ConvertBodys()
+      if (meta.empty() || Serialization::FromBytes<Body>(meta.data(), meta.size()).IsParseCurrent()) return;
+
+      StoredBody storedBody;
+      storedBody.m_FolderId = folderId;
+      storedBody.m_Uid = uid;
+      storedBody.m_Meta = meta;
+      staleBodys.push_back(std::move(storedBody));
+    };
+
+    sqlite::database_binder& selectData =
+      dbCon->Prepare("SELECT d.data, d.codec FROM bodys b JOIN bodydata d ON d.hash = b.hash "
+                     "WHERE b.folder_id = ? AND b.uid = ?;");
+    for (auto& staleBody : staleBodys)
+    {
+      selectData.reset();
+      selectData << staleBody.m_FolderId << staleBody.m_Uid
+                 >> [&](const std::vector<char>& packedData, const int& codec)
+      {
+        std::string data;
+        if (UnpackBodyData(codec, packedData.data(), packedData.size(), data))
+        {
+          DecodeBody(std::move(data), staleBody.m_Meta.data(), staleBody.m_Meta.size(), staleBody.m_Body);
+        }
+      };
+    }
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to read bodys for re-parse (%d)", ex.get_code());
+    return false;
   }
 
+  if (staleBodys.empty() && !p_Done) return true;
+
+  Util::ParallelFor(staleBodys.size(), [&](size_t p_Index)
+  {
+    StoredBody& staleBody = staleBodys[p_Index];
+    if (staleBody.m_Body.GetData().empty()) return; // raw data missing or invalid
+
+    staleBody.m_Body.ParseIfNeeded();
+    Serialization::ToBytes(staleBody.m_Body, staleBody.m_NewMeta);
+  });
+
   try
   {
-    std::shared_ptr<DbConnection> dbCon = GetDb(BodysDb, p_Folder, true /* p_Writable */);
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
     std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-    *db << "DELETE FROM bodys;";
+    sqlite::database_binder& update =
+      dbCon->Prepare("UPDATE bodys SET meta = ? WHERE folder_id = ? AND uid = ? AND meta = ?;");
+    DbTransaction transaction(db);
+    for (const auto& staleBody : staleBodys)
+    {
+      if (staleBody.m_NewMeta.empty()) continue;
+
+      // body may have been replaced or deleted since it was read
+      update.reset();
+      update << staleBody.m_NewMeta << staleBody.m_FolderId << staleBody.m_Uid << staleBody.m_Meta;
+      update.execute();
+    }
+
+    if (p_Done)
+    {
+      *db << "INSERT OR REPLACE INTO counters (name, value) VALUES ('body_parse_version', ?);"
+          << (int64_t)Body::GetCurrentParseVersion();
+      *db << "DELETE FROM counters WHERE name = 'body_reparse_cursor';";
+    }
+    else
+    {
+      *db << "INSERT OR REPLACE INTO counters (name, value) VALUES ('body_reparse_cursor', ?);" << p_Cursor;
+    }
+    transaction.Commit();
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to store re-parsed bodys (%d)", ex.get_code());
+    return false;
   }
 
+  return true;
+}
+
+int64_t ImapCache::GetCounter(const std::string& p_Name, int64_t p_Default)
+{
+  int64_t value = p_Default;
   try
   {
-    std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
-    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
-    *db << "DELETE FROM uids;";
-    *db << "DELETE FROM flags;";
+    std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+    std::shared_ptr<DbConnection> dbCon = GetDb(false /* p_Writable */);
+    *dbCon->m_Database << "SELECT value FROM counters WHERE name = ?;" << p_Name
+                       >> [&](const int64_t& p_Value) { value = p_Value; };
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to read counter %s (%d)", p_Name.c_str(), ex.get_code());
   }
+
+  return value;
 }
 
-// delete specified messages
-void ImapCache::DeleteMessages(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+void ImapCache::SetStatus(uint32_t p_Flags, float p_Progress /* = -1 */)
 {
-  DeleteUids(p_Folder, p_Uids);
-  DeleteFlags(p_Folder, p_Uids);
-  DeleteHeaders(p_Folder, p_Uids);
-  DeleteBodys(p_Folder, p_Uids);
+  StatusUpdate statusUpdate;
+  statusUpdate.SetFlags = p_Flags;
+  statusUpdate.Progress = p_Progress;
+  if (m_StatusHandler)
+  {
+    m_StatusHandler(statusUpdate);
+  }
 }
 
-// delete specified uids
-void ImapCache::DeleteUids(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+void ImapCache::ClearStatus(uint32_t p_Flags)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+  StatusUpdate statusUpdate;
+  statusUpdate.ClearFlags = p_Flags;
+  if (m_StatusHandler)
+  {
+    m_StatusHandler(statusUpdate);
+  }
+}
 
-  if (Util::GetReadOnly()) return;
+// wait specified duration, yielding to foreground cache access, returns false if stopping
+bool ImapCache::BackgroundWait(const std::chrono::milliseconds& p_Duration)
+{
+  std::unique_lock<std::mutex> backgroundLock(m_BackgroundMutex);
+  m_BackgroundCondVar.wait_for(backgroundLock, p_Duration, [&]() { return !m_BackgroundRunning; });
+  return m_BackgroundRunning;
+}
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+bool ImapCache::IsCacheSizeLimited()
+{
+  return (Util::GetCacheMaxSize() > 0) || (Util::GetCacheMaxFolderSize() > 0);
+}
 
-  try
-  {
-    std::set<uint32_t> uids;
-    auto lambda = [&](const std::vector<uint32_t>& data)
-    {
-      uids = ToSet(data);
-    };
+void ImapCache::SetUsed()
+{
+  std::lock_guard<std::mutex> usageLock(m_UsageMutex);
+  m_LastUsed = std::chrono::steady_clock::now();
+}
 
-    *db << "SELECT uids.uids FROM uids LIMIT 1" >> lambda;
+bool ImapCache::IsIdle()
+{
+  std::lock_guard<std::mutex> usageLock(m_UsageMutex);
+  return (std::chrono::steady_clock::now() - m_LastUsed) >= s_IdleDelay;
+}
 
-    for (auto& uid : p_Uids)
-    {
-      uids.erase(uid);
-    }
+void ImapCache::SetAccessed(int64_t p_FolderId, const std::set<uint32_t>& p_Uids)
+{
+  if (!IsCacheSizeLimited()) return;
 
-    *db << "begin;";
-    *db << "DELETE FROM uids;";
-    *db << "INSERT INTO uids (uids) VALUES (?);" << ToVector(uids);
-    *db << "commit;";
-  }
-  catch (const sqlite::sqlite_exception& ex)
+  std::lock_guard<std::mutex> usageLock(m_UsageMutex);
+  const int64_t now = time(NULL);
+  for (const auto& uid : p_Uids)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    m_AccessTimes[std::make_pair(p_FolderId, uid)] = now;
   }
 }
 
-// delete specified flags
-void ImapCache::DeleteFlags(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+// store body access times tracked in memory, to keep reads free from db writes
+void ImapCache::FlushAccessTimes()
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
-
-  if (Util::GetReadOnly()) return;
+  std::map<std::pair<int64_t, uint32_t>, int64_t> accessTimes;
+  {
+    std::lock_guard<std::mutex> usageLock(m_UsageMutex);
+    accessTimes.swap(m_AccessTimes);
+  }
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(UidFlagsDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  if (accessTimes.empty()) return;
 
-  std::stringstream sstream;
-  std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-  std::string uidlist = sstream.str();
-  uidlist.pop_back(); // assumes non-empty input set
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
 
   try
   {
-    *db << "DELETE FROM flags WHERE uid IN (" + uidlist + ");";
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    sqlite::database_binder& update =
+      dbCon->Prepare("UPDATE bodys SET accessed = ? WHERE folder_id = ? AND uid = ?;");
+    DbTransaction transaction(db);
+    for (const auto& accessTime : accessTimes)
+    {
+      update.reset();
+      update << accessTime.second << accessTime.first.first << accessTime.first.second;
+      update.execute();
+    }
+    transaction.Commit();
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to store body access times (%d)", ex.get_code());
   }
 }
 
-// delete specified headers
-void ImapCache::DeleteHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+// evict least recently accessed bodys exceeding global or per-folder cache size limit,
+// returns true if more may need eviction
+bool ImapCache::EvictBodys(int64_t& p_Count)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+  // stored size of a body, shared body data is counted for each folder referencing it
+  static const std::string bodySizeSql =
+    "(IFNULL(LENGTH(b.data), 0) + IFNULL(LENGTH(b.meta), 0) + "
+    "IFNULL((SELECT LENGTH(d.data) FROM bodydata d WHERE d.hash = b.hash), 0))";
 
-  if (Util::GetReadOnly()) return;
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  try
+  {
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(HeadersDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    int64_t folderId = -1;
+    int64_t excessSize = 0;
+    const int64_t maxSize = Util::GetCacheMaxSize();
+    if (maxSize > 0)
+    {
+      int64_t totalSize = 0;
+      *db << "SELECT (SELECT TOTAL(IFNULL(LENGTH(data), 0) + IFNULL(LENGTH(meta), 0)) FROM bodys) + "
+        "(SELECT TOTAL(LENGTH(data)) FROM bodydata);" >> totalSize;
+      excessSize = totalSize - maxSize;
+    }
 
-  std::stringstream sstream;
-  std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-  std::string uidlist = sstream.str();
-  uidlist.pop_back(); // assumes non-empty input set
+    const int64_t maxFolderSize = Util::GetCacheMaxFolderSize();
+    if ((excessSize <= 0) && (maxFolderSize > 0))
+    {
+      dbCon->Prepare("SELECT b.folder_id, TOTAL(" + bodySizeSql + ") AS folder_size FROM bodys b "
+                     "GROUP BY b.folder_id HAVING folder_size > ? ORDER BY folder_size DESC LIMIT 1;")
+        << maxFolderSize >> [&](const int64_t& id, const int64_t& folderSize)
+      {
+        folderId = id;
+        excessSize = folderSize - maxFolderSize;
+      };
+    }
 
-  try
-  {
-    *db << "DELETE FROM headers WHERE uid IN (" + uidlist + ");";
-  }
-  catch (const sqlite::sqlite_exception& ex)
-  {
-    HANDLE_SQLITE_EXCEPTION(ex);
-  }
-}
+    if (excessSize <= 0) return false;
 
-// delete specified bodys
-void ImapCache::DeleteBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+    std::vector<std::pair<int64_t, uint32_t>> evictBodys;
+    int64_t evictSize = 0;
+    auto lambda = [&](const int64_t& id, const uint32_t& uid, const int64_t& size)
+    {
+      if (evictSize >= excessSize) return;
 
-  if (Util::GetReadOnly()) return;
+      evictBodys.push_back(std::make_pair(id, uid));
+      evictSize += size;
+    };
 
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  std::shared_ptr<DbConnection> dbCon = GetDb(BodysDb, p_Folder, true /* p_Writable */);
-  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+    if (folderId == -1)
+    {
+      dbCon->Prepare("SELECT b.folder_id, b.uid, " + bodySizeSql + " FROM bodys b "
+                     "ORDER BY b.accessed, b.uid LIMIT ?;") << s_EvictBatchSize >> lambda;
+    }
+    else
+    {
+      dbCon->Prepare("SELECT b.folder_id, b.uid, " + bodySizeSql + " FROM bodys b WHERE b.folder_id = ? "
+                     "ORDER BY b.accessed, b.uid LIMIT ?;") << folderId << s_EvictBatchSize >> lambda;
+    }
 
-  std::stringstream sstream;
-  std::copy(p_Uids.begin(), p_Uids.end(), std::ostream_iterator<uint32_t>(sstream, ","));
-  std::string uidlist = sstream.str();
-  uidlist.pop_back(); // assumes non-empty input set
+    if (evictBodys.empty()) return false;
 
-  try
-  {
-    *db << "DELETE FROM bodys WHERE uid IN (" + uidlist + ");";
+    sqlite::database_binder& remove = dbCon->Prepare("DELETE FROM bodys WHERE folder_id = ? AND uid = ?;");
+    DbTransaction transaction(db);
+    for (const auto& evictBody : evictBodys)
+    {
+      remove.reset();
+      remove << evictBody.first << evictBody.second;
+      remove.execute();
+    }
+    transaction.Commit();
+
+    p_Count += evictBodys.size();
   }
   catch (const sqlite::sqlite_exception& ex)
   {
-    HANDLE_SQLITE_EXCEPTION(ex);
+    LOG_WARNING("failed to evict bodys (%d)", ex.get_code());
+    return false;
   }
+
+  return true;
 }
 
-bool ImapCache::Export(const std::string& p_Path)
+// delete up to p_Limit rows per table whose message is no longer in uids, returns true if any were deleted
+// must be called with shared cachelock
+bool ImapCache::DeleteOrphans(int p_Limit, std::map<std::string, int64_t>& p_Counts)
 {
-  // @todo: determine what is correct/portable MailDir format
-  Util::MkDir(p_Path);
-  Util::MkDir(p_Path + "/new");
-  Util::MkDir(p_Path + "/tmp");
-  Util::MkDir(p_Path + "/cur");
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
 
-  const std::set<std::string> folders = GetFolders();
-  for (const auto& folder : folders)
+  bool deleted = false;
+  for (const auto& orphanCondition : s_OrphanConditions)
   {
-    std::string folderName = folder;
-    Util::ReplaceString(folderName, "/", "_");
-    std::string folderPath = p_Path + "/" + folderName;
-    Util::MkDir(folderPath);
-    Util::MkDir(folderPath + "/new");
-    Util::MkDir(folderPath + "/tmp");
-    Util::MkDir(folderPath + "/cur");
-
-    const std::set<uint32_t> uids = GetUids(folder);
-    if (uids.empty()) continue;
+    const std::string& table = orphanCondition.first;
+    std::vector<std::pair<int64_t, uint32_t>> orphans;
+    dbCon->Prepare("SELECT t.folder_id, t.uid FROM " + table + " t WHERE " + orphanCondition.second + " LIMIT ?;")
+      << p_Limit >> [&](const int64_t& folderId, const uint32_t& uid)
+    {
+      orphans.push_back(std::make_pair(folderId, uid));
+    };
 
-    const std::map<uint32_t, Body> bodys = GetBodys(folder, uids, false /*p_Prefetch*/);
+    if (orphans.empty()) continue;
 
-    for (const auto& body : bodys)
+    sqlite::database_binder& remove = dbCon->Prepare("DELETE FROM " + table + " WHERE folder_id = ? AND uid = ?;");
+    DbTransaction transaction(db);
+    for (const auto& orphan : orphans)
+    {
+      remove.reset();
+      remove << orphan.first << orphan.second;
+      remove.execute();
+    }
+    transaction.Commit();
+    if (table == "flags")
     {
-      const uint32_t uid = body.first;
-      const std::string& data = body.second.GetData();
-      const std::string path = folderPath + "/cur/" + std::to_string(uid) + ".eml";
-      Util::WriteFile(path, data);
+      FlagsWritten();
     }
+
+    p_Counts[table] += orphans.size();
+    deleted = true;
   }
-  return true;
+
+  return deleted;
 }
 
-void ImapCache::InitHeadersCache()
+// delete a batch of orphaned rows in background, returns true if more may remain
+bool ImapCache::CleanupOrphans(std::map<std::string, int64_t>& p_Counts)
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  static const int version = 2;
-  CacheUtil::CommonInitCacheDir(GetCacheDir(HeadersDb), version, m_CacheEncrypt);
-  Util::MkDir(GetCacheDbDir(HeadersDb));
-  if (m_CacheEncrypt)
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  try
+  {
+    return DeleteOrphans(s_OrphanBatchSize, p_Counts);
+  }
+  catch (const sqlite::sqlite_exception& ex)
   {
-    Util::RmDir(GetTempDbDir(HeadersDb));
-    Util::MkDir(GetTempDbDir(HeadersDb));
+    LOG_WARNING("failed to delete orphaned rows (%d)", ex.get_code());
+    return false;
   }
 }
 
-void ImapCache::CleanupHeadersCache()
+// delete all data of specified folders
+// must be called with shared cachelock
+void ImapCache::DeleteStaleFolders(const std::set<std::string>& p_Folders)
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  CloseDbs(HeadersDb);
-}
+  if (p_Folders.empty()) return;
 
-void ImapCache::InitBodysCache()
-{
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  static const int version = 2;
-  CacheUtil::CommonInitCacheDir(GetCacheDir(BodysDb), version, m_CacheEncrypt);
-  Util::MkDir(GetCacheDbDir(BodysDb));
-  if (m_CacheEncrypt)
+  std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  DbTransaction transaction(db);
+  for (const auto& folder : p_Folders)
   {
-    Util::RmDir(GetTempDbDir(BodysDb));
-    Util::MkDir(GetTempDbDir(BodysDb));
+    LOG_INFO("delete stale folder %s", folder.c_str());
+    int64_t folderId = -1;
+    *db << "SELECT id FROM folders WHERE name = ?;" << folder >> folderId;
+    *db << "DELETE FROM headers WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM headerfields WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM bodys WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM uids WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM flags WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM validity WHERE folder_id = ?;" << folderId;
+    *db << "DELETE FROM folders WHERE id = ?;" << folderId;
   }
-}
+  transaction.Commit();
+  FlagsWritten();
 
-void ImapCache::CleanupBodysCache()
-{
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  CloseDbs(BodysDb);
+  std::lock_guard<std::mutex> folderIdsLock(m_FolderIdsMutex);
+  for (const auto& folder : p_Folders)
+  {
+    m_FolderIds.erase(folder);
+  }
 }
 
-void ImapCache::InitUidFlagsCache()
+// release a batch of free db pages to the file system, returns true if more remain
+bool ImapCache::IncrementalVacuum()
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  static const int version = 2;
-  CacheUtil::CommonInitCacheDir(GetCacheDir(UidFlagsDb), version, m_CacheEncrypt);
-  Util::MkDir(GetCacheDbDir(UidFlagsDb));
-  if (m_CacheEncrypt)
+  std::shared_lock<std::shared_mutex> cacheLock(m_CacheMutex);
+  try
+  {
+    std::shared_ptr<DbConnection> dbCon = GetDb(true /* p_Writable */);
+    std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+
+    // auto_vacuum 2 is incremental, dbs created by earlier versions need a full vacuum to convert
+    int autoVacuum = 0;
+    int64_t freePages = 0;
+    *db << "SELECT auto_vacuum, freelist_count FROM pragma_auto_vacuum(), pragma_freelist_count();"
+        >> std::tie(autoVacuum, freePages);
+    if ((autoVacuum != 2) || (freePages < s_VacuumMinFreePages)) return false;
+
+    *db << "PRAGMA incremental_vacuum(" + std::to_string(s_VacuumBatchPages) + ");";
+    return (freePages - s_VacuumBatchPages) >= s_VacuumMinFreePages;
+  }
+  catch (const sqlite::sqlite_exception& ex)
   {
-    Util::RmDir(GetTempDbDir(UidFlagsDb));
-    Util::MkDir(GetTempDbDir(UidFlagsDb));
+    LOG_WARNING("failed to vacuum db (%d)", ex.get_code());
+    return false;
   }
 }
 
-void ImapCache::CleanupUidFlagsCache()
+std::string ImapCache::GetCacheDir()
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  CloseDbs(UidFlagsDb);
+  return CacheUtil::GetCacheDir() + std::string("imap/");
 }
 
-void ImapCache::InitValidityCache()
+std::string ImapCache::GetCacheDbDir()
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  static const int version = 1;
-  CacheUtil::CommonInitCacheDir(GetCacheDir(ValidityDb), version, m_CacheEncrypt);
-  Util::MkDir(GetCacheDbDir(ValidityDb));
-  if (m_CacheEncrypt)
-  {
-    Util::RmDir(GetTempDbDir(ValidityDb));
-    Util::MkDir(GetTempDbDir(ValidityDb));
-  }
+  return CacheUtil::GetCacheDir() + std::string("imap/db/");
 }
 
-void ImapCache::CleanupValidityCache()
+std::string ImapCache::GetTempDbDir()
 {
-  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-  CloseDbs(ValidityDb);
+  return Util::GetTempDir() + std::string("imap/");
 }
 
-std::string ImapCache::GetDbTypeName(ImapCache::DbType p_DbType)
+std::string ImapCache::GetFoldersPath()
 {
-  static const std::map<DbType, std::string> dbTypeNames =
-  {
-    { HeadersDb, "headers" },
-    { BodysDb, "messages" },
-    { UidFlagsDb, "uidflags" },
-    { ValidityDb, "validity" },
-  };
-  return dbTypeNames.at(p_DbType);
+  return GetCacheDir() + std::string("folders");
 }
 
-std::string ImapCache::GetCacheDir(ImapCache::DbType p_DbType)
+std::string ImapCache::GetLegacyCacheDir(const std::string& p_TypeName)
 {
-  return CacheUtil::GetCacheDir() + GetDbTypeName(p_DbType) + std::string("/");
+  return CacheUtil::GetCacheDir() + p_TypeName + std::string("/");
 }
 
-std::string ImapCache::GetCacheDbDir(ImapCache::DbType p_DbType)
+std::string ImapCache::GetLegacyCacheDbDir(const std::string& p_TypeName)
 {
-  return CacheUtil::GetCacheDir() + GetDbTypeName(p_DbType) + std::string("/db/");
+  return CacheUtil::GetCacheDir() + p_TypeName + std::string("/db/");
 }
 
-std::string ImapCache::GetTempDbDir(ImapCache::DbType p_DbType)
+std::vector<std::string> ImapCache::GetLegacyTypeNames()
 {
-  return Util::GetTempDir() + GetDbTypeName(p_DbType) + std::string("/");
+  return std::vector<std::string>({ "headers", "messages", "uidflags", "validity" });
 }
 
-std::string ImapCache::GetHeadersFoldersPath()
+std::string ImapCache::GetLegacyDbName(const std::string& p_Folder)
 {
-  return GetCacheDir(HeadersDb) + std::string("folders");
+  return (m_CacheEncrypt ? Crypto::SHA256(p_Folder) : Util::ToHex(p_Folder)) + ".sqlite";
 }
 
-std::string ImapCache::GetDbName(const std::string& p_Folder)
+std::string ImapCache::GetDbName()
 {
-  return (m_CacheEncrypt ? Crypto::SHA256(p_Folder) : Util::ToHex(p_Folder)) + ".sqlite";
+  return "cache.sqlite";
 }
 
-std::string ImapCache::GetDbPath(ImapCache::DbType p_DbType, const std::string& p_Folder)
+// copies db using sqlite backup api, optionally using different vfs for source and destination
+bool ImapCache::CopyDb(const std::string& p_SrcPath, const std::string& p_SrcVfsName,
+                       const std::string& p_DstPath, const std::string& p_DstVfsName)
 {
-  LOG_DEBUG_FUNC(STR(GetDbTypeName(p_DbType), p_Folder));
-
-  const std::string& dbName = GetDbName(p_Folder);
-  std::string dbPath;
-  if (m_CacheEncrypt)
+  bool rv = false;
+  try
   {
-    dbPath = GetTempDbDir(p_DbType) + dbName;
-    std::string cacheDbPath = GetCacheDbDir(p_DbType) + dbName;
-    if (!Util::Exists(dbPath))
+    sqlite::sqlite_config srcConfig;
+    srcConfig.zVfs = p_SrcVfsName.empty() ? nullptr : p_SrcVfsName.c_str();
+    sqlite::database srcDb(p_SrcPath, srcConfig);
+
+    Util::DeleteFile(p_DstPath);
+    sqlite::sqlite_config dstConfig;
+    dstConfig.zVfs = p_DstVfsName.empty() ? nullptr : p_DstVfsName.c_str();
+    sqlite::database dstDb(p_DstPath, dstConfig);
+
+    sqlite3_backup* backup = sqlite3_backup_init(dstDb.connection().get(), "main",
+                                                 srcDb.connection().get(), "main");
+    if (backup != nullptr)
     {
-      if (Util::Exists(cacheDbPath))
-      {
-        if (!Crypto::AESDecryptFile(cacheDbPath, dbPath, m_Pass))
-        {
-          Util::DeleteFile(dbPath);
-        }
-      }
+      rv = (sqlite3_backup_step(backup, -1) == SQLITE_DONE);
+      rv &= (sqlite3_backup_finish(backup) == SQLITE_OK);
     }
   }
-  else
+  catch (const sqlite::sqlite_exception& ex)
   {
-    dbPath = GetCacheDbDir(p_DbType) + dbName;
+    LOG_WARNING("failed to copy db %s (%d)", p_SrcPath.c_str(), ex.get_code());
+    rv = false;
   }
 
-  return dbPath;
+  return rv;
 }
 
-void ImapCache::WriteDb(ImapCache::DbType p_DbType, const std::string& p_Folder)
+// must be called with shared cachelock, and without holding a write connection
+std::shared_ptr<ImapCache::DbConnection> ImapCache::GetDb(bool p_Writable)
 {
-  LOG_DEBUG_FUNC(STR(GetDbTypeName(p_DbType), p_Folder));
+  if (p_Writable)
+  {
+    // lease the single write connection, writers are serialized while readers proceed in parallel
+    // on their own connections, which in wal mode see the last committed state
+    m_WriteDbMutex.lock();
+    return std::shared_ptr<DbConnection>(m_WriteDb.get(), [this](DbConnection*)
+    {
+      m_WriteDbMutex.unlock();
+    });
+  }
 
-  if (m_CacheEncrypt) // just in case
+  // lease a read connection from the pool, it is returned to the pool when released
+  std::unique_ptr<DbConnection> dbConnection;
   {
-    const std::string& dbName = GetDbName(p_Folder);
-    std::string dbPath = GetTempDbDir(p_DbType) + dbName;
-    std::string cacheDbPath = GetCacheDbDir(p_DbType) + dbName;
-    if (!Crypto::AESEncryptFile(dbPath, cacheDbPath, m_Pass))
+    std::lock_guard<std::mutex> poolLock(m_PoolMutex);
+    if (!m_ReadDbPool.empty())
     {
-      Util::DeleteFile(cacheDbPath);
+      dbConnection = std::move(m_ReadDbPool.back());
+      m_ReadDbPool.pop_back();
     }
   }
-}
 
-void ImapCache::CreateDb(ImapCache::DbType p_DbType, const std::string& p_DbPath)
-{
-  LOG_DEBUG_FUNC(STR(GetDbTypeName(p_DbType), p_DbPath));
+  if (!dbConnection)
+  {
+    dbConnection.reset(new DbConnection(m_WriteDb->m_DbPath, true /* p_ReadOnly */, m_WriteDb->m_VfsName));
+  }
 
-  try
+  return std::shared_ptr<DbConnection>(dbConnection.release(), [this](DbConnection* p_DbConnection)
   {
-    sqlite::database db(p_DbPath);
-    if (p_DbType == HeadersDb)
-    {
-      db << "CREATE TABLE IF NOT EXISTS headers (uid INT, data BLOB, PRIMARY KEY (uid));";
-    }
-    else if (p_DbType == BodysDb)
-    {
-      db << "CREATE TABLE IF NOT EXISTS bodys (uid INT, data BLOB, PRIMARY KEY (uid));";
-    }
-    else if (p_DbType == UidFlagsDb)
+    std::lock_guard<std::mutex> poolLock(m_PoolMutex);
+    if (m_ReadDbPool.size() < s_ReadDbPoolSize)
     {
-      db << "CREATE TABLE IF NOT EXISTS uids (uids BLOB);";
-      // @todo: remove uidvalidity creation on update of version in InitUidFlagsCache
-      db << "CREATE TABLE IF NOT EXISTS uidvalidity (uidvalidity BLOB);";
-      db << "CREATE TABLE IF NOT EXISTS flags (uid INT, flag INT, PRIMARY KEY (uid));";
+      m_ReadDbPool.emplace_back(p_DbConnection);
     }
-    else if (p_DbType == ValidityDb)
+    else
     {
-      db << "CREATE TABLE IF NOT EXISTS validity (folder TEXT, uid INT, PRIMARY KEY (folder));";
+      delete p_DbConnection;
     }
-  }
-  catch (const sqlite::sqlite_exception& ex)
-  {
-    HANDLE_SQLITE_EXCEPTION(ex);
-  }
+  });
 }
 
-// must be called with cachelock
-std::shared_ptr<ImapCache::DbConnection> ImapCache::GetDb(ImapCache::DbType p_DbType, const std::string& p_Folder,
-                                                          bool p_Writable)
+// must be called with shared cachelock, and without holding a write connection
+int64_t ImapCache::GetFolderId(const std::string& p_Folder, bool p_Create)
 {
-  std::shared_ptr<ImapCache::DbConnection> dbConnection;
-  auto& dbMap = m_DbConnections[p_DbType];
-  auto it = dbMap.find(p_Folder);
-  if (it != dbMap.end())
   {
-    // use existing open connection
-    dbConnection = it->second;
+    std::lock_guard<std::mutex> folderIdsLock(m_FolderIdsMutex);
+    auto it = m_FolderIds.find(p_Folder);
+    if (it != m_FolderIds.end()) return it->second;
   }
-  else
-  {
-    // open new connection
-    const std::string& dbPath = GetDbPath(p_DbType, p_Folder);
-    if (!Util::Exists(dbPath))
-    {
-      CreateDb(p_DbType, dbPath);
-    }
 
-    dbConnection = std::shared_ptr<DbConnection>(new DbConnection(dbPath));
-    dbMap[p_Folder] = dbConnection;
+  int64_t folderId = -1;
+  std::shared_ptr<DbConnection> dbCon = GetDb(p_Create /* p_Writable */);
+  std::shared_ptr<sqlite::database> db = dbCon->m_Database;
+  try
+  {
+    dbCon->Prepare("SELECT id FROM folders WHERE name = ?;") << p_Folder >> folderId;
+  }
+  catch (const sqlite::errors::no_rows&)
+  {
+    folderId = -1;
   }
 
-  if (m_CacheEncrypt)
+  if ((folderId == -1) && p_Create)
   {
-    // for encrypted db - only keep one writable db to minimize shutdown time
-    auto& currentWriteDb = m_CurrentWriteDb[p_DbType];
-    if (p_Writable && (currentWriteDb != p_Folder))
+    try
     {
-      if (!currentWriteDb.empty())
-      {
-        std::shared_ptr<ImapCache::DbConnection> prevDbConnection = dbMap.at(currentWriteDb);
-        if (prevDbConnection->m_Dirty)
-        {
-          prevDbConnection->CloseDb();
-          WriteDb(p_DbType, currentWriteDb);
-          prevDbConnection->OpenDb();
-          prevDbConnection->m_Dirty = false;
-        }
-      }
-
-      currentWriteDb = p_Folder;
+      *db << "INSERT INTO folders (name) VALUES (?);" << p_Folder;
+      folderId = db->last_insert_rowid();
+    }
+    catch (const sqlite::sqlite_exception& ex)
+    {
+      HANDLE_SQLITE_EXCEPTION(ex);
     }
   }
 
-  dbConnection->m_Dirty |= p_Writable;
+  if (folderId != -1)
+  {
+    std::lock_guard<std::mutex> folderIdsLock(m_FolderIdsMutex);
+    m_FolderIds[p_Folder] = folderId;
+  }
 
-  return dbConnection;
+  return folderId;
 }
 
-// must be called with cachelock
-void ImapCache::CloseDbs(ImapCache::DbType p_DbType)
+// must be called with exclusive cachelock
+void ImapCache::CloseDbs()
 {
-  LOG_DEBUG_FUNC(STR(GetDbTypeName(p_DbType)));
+  LOG_DEBUG_FUNC(STR());
 
-  auto& dbMap = m_DbConnections[p_DbType];
-  if (m_CacheEncrypt)
   {
-    // for encrypted mode, write back any dirty db (should only be one)
-    for (auto it = dbMap.begin(); it != dbMap.end(); ++it)
-    {
-      const std::string& folder = it->first;
-      std::shared_ptr<ImapCache::DbConnection> dbConnection = it->second;
-      if (dbConnection->m_Dirty)
-      {
-        dbConnection->CloseDb();
-        WriteDb(p_DbType, folder);
-        dbConnection->m_Dirty = false;
-      }
-    }
+    std::lock_guard<std::mutex> poolLock(m_PoolMutex);
+    m_ReadDbPool.clear();
   }
 
-  dbMap.clear();
+  // closing the last connection checkpoints the wal into the main db file
+  m_WriteDb.reset();
 }
 
 std::string ImapCache::ReadCacheFile(const std::string& p_Path)
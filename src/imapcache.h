@@ -1,17 +1,25 @@
 // imapcache.h
 //
-// Copyright (c) 2020-2022 Kristofer Berggren
+// Copyright (c) 2020-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "status.h"
 
 class Body;
 class Header;
@@ -24,18 +32,78 @@ namespace sqlite
 class ImapCache
 {
 private:
-  enum DbType
+  struct DbConnection;
+  struct PendingWrites;
+
+public:
+  struct Stats
   {
-    HeadersDb = 0,
-    BodysDb,
-    UidFlagsDb,
-    ValidityDb,
+    int64_t m_BodyCount = 0;
+    int64_t m_BodyCompressedCount = 0;
+    int64_t m_BodyDataSize = 0;
+    int64_t m_BodyStoredSize = 0;
+    int64_t m_BodySharedCount = 0;
+    int64_t m_DedupLookups = 0;
+    int64_t m_DedupHits = 0;
+    int64_t m_DbSize = 0;
   };
 
-  struct DbConnection;
+  // result of Maintain(), sizes are in bytes
+  struct MaintenanceReport
+  {
+    struct FolderStats
+    {
+      int64_t m_UidCount = 0;
+      int64_t m_HeaderCount = 0;
+      int64_t m_BodyCount = 0;
+      int64_t m_StoredSize = 0;
+    };
+
+    struct TableStats
+    {
+      int64_t m_RowCount = 0;
+      int64_t m_Size = 0; // zero if sqlite lacks dbstat support
+    };
+
+    std::map<std::string, FolderStats> m_Folders;
+    std::map<std::string, TableStats> m_Tables;
+    std::map<std::string, int64_t> m_Orphans;
+    std::set<std::string> m_StaleFolders;
+    std::vector<std::string> m_IntegrityErrors;
+    bool m_IntegrityChecked = false;
+    int64_t m_DbSize = 0;
+    int64_t m_FreeSize = 0;
+    int64_t m_VacuumedDbSize = 0;
+  };
+
+  enum SortField
+  {
+    SortFieldDate = 0,
+    SortFieldFrom,
+    SortFieldTo,
+    SortFieldSubject,
+    SortFieldUnseen,
+    SortFieldAttachments,
+  };
+
+  // sort order and filters for GetSortedUids(), string filters are matched against
+  // normalized values (see Util::NormalizeName and Util::NormalizeSubject)
+  struct UidQuery
+  {
+    SortField m_SortField = SortFieldDate;
+    bool m_Ascending = false;
+    bool m_UnseenOnly = false;
+    bool m_AttachmentsOnly = false;
+    std::string m_FromName;
+    std::string m_ToName;
+    std::string m_Subject;
+    uint32_t m_Offset = 0;
+    uint32_t m_Limit = 0;
+  };
 
 public:
-  ImapCache(const bool p_CacheEncrypt, const std::string& p_Pass);
+  ImapCache(const bool p_CacheEncrypt, const std::string& p_Pass,
+            const std::function<void(const StatusUpdate&)>& p_StatusHandler = nullptr);
   virtual ~ImapCache();
 
   static bool ChangePass(const bool p_CacheEncrypt,
@@ -51,47 +119,88 @@ public:
                                         const bool p_Prefetch);
   void SetHeaders(const std::string& p_Folder, const std::map<uint32_t, Header>& p_Headers);
 
+  std::vector<uint32_t> GetSortedUids(const std::string& p_Folder, const UidQuery& p_Query);
+  int64_t GetSortedUidsCount(const std::string& p_Folder, const UidQuery& p_Query);
+
   std::map<uint32_t, uint32_t> GetFlags(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
   void SetFlags(const std::string& p_Folder, const std::map<uint32_t, uint32_t>& p_Flags);
 
   std::map<uint32_t, Body> GetBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
                                     const bool p_Prefetch);
   void SetBodys(const std::string& p_Folder, const std::map<uint32_t, Body>& p_Bodys);
+  std::set<uint32_t> LinkBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
 
   bool CheckUidValidity(const std::string& p_Folder, int p_Uid);
+  uint64_t GetModSeq(const std::string& p_Folder);
+  void SetModSeq(const std::string& p_Folder, uint64_t p_ModSeq);
   void SetFlagSeen(const std::string& p_Folder, const std::set<uint32_t>& p_Uids, const bool p_Value);
 
   void ClearFolder(const std::string& p_Folder);
 
   void DeleteMessages(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
 
-  bool Export(const std::string& p_Path);
+  bool Export(const std::string& p_Path, bool p_Incremental);
+  Stats GetStats();
+  MaintenanceReport Maintain();
 
 private:
-  void InitHeadersCache();
-  void CleanupHeadersCache();
-
-  void InitBodysCache();
-  void CleanupBodysCache();
-
-  void InitUidFlagsCache();
-  void CleanupUidFlagsCache();
-
-  void InitValidityCache();
-  void CleanupValidityCache();
-
-  static std::string GetDbTypeName(ImapCache::DbType p_DbType);
-  static std::string GetCacheDir(ImapCache::DbType p_DbType);
-  static std::string GetCacheDbDir(ImapCache::DbType p_DbType);
-  static std::string GetTempDbDir(ImapCache::DbType p_DbType);
-  static std::string GetHeadersFoldersPath();
-
-  std::string GetDbName(const std::string& p_Folder);
-  std::string GetDbPath(ImapCache::DbType p_DbType, const std::string& p_Folder);
-  void WriteDb(ImapCache::DbType p_DbType, const std::string& p_Folder);
-  void CreateDb(ImapCache::DbType p_DbType, const std::string& p_DbPath);
-  std::shared_ptr<DbConnection> GetDb(DbType p_DbType, const std::string& p_Folder, bool p_Writable);
-  void CloseDbs(DbType p_DbType);
+  bool ExportFolder(const std::string& p_Folder, const std::string& p_FolderPath, bool p_Incremental);
+  void InitCache();
+  void CleanupCache();
+  void InitDb();
+  void CreateTables();
+  void CreateHeaderFieldsTable();
+  void CreateBodyDataTables();
+  void UpgradeTables(int p_FromVersion);
+  void MigrateLegacyCache();
+  bool MigrateLegacyDb(const std::string& p_TypeName, const std::string& p_DbName,
+                       const std::function<void()>& p_MigrateFunc);
+  void StartWriter();
+  void StopWriter();
+  void WriterProcess();
+  void WaitWriteQueue(std::unique_lock<std::mutex>& p_WriteLock);
+  void FlushWrites();
+  void FlagsWritten();
+  bool WriteQueued();
+  void StartBackground();
+  void StopBackground();
+  void BackgroundProcess();
+  bool ConvertHeaderFields(int64_t& p_Count);
+  bool ConvertBodys(int64_t& p_Count, int64_t& p_SavedSize);
+  bool ReparseStale();
+  bool ReparseHeaders(int64_t& p_Cursor, int64_t& p_Count, bool& p_Done);
+  bool ReparseBodys(int64_t& p_Cursor, int64_t& p_Count, bool& p_Done);
+  int64_t GetCounter(const std::string& p_Name, int64_t p_Default);
+  void SetStatus(uint32_t p_Flags, float p_Progress = -1);
+  void ClearStatus(uint32_t p_Flags);
+  bool BackgroundWait(const std::chrono::milliseconds& p_Duration);
+  bool IsCacheSizeLimited();
+  void SetUsed();
+  bool IsIdle();
+  void SetAccessed(int64_t p_FolderId, const std::set<uint32_t>& p_Uids);
+  void FlushAccessTimes();
+  bool EvictBodys(int64_t& p_Count);
+  bool DeleteOrphans(int p_Limit, std::map<std::string, int64_t>& p_Counts);
+  bool CleanupOrphans(std::map<std::string, int64_t>& p_Counts);
+  void DeleteStaleFolders(const std::set<std::string>& p_Folders);
+  bool IncrementalVacuum();
+
+  static std::string GetCacheDir();
+  static std::string GetCacheDbDir();
+  static std::string GetTempDbDir();
+  static std::string GetFoldersPath();
+  static std::string GetLegacyCacheDir(const std::string& p_TypeName);
+  static std::string GetLegacyCacheDbDir(const std::string& p_TypeName);
+  static std::vector<std::string> GetLegacyTypeNames();
+
+  static std::string GetDbName();
+  static bool CopyDb(const std::string& p_SrcPath, const std::string& p_SrcVfsName,
+                     const std::string& p_DstPath, const std::string& p_DstVfsName);
+
+  std::string GetLegacyDbName(const std::string& p_Folder);
+  std::shared_ptr<DbConnection> GetDb(bool p_Writable);
+  int64_t GetFolderId(const std::string& p_Folder, bool p_Create);
+  void CloseDbs();
   std::string ReadCacheFile(const std::string& p_Path);
   void WriteCacheFile(const std::string& p_Path, const std::string& p_Str);
 
@@ -103,9 +212,39 @@ private:
 private:
   bool m_CacheEncrypt;
   std::string m_Pass;
+  std::function<void(const StatusUpdate&)> m_StatusHandler;
   std::set<std::string> m_Folders;
 
-  std::mutex m_CacheMutex;
-  std::map<DbType, std::map<std::string, std::shared_ptr<DbConnection>>> m_DbConnections;
-  std::map<DbType, std::string> m_CurrentWriteDb;
+  // held shared by cache operations, and exclusive while opening and closing dbs
+  std::shared_mutex m_CacheMutex;
+  std::string m_VfsName;
+  std::shared_ptr<DbConnection> m_WriteDb;
+
+  // held while the write connection is leased, read connections are leased from pool
+  std::mutex m_WriteDbMutex;
+  std::mutex m_PoolMutex;
+  std::vector<std::unique_ptr<DbConnection>> m_ReadDbPool;
+
+  std::mutex m_FoldersMutex;
+  std::mutex m_FolderIdsMutex;
+  std::map<std::string, int64_t> m_FolderIds;
+
+  std::mutex m_UsageMutex;
+  std::map<std::pair<int64_t, uint32_t>, int64_t> m_AccessTimes;
+  std::chrono::steady_clock::time_point m_LastUsed;
+
+  std::mutex m_WriteMutex;
+  std::condition_variable m_WriteCondVar;
+  std::map<std::string, PendingWrites> m_PendingWrites;
+  std::map<std::string, PendingWrites> m_WritingWrites;
+  size_t m_PendingWriteCount = 0;
+  size_t m_FlushWaiters = 0;
+  uint64_t m_WriteGeneration = 0;
+  bool m_WriterRunning = false;
+  std::thread m_WriterThread;
+
+  bool m_BackgroundRunning = false;
+  std::thread m_BackgroundThread;
+  std::mutex m_BackgroundMutex;
+  std::condition_variable m_BackgroundCondVar;
 };
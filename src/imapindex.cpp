@@ -1,6 +1,6 @@
 // imapindex.cpp
 //
-// Copyright (c) 2020-2024 Kristofer Berggren
+// Copyright (c) 2020-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
@@ -60,16 +60,8 @@ bool ImapIndex::ChangePass(const bool p_CacheEncrypt,
 {
   if (!p_CacheEncrypt) return true;
 
-  InitCacheTempDir();
-  if (!CacheUtil::DecryptCacheDir(p_OldPass, GetCacheIndexDbDir(), GetCacheIndexDbTempDir())) return false;
-
-  Util::RmDir(GetCacheIndexDbDir());
-  Util::MkDir(GetCacheIndexDbDir());
-  if (!CacheUtil::EncryptCacheDir(p_NewPass, GetCacheIndexDbTempDir(), GetCacheIndexDbDir())) return false;
-
-  CleanupCacheTempDir();
-
-  return true;
+  return CacheUtil::ReencryptCacheDir(p_OldPass, p_NewPass, GetCacheIndexDbDir(),
+                                      GetCacheIndexDir() + "reencrypt.journal");
 }
 
 void ImapIndex::NotifyIdle(bool p_IsIdle)
@@ -343,7 +335,7 @@ void ImapIndex::HandleSyncEnqueue()
     const std::set<uint32_t>& bodyUids = MapKey(m_ImapCache->GetBodys(folder, uids, true /* p_Prefetch */));
     const std::set<uint32_t>& docUids = docFolderUids[folder];
     std::set<uint32_t> uidsToAdd = bodyUids - docUids; // present in cache, but not in index
-    std::set<uint32_t> uidsToDel = docUids - bodyUids; // present in index, but not in cache
+    std::set<uint32_t> uidsToDel = docUids - uids; // present in index, but no longer in folder
 
     std::unique_lock<std::mutex> lock(m_ProcessMutex);
     if (!uidsToAdd.empty())
@@ -386,14 +378,14 @@ void ImapIndex::AddMessage(const std::string& p_Folder, uint32_t p_Uid)
   const std::string& docId = GetDocId(p_Folder, p_Uid);
   if (!m_SearchEngine->Exists(docId))
   {
-    const std::map<uint32_t, Body>& uidBodys = m_ImapCache->GetBodys(p_Folder, std::set<uint32_t>({ p_Uid }), false);
+    std::map<uint32_t, Body> uidBodys = m_ImapCache->GetBodys(p_Folder, std::set<uint32_t>({ p_Uid }), false);
     const std::map<uint32_t, Header>& uidHeaders = m_ImapCache->GetHeaders(p_Folder, std::set<uint32_t>(
                                                                              { p_Uid }), false);
 
     if (!uidBodys.empty() && !uidHeaders.empty())
     {
       const Header& header = uidHeaders.begin()->second;
-      const Body& body = uidBodys.begin()->second;
+      Body& body = uidBodys.begin()->second;
 
       const int64_t timeStamp = header.GetTimeStamp();
       const std::string& bodyText = body.GetTextPlain();
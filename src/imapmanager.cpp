@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "auth.h"
+#include "imaputil.h"
 #include "loghelp.h"
 #include "util.h"
 
@@ -21,6 +22,9 @@ ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
                          const uint32_t p_IdleTimeout,
                          const std::set<std::string>& p_FoldersExclude,
                          const bool p_SniEnabled,
+                         const uint32_t p_MaxLineLen,
+                         const uint32_t p_Connections,
+                         const bool p_CompressEnabled,
                          const std::function<void(const ImapManager::Request&,
                                                   const ImapManager::Response&)>& p_ResponseHandler,
                          const std::function<void(const ImapManager::Action&,
@@ -31,7 +35,8 @@ ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
                          const bool p_IdleInbox,
                          const std::string& p_Inbox)
   : m_Imap(p_User, p_Pass, p_Host, p_Port, p_Timeout,
-           p_CacheEncrypt, p_CacheIndexEncrypt, p_FoldersExclude, p_SniEnabled, p_StatusHandler)
+           p_CacheEncrypt, p_CacheIndexEncrypt, p_FoldersExclude, p_SniEnabled, p_MaxLineLen,
+           p_CompressEnabled, p_StatusHandler)
   , m_Connect(p_Connect)
   , m_ResponseHandler(p_ResponseHandler)
   , m_ResultHandler(p_ResultHandler)
@@ -43,11 +48,22 @@ ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
   , m_Running(false)
   , m_CacheRunning(false)
   , m_Aborting(false)
+  , m_PrefetchRunning(false)
+  , m_PrefetchConnected(0)
 {
   LOG_IF_NONZERO(pipe(m_Pipe));
   LOG_IF_NONZERO(pipe(m_CachePipe));
   m_Connecting = m_Connect;
   m_IdleTimeout = std::max(1U, p_IdleTimeout);
+
+  // first connection is used for interactive requests, remaining ones for prefetch
+  if (m_Connect)
+  {
+    for (uint32_t connId = 1; connId < p_Connections; ++connId)
+    {
+      m_PrefetchImaps.emplace_back(new Imap(m_Imap, connId));
+    }
+  }
 }
 
 ImapManager::~ImapManager()
@@ -100,6 +116,57 @@ ImapManager::~ImapManager()
     }
   }
 
+  if (!m_PrefetchThreads.empty())
+  {
+    std::unique_lock<std::mutex> lock(m_ExitedPrefetchCondMutex);
+
+    m_PrefetchRunning = false;
+    {
+      std::lock_guard<std::mutex> queueLock(m_QueueMutex);
+      m_PrefetchCond.notify_all();
+    }
+
+    if (m_ExitedPrefetchCond.wait_for(lock, std::chrono::seconds(3),
+                                      [&]() { return (m_PrefetchExited == (int)m_PrefetchThreads.size()); }))
+    {
+      LOG_DEBUG("prefetch threads exited");
+    }
+    else
+    {
+      LOG_WARNING("prefetch threads exit timeout");
+
+      LOG_DEBUG("prefetch threads abort");
+      m_Aborting = true;
+      for (auto& prefetchImap : m_PrefetchImaps)
+      {
+        prefetchImap->SetAborting(true);
+      }
+
+      for (auto& prefetchThread : m_PrefetchThreads)
+      {
+        pthread_kill(prefetchThread.native_handle(), SIGUSR2);
+      }
+    }
+
+    lock.unlock();
+    for (auto& prefetchThread : m_PrefetchThreads)
+    {
+      prefetchThread.join();
+    }
+
+    LOG_DEBUG("prefetch threads joined");
+  }
+
+  LogRequestLatency();
+
+  const Imap::CompressStats compressStats = GetCompressStats();
+  if (compressStats.m_UncompressedBytes > 0)
+  {
+    LOG_DEBUG("compress total: compressed %llu bytes uncompressed %llu bytes",
+              (unsigned long long)compressStats.m_CompressedBytes,
+              (unsigned long long)compressStats.m_UncompressedBytes);
+  }
+
   {
     std::unique_lock<std::mutex> lock(m_ExitedCacheCondMutex);
 
@@ -144,6 +211,12 @@ void ImapManager::Start()
   LOG_DEBUG("start threads");
   m_Thread = std::thread(&ImapManager::Process, this);
   m_CacheThread = std::thread(&ImapManager::CacheProcess, this);
+  m_PrefetchRunning = true;
+  for (auto& prefetchImap : m_PrefetchImaps)
+  {
+    m_PrefetchThreads.emplace_back(&ImapManager::PrefetchProcess, this, prefetchImap.get());
+  }
+
   m_SearchThread = std::thread(&ImapManager::SearchProcess, this);
 }
 
@@ -159,6 +232,7 @@ void ImapManager::AsyncRequest(const ImapManager::Request& p_Request)
   {
     std::lock_guard<std::mutex> lock(m_QueueMutex);
     m_Requests.push_front(p_Request);
+    m_Requests.front().m_QueueTimeMs = ImapUtil::GetTimeMs();
     PipeWriteOne(m_Pipe);
     ProgressCountRequestAdd(p_Request, false /* p_IsPrefetch */);
   }
@@ -174,7 +248,16 @@ void ImapManager::PrefetchRequest(const ImapManager::Request& p_Request)
   {
     std::lock_guard<std::mutex> lock(m_QueueMutex);
     m_PrefetchRequests[p_Request.m_PrefetchLevel].push_front(p_Request);
-    PipeWriteOne(m_Pipe);
+    if (HasPrefetchLanes())
+    {
+      // do not interrupt idle on the interactive connection
+      m_PrefetchCond.notify_one();
+    }
+    else
+    {
+      PipeWriteOne(m_Pipe);
+    }
+
     ProgressCountRequestAdd(p_Request, true /* p_IsPrefetch */);
   }
   else
@@ -491,6 +574,9 @@ void ImapManager::Process()
       LOG_INFO("initial login ok");
       SetStatus(Status::FlagConnected);
       m_OnceConnected = true;
+
+      std::lock_guard<std::mutex> queueLock(m_QueueMutex);
+      m_PrefetchCond.notify_all();
     }
     else
     {
@@ -520,8 +606,8 @@ void ImapManager::Process()
 
     int selrv = 1;
     m_QueueMutex.lock();
-    bool isQueueEmpty = m_Requests.empty() && m_PrefetchRequests.empty() && m_Actions.empty() &&
-      m_SearchRequests.empty();
+    bool isQueueEmpty = m_Requests.empty() && (m_PrefetchRequests.empty() || HasPrefetchLanes()) &&
+      m_Actions.empty() && m_SearchRequests.empty();
     m_QueueMutex.unlock();
 
     if (isQueueEmpty || !m_OnceConnected)
@@ -554,7 +640,8 @@ void ImapManager::Process()
 
       while (m_Running && !authRefreshNeeded &&
              m_OnceConnected &&
-             (!m_Requests.empty() || !m_PrefetchRequests.empty() || !m_Actions.empty() || !m_SearchRequests.empty()))
+             (!m_Requests.empty() || (!m_PrefetchRequests.empty() && !HasPrefetchLanes()) ||
+              !m_Actions.empty() || !m_SearchRequests.empty()))
       {
         bool isConnected = true;
         float progress = 0;
@@ -657,6 +744,7 @@ void ImapManager::Process()
           }
           else
           {
+            AddRequestLatency(request);
             ProgressCountRequestDone(request, false /* p_IsPrefetch */);
             progress = GetProgressPercentage(request, false /* p_IsPrefetch */);
           }
@@ -671,7 +759,7 @@ void ImapManager::Process()
 
         m_QueueMutex.lock();
         progress = 0;
-        while (m_Actions.empty() && m_Requests.empty() && !m_PrefetchRequests.empty() &&
+        while (m_Actions.empty() && m_Requests.empty() && !m_PrefetchRequests.empty() && !HasPrefetchLanes() &&
                m_Running && isConnected && !authRefreshNeeded)
         {
           Request request = m_PrefetchRequests.begin()->second.front();
@@ -727,7 +815,7 @@ void ImapManager::Process()
           }
         }
 
-        const bool isPrefetchRequestsEmpty = m_PrefetchRequests.empty();
+        const bool isPrefetchRequestsEmpty = m_PrefetchRequests.empty() && (m_PrefetchActive == 0);
         m_QueueMutex.unlock();
         if (isPrefetchRequestsEmpty)
         {
@@ -748,12 +836,12 @@ void ImapManager::Process()
         ProgressCountReset(false /* p_IsPrefetch */);
       }
 
-      if (m_PrefetchRequests.empty())
+      if (m_PrefetchRequests.empty() && (m_PrefetchActive == 0))
       {
         ProgressCountReset(true /* p_IsPrefetch */);
       }
 
-      isQueueEmpty = m_Requests.empty() && m_PrefetchRequests.empty() && m_Actions.empty();
+      isQueueEmpty = m_Requests.empty() && (m_PrefetchRequests.empty() || HasPrefetchLanes()) && m_Actions.empty();
 
       m_QueueMutex.unlock();
     }
@@ -895,6 +983,142 @@ void ImapManager::CacheProcess()
   m_ExitedCacheCond.notify_one();
 }
 
+void ImapManager::PrefetchProcess(Imap* p_Imap)
+{
+  THREAD_REGISTER();
+
+  LOG_DEBUG("entering prefetch loop");
+  float progress = 0;
+  int loginRetryDelay = 15;
+  bool isConnected = false;
+  std::unique_lock<std::mutex> lock(m_QueueMutex);
+  while (m_PrefetchRunning)
+  {
+    if (!m_OnceConnected)
+    {
+      m_PrefetchCond.wait_for(lock, std::chrono::seconds(15));
+      continue;
+    }
+
+    if (!isConnected)
+    {
+      lock.unlock();
+      isConnected = p_Imap->Login();
+      lock.lock();
+
+      if (!isConnected)
+      {
+        // servers may limit connections per account, prefetch then remains on the interactive connection
+        LOG_WARNING("prefetch login failed, retry in %d sec", loginRetryDelay);
+        m_PrefetchCond.wait_for(lock, std::chrono::seconds(loginRetryDelay),
+                                [&]() { return !m_PrefetchRunning; });
+        loginRetryDelay = std::min(loginRetryDelay * 2, 15 * 60);
+        continue;
+      }
+
+      LOG_DEBUG("prefetch login ok");
+      loginRetryDelay = 15;
+      ++m_PrefetchConnected;
+    }
+
+    if (m_PrefetchRequests.empty())
+    {
+      m_PrefetchCond.wait_for(lock, std::chrono::seconds(15));
+      continue;
+    }
+
+    Request request = m_PrefetchRequests.begin()->second.front();
+    m_PrefetchRequests.begin()->second.pop_front();
+    if (m_PrefetchRequests.begin()->second.empty())
+    {
+      m_PrefetchRequests.erase(m_PrefetchRequests.begin());
+    }
+
+    ++m_PrefetchActive;
+    lock.unlock();
+
+    SetStatus(Status::FlagPrefetching, progress);
+
+    Response response;
+    bool result = PerformRequest(*p_Imap, request, false /* p_Cached */, true /* p_Prefetch */, response);
+
+    bool retry = false;
+    if (!result)
+    {
+      if (!p_Imap->CheckConnection())
+      {
+        LOG_WARNING("prefetch request failed due to connection lost");
+        p_Imap->Logout();
+        isConnected = false;
+        retry = true;
+      }
+      else if (request.m_TryCount < 2)
+      {
+        ++request.m_TryCount;
+        LOG_WARNING("prefetch request retry %d", request.m_TryCount);
+        retry = true;
+      }
+    }
+
+    if (!retry)
+    {
+      SendRequestResponse(request, response);
+    }
+
+    lock.lock();
+    --m_PrefetchActive;
+
+    if (retry)
+    {
+      m_PrefetchRequests[request.m_PrefetchLevel].push_front(request);
+    }
+    else
+    {
+      ProgressCountRequestDone(request, true /* p_IsPrefetch */);
+      progress = GetProgressPercentage(request, true /* p_IsPrefetch */);
+    }
+
+    if (!isConnected && (--m_PrefetchConnected == 0))
+    {
+      // wake up interactive connection to take over pending prefetch requests
+      PipeWriteOne(m_Pipe);
+    }
+
+    if (m_PrefetchRequests.empty() && (m_PrefetchActive == 0))
+    {
+      ProgressCountReset(true /* p_IsPrefetch */);
+      progress = 0;
+
+      lock.unlock();
+      ClearStatus(Status::FlagPrefetching);
+      lock.lock();
+    }
+  }
+
+  if (isConnected)
+  {
+    --m_PrefetchConnected;
+  }
+
+  lock.unlock();
+
+  if (!m_Aborting && isConnected)
+  {
+    p_Imap->Logout();
+  }
+
+  LOG_DEBUG("exiting prefetch loop");
+
+  std::unique_lock<std::mutex> exitedLock(m_ExitedPrefetchCondMutex);
+  ++m_PrefetchExited;
+  m_ExitedPrefetchCond.notify_one();
+}
+
+bool ImapManager::HasPrefetchLanes()
+{
+  return (m_PrefetchConnected > 0);
+}
+
 void ImapManager::SearchProcess()
 {
   LOG_DEBUG("entering loop");
@@ -926,6 +1150,12 @@ void ImapManager::SearchProcess()
 
 bool ImapManager::PerformRequest(const Request& p_Request, bool p_Cached, bool p_Prefetch,
                                  Response& p_Response)
+{
+  return PerformRequest(m_Imap, p_Request, p_Cached, p_Prefetch, p_Response);
+}
+
+bool ImapManager::PerformRequest(Imap& p_Imap, const Request& p_Request, bool p_Cached, bool p_Prefetch,
+                                 Response& p_Response)
 {
   p_Response.m_ResponseStatus = ResponseStatusOk;
   p_Response.m_Folder = p_Request.m_Folder;
@@ -933,34 +1163,34 @@ bool ImapManager::PerformRequest(const Request& p_Request, bool p_Cached, bool p
 
   if (p_Request.m_GetFolders)
   {
-    const bool rv = m_Imap.GetFolders(p_Cached, p_Response.m_Folders);
+    const bool rv = p_Imap.GetFolders(p_Cached, p_Response.m_Folders);
     p_Response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetFoldersFailed;
   }
 
   if (p_Request.m_GetUids)
   {
-    const bool rv = m_Imap.GetUids(p_Request.m_Folder, p_Cached, p_Response.m_Uids,
+    const bool rv = p_Imap.GetUids(p_Request.m_Folder, p_Cached, p_Response.m_Uids,
                                    p_Response.m_UidInvalid);
     p_Response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetUidsFailed;
   }
 
   if (!p_Request.m_GetHeaders.empty())
   {
-    const bool rv = m_Imap.GetHeaders(p_Request.m_Folder, p_Request.m_GetHeaders, p_Cached,
+    const bool rv = p_Imap.GetHeaders(p_Request.m_Folder, p_Request.m_GetHeaders, p_Cached,
                                       p_Prefetch, p_Response.m_Headers);
     p_Response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetHeadersFailed;
   }
 
   if (!p_Request.m_GetFlags.empty())
   {
-    const bool rv = m_Imap.GetFlags(p_Request.m_Folder, p_Request.m_GetFlags, p_Cached,
+    const bool rv = p_Imap.GetFlags(p_Request.m_Folder, p_Request.m_GetFlags, p_Cached,
                                     p_Response.m_Flags);
     p_Response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetFlagsFailed;
   }
 
   if (!p_Request.m_GetBodys.empty())
   {
-    const bool rv = m_Imap.GetBodys(p_Request.m_Folder, p_Request.m_GetBodys, p_Cached,
+    const bool rv = p_Imap.GetBodys(p_Request.m_Folder, p_Request.m_GetBodys, p_Cached,
                                     p_Prefetch, p_Response.m_Bodys);
     if (p_Request.m_ProcessHtml)
     {
@@ -1071,6 +1301,9 @@ void ImapManager::SetStatus(uint32_t p_Flags, float p_Progress /* = -1 */)
   StatusUpdate statusUpdate;
   statusUpdate.SetFlags = p_Flags;
   statusUpdate.Progress = p_Progress;
+  const Imap::CompressStats compressStats = GetCompressStats();
+  statusUpdate.CompressedBytes = compressStats.m_CompressedBytes;
+  statusUpdate.UncompressedBytes = compressStats.m_UncompressedBytes;
   if (m_StatusHandler)
   {
     m_StatusHandler(statusUpdate);
@@ -1081,6 +1314,9 @@ void ImapManager::ClearStatus(uint32_t p_Flags)
 {
   StatusUpdate statusUpdate;
   statusUpdate.ClearFlags = p_Flags;
+  const Imap::CompressStats compressStats = GetCompressStats();
+  statusUpdate.CompressedBytes = compressStats.m_CompressedBytes;
+  statusUpdate.UncompressedBytes = compressStats.m_UncompressedBytes;
   if (m_StatusHandler)
   {
     m_StatusHandler(statusUpdate);
@@ -1179,3 +1415,44 @@ void ImapManager::PipeReadAll(int p_Fds[2])
     LOG_IF_NOT_EQUAL(read(readFd, &buf[0], len), len);
   }
 }
+
+// must be called with queue lock held
+void ImapManager::AddRequestLatency(const Request& p_Request)
+{
+  if (p_Request.m_QueueTimeMs == 0) return;
+
+  // latency from queueing to response, tracked separately for requests served during prefetch
+  const int64_t latencyMs = ImapUtil::GetTimeMs() - p_Request.m_QueueTimeMs;
+  const bool isPrefetching = !m_PrefetchRequests.empty() || (m_PrefetchActive > 0);
+  LatencyStats& latencyStats = isPrefetching ? m_PrefetchingLatency : m_IdleLatency;
+  ++latencyStats.m_Count;
+  latencyStats.m_TotalMs += latencyMs;
+  latencyStats.m_MaxMs = std::max(latencyStats.m_MaxMs, latencyMs);
+  LOG_DEBUG("request latency %lld ms prefetching %d", (long long)latencyMs, (int)isPrefetching);
+}
+
+void ImapManager::LogRequestLatency()
+{
+  const int64_t idleAvgMs = (m_IdleLatency.m_Count > 0) ? (m_IdleLatency.m_TotalMs / m_IdleLatency.m_Count) : 0;
+  const int64_t prefetchingAvgMs = (m_PrefetchingLatency.m_Count > 0)
+    ? (m_PrefetchingLatency.m_TotalMs / m_PrefetchingLatency.m_Count) : 0;
+  LOG_INFO("request latency: connections %d idle count %lld avg %lld max %lld ms"
+           ", prefetching count %lld avg %lld max %lld ms",
+           (int)(m_PrefetchImaps.size() + 1),
+           (long long)m_IdleLatency.m_Count, (long long)idleAvgMs, (long long)m_IdleLatency.m_MaxMs,
+           (long long)m_PrefetchingLatency.m_Count, (long long)prefetchingAvgMs,
+           (long long)m_PrefetchingLatency.m_MaxMs);
+}
+
+Imap::CompressStats ImapManager::GetCompressStats()
+{
+  Imap::CompressStats compressStats = m_Imap.GetCompressStats();
+  for (auto& prefetchImap : m_PrefetchImaps)
+  {
+    const Imap::CompressStats prefetchCompressStats = prefetchImap->GetCompressStats();
+    compressStats.m_CompressedBytes += prefetchCompressStats.m_CompressedBytes;
+    compressStats.m_UncompressedBytes += prefetchCompressStats.m_UncompressedBytes;
+  }
+
+  return compressStats;
+}
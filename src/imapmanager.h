@@ -11,10 +11,12 @@
 #include <condition_variable>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -50,6 +52,7 @@ public:
     std::set<uint32_t> m_GetFlags;
     std::set<uint32_t> m_GetBodys;
     uint32_t m_TryCount = 0;
+    int64_t m_QueueTimeMs = 0;
   };
 
   struct Response
@@ -122,6 +125,9 @@ public:
               const uint32_t p_IdleTimeout,
               const std::set<std::string>& p_FoldersExclude,
               const bool p_SniEnabled,
+              const uint32_t p_MaxLineLen,
+              const uint32_t p_Connections,
+              const bool p_CompressEnabled,
               const std::function<void(const ImapManager::Request&, const ImapManager::Response&)>& p_ResponseHandler,
               const std::function<void(const ImapManager::Action&, const ImapManager::Result&)>& p_ResultHandler,
               const std::function<void(const StatusUpdate&)>& p_StatusHandler,
@@ -150,6 +156,13 @@ private:
     std::unordered_map<std::string, int32_t> m_ItemDone;
   };
 
+  struct LatencyStats
+  {
+    int64_t m_Count = 0;
+    int64_t m_TotalMs = 0;
+    int64_t m_MaxMs = 0;
+  };
+
 private:
   bool ProcessIdle();
   int GetIdleDurationSec();
@@ -160,8 +173,12 @@ private:
   bool CheckConnectivity();
   void CheckConnectivityAndReconnect(bool p_SkipCheck);
   void CacheProcess();
+  void PrefetchProcess(Imap* p_Imap);
+  bool HasPrefetchLanes();
   void SearchProcess();
   bool PerformRequest(const Request& p_Request, bool p_Cached, bool p_Prefetch, Response& p_Response);
+  bool PerformRequest(Imap& p_Imap, const Request& p_Request, bool p_Cached, bool p_Prefetch,
+                      Response& p_Response);
   bool PerformAction(const Action& p_Action);
   bool PerformSearch(bool p_IsLocal, const SearchQuery& p_SearchQuery);
   void SendRequestResponse(const Request& p_Request, const Response& p_Response);
@@ -172,6 +189,9 @@ private:
   void ProgressCountRequestDone(const Request& p_Request, bool p_IsPrefetch);
   void ProgressCountReset(bool p_IsPrefetch);
   float GetProgressPercentage(const Request& p_Request, bool p_IsPrefetch);
+  void AddRequestLatency(const Request& p_Request);
+  Imap::CompressStats GetCompressStats();
+  void LogRequestLatency();
   void PipeWriteOne(int p_Fds[2]);
   void PipeReadAll(int p_Fds[2]);
 
@@ -212,6 +232,21 @@ private:
   std::string m_CurrentFolder = "INBOX";
   std::mutex m_Mutex;
 
+  // background connections serving prefetch requests, leaving m_Imap to interactive requests,
+  // actions and idle. prefetch is handled by m_Imap while no background connection is logged in.
+  std::vector<std::unique_ptr<Imap>> m_PrefetchImaps;
+  std::vector<std::thread> m_PrefetchThreads;
+  std::atomic<bool> m_PrefetchRunning;
+  std::atomic<int> m_PrefetchConnected;
+  std::condition_variable m_PrefetchCond;
+  int m_PrefetchActive = 0;
+  int m_PrefetchExited = 0;
+  std::condition_variable m_ExitedPrefetchCond;
+  std::mutex m_ExitedPrefetchCondMutex;
+
+  LatencyStats m_IdleLatency;
+  LatencyStats m_PrefetchingLatency;
+
   int m_Pipe[2] = { -1, -1 };
   int m_CachePipe[2] = { -1, -1 };
 
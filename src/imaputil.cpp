@@ -21,6 +21,16 @@
 #include "crypto.h"
 #include "util.h"
 
+void ImapUtil::FreeUidSets(std::vector<struct mailimap_set*>& p_Sets)
+{
+  for (auto& set : p_Sets)
+  {
+    mailimap_set_free(set);
+  }
+
+  p_Sets.clear();
+}
+
 std::string ImapUtil::GetConnectionAddresses(struct mailimap* p_Imap)
 {
   int fd = GetImapFd(p_Imap);
@@ -83,6 +93,42 @@ int64_t ImapUtil::GetTimeMs()
     std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// encodes uids as ranges of consecutive uids (e.g. 1:5,8,10:12), split into several sets when the
+// encoded length would exceed p_MaxLen, so each can be sent in a command within server line limits
+std::vector<struct mailimap_set*> ImapUtil::NewUidSets(const std::set<uint32_t>& p_Uids, size_t p_MaxLen)
+{
+  std::vector<struct mailimap_set*> sets;
+  struct mailimap_set* set = nullptr;
+  size_t setLen = 0;
+  auto it = p_Uids.begin();
+  while (it != p_Uids.end())
+  {
+    const uint32_t first = *it;
+    uint32_t last = first;
+    for (++it; (it != p_Uids.end()) && (*it == (last + 1)); ++it)
+    {
+      last = *it;
+    }
+
+    const size_t rangeLen = std::to_string(first).size() +
+      ((last != first) ? (1 + std::to_string(last).size()) : 0);
+    if ((set == nullptr) || ((setLen + 1 + rangeLen) > p_MaxLen))
+    {
+      set = mailimap_set_new_empty();
+      sets.push_back(set);
+      setLen = rangeLen;
+    }
+    else
+    {
+      setLen += 1 + rangeLen; // including separator
+    }
+
+    mailimap_set_add_interval(set, first, last);
+  }
+
+  return sets;
+}
+
 std::vector<std::string> ImapUtil::ResolveHostIps(const std::string& p_Host, std::string& p_Err)
 {
   p_Err.clear();
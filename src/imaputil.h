@@ -8,15 +8,18 @@
 #pragma once
 
 #include <cstdint>
+#include <set>
 #include <string>
 #include <vector>
 
 struct mailimap;
+struct mailimap_set;
 struct sockaddr_storage;
 
 class ImapUtil
 {
 public:
+  static void FreeUidSets(std::vector<struct mailimap_set*>& p_Sets);
   static std::string GetConnectionAddresses(struct mailimap* p_Imap);
   static std::string GetExchangeServerId(const std::string& p_Response);
   static std::string GetHostAddresses(const std::string& p_Host);
@@ -24,6 +27,7 @@ public:
   static std::string GetPeerIp(struct mailimap* p_Imap);
 
   static int64_t GetTimeMs();
+  static std::vector<struct mailimap_set*> NewUidSets(const std::set<uint32_t>& p_Uids, size_t p_MaxLen);
   static std::vector<std::string> ResolveHostIps(const std::string& p_Host, std::string& p_Err);
   static std::string TokenFingerprint(const std::string& p_Token);
 
@@ -13,6 +13,7 @@
 #include "addressbook.h"
 #include "auth.h"
 #include "cacheutil.h"
+#include "compress.h"
 #include "config.h"
 #include "crypto.h"
 #include "debuginfo.h"
@@ -27,6 +28,7 @@
 #include "ui.h"
 #include "uikeyconfig.h"
 #include "uikeyinput.h"
+#include "uisnapshot.h"
 #include "util.h"
 #include "version.h"
 
@@ -70,8 +72,11 @@ int main(int argc, char* argv[])
   bool keyDump = false;
   bool readOnly = false;
   bool setupAllowCacheEncrypt = false;
+  bool cacheStats = false;
+  bool cacheMaintenance = false;
   std::string setup;
   std::string exportDir;
+  bool exportIncremental = false;
 
   // Argument handling
   std::vector<std::string> args(argv + 1, argv + argc);
@@ -81,6 +86,14 @@ int main(int argc, char* argv[])
     {
       setupAllowCacheEncrypt = true;
     }
+    else if ((*it == "-cm") || (*it == "--cache-maintenance"))
+    {
+      cacheMaintenance = true;
+    }
+    else if ((*it == "-cs") || (*it == "--cache-stats"))
+    {
+      cacheStats = true;
+    }
     else if (((*it == "-d") || (*it == "--confdir")) && (std::distance(it + 1, args.end()) > 0))
     {
       ++it;
@@ -130,6 +143,12 @@ int main(int argc, char* argv[])
       ++it;
       exportDir = *it;
     }
+    else if (((*it == "-xi") || (*it == "--export-incremental")) && (std::distance(it + 1, args.end()) > 0))
+    {
+      ++it;
+      exportDir = *it;
+      exportIncremental = true;
+    }
     else
     {
       ShowHelp();
@@ -207,6 +226,8 @@ int main(int argc, char* argv[])
     { "addressbook_encrypt", "0" },
     { "cache_encrypt", "0" },
     { "cache_index_encrypt", "0" },
+    { "cache_max_size", "0" },
+    { "cache_max_folder_size", "0" },
     { "client_store_sent", "0" },
     { "coredump_enabled", "0" },
     { "html_to_text_cmd", "" },
@@ -232,6 +253,9 @@ int main(int argc, char* argv[])
     { "file_picker_cmd", "" },
     { "downloads_dir", "" },
     { "idle_timeout", "29" },
+    { "imap_max_line_len", "8192" },
+    { "imap_connections", "2" },
+    { "imap_compress", "1" },
     { "sni_enabled", "1" },
     { "logdump_enabled", "0" },
     { "copy_to_trash", "" },
@@ -339,6 +363,7 @@ int main(int argc, char* argv[])
   Util::SetDownloadsDir(mainConfig->Get("downloads_dir"));
   const bool isCoredumpEnabled = (mainConfig->Get("coredump_enabled") == "1");
   const bool sniEnabled = (mainConfig->Get("sni_enabled") == "1");
+  const bool imapCompress = (mainConfig->Get("imap_compress") == "1");
   const bool isLogdumpEnabled = (mainConfig->Get("logdump_enabled") == "1");
   Util::SetCopyToTrash(mainConfig->Get("copy_to_trash"), mainConfig->Get("imap_host"));
   mainConfig->Set("copy_to_trash", std::to_string(Util::GetCopyToTrash()));
@@ -384,6 +409,10 @@ int main(int argc, char* argv[])
   uint32_t prefetchLevel = 0;
   uint64_t networkTimeout = 0;
   uint32_t idleTimeout = 29;
+  uint32_t imapMaxLineLen = 8192;
+  uint32_t imapConnections = 2;
+  int64_t cacheMaxSize = 0;
+  int64_t cacheMaxFolderSize = 0;
   try
   {
     imapPort = std::stoi(mainConfig->Get("imap_port"));
@@ -391,11 +420,18 @@ int main(int argc, char* argv[])
     prefetchLevel = std::stoi(mainConfig->Get("prefetch_level"));
     networkTimeout = std::stoll(mainConfig->Get("network_timeout"));
     idleTimeout = std::stoi(mainConfig->Get("idle_timeout"));
+    imapMaxLineLen = std::stoul(mainConfig->Get("imap_max_line_len"));
+    imapConnections = std::stoul(mainConfig->Get("imap_connections"));
+    cacheMaxSize = std::stoll(mainConfig->Get("cache_max_size"));
+    cacheMaxFolderSize = std::stoll(mainConfig->Get("cache_max_folder_size"));
   }
   catch (...)
   {
   }
 
+  // Cache size limits are configured in MB
+  Util::SetCacheMaxSize(cacheMaxSize * 1024 * 1024, cacheMaxFolderSize * 1024 * 1024);
+
   if (!ValidateConfig(user, imapHost, imapPort, smtpHost, smtpPort))
   {
     ShowHelp();
@@ -436,11 +472,96 @@ int main(int argc, char* argv[])
   if (!exportDir.empty())
   {
     ImapCache imapCache(cacheEncrypt, pass);
-    bool exportRv = imapCache.Export(exportDir);
+    bool exportRv = imapCache.Export(exportDir, exportIncremental);
     std::cout << "Export " << (exportRv ? "success" : "failure") << "\n";
     return exportRv ? 0 : 1;
   }
 
+  // Show cache statistics if requested
+  if (cacheStats)
+  {
+    ImapCache imapCache(cacheEncrypt, pass);
+    const ImapCache::Stats stats = imapCache.GetStats();
+    const int64_t savedSize = stats.m_BodyDataSize - stats.m_BodyStoredSize;
+    std::cout << "Messages:      " << stats.m_BodyCount << " (" << stats.m_BodyCompressedCount << " compressed)\n";
+    std::cout << "Message data:  " << Util::GetPrefixedSize(stats.m_BodyDataSize) << "\n";
+    std::cout << "Stored size:   " << Util::GetPrefixedSize(stats.m_BodyStoredSize) << "\n";
+    std::cout << "Saved:         " << Util::GetPrefixedSize(std::max<int64_t>(savedSize, 0)) << "\n";
+    std::cout << "Shared:        " << stats.m_BodySharedCount << " messages stored once for multiple folders\n";
+    const int64_t dedupRate = (stats.m_DedupLookups > 0) ? ((stats.m_DedupHits * 100) / stats.m_DedupLookups) : 0;
+    std::cout << "Dedup hits:    " << stats.m_DedupHits << " of " << stats.m_DedupLookups << " (" << dedupRate << "%)\n";
+    std::cout << "Database size: " << Util::GetPrefixedSize(stats.m_DbSize) << "\n";
+    return 0;
+  }
+
+  // Perform cache maintenance if requested
+  if (cacheMaintenance)
+  {
+    ImapCache imapCache(cacheEncrypt, pass);
+    const ImapCache::MaintenanceReport report = imapCache.Maintain();
+    std::cout << "Folders:\n";
+    for (const auto& folder : report.m_Folders)
+    {
+      std::cout << "  " << folder.first << ": " << folder.second.m_UidCount << " messages, "
+                << folder.second.m_HeaderCount << " headers, " << folder.second.m_BodyCount << " bodys, "
+                << Util::GetPrefixedSize(folder.second.m_StoredSize) << "\n";
+    }
+
+    std::cout << "Tables:\n";
+    for (const auto& table : report.m_Tables)
+    {
+      std::cout << "  " << table.first << ": " << table.second.m_RowCount << " rows";
+      if (table.second.m_Size > 0)
+      {
+        std::cout << ", " << Util::GetPrefixedSize(table.second.m_Size);
+      }
+      std::cout << "\n";
+    }
+
+    const int64_t freePercent = (report.m_DbSize > 0) ? ((report.m_FreeSize * 100) / report.m_DbSize) : 0;
+    std::cout << "Database size: " << Util::GetPrefixedSize(report.m_DbSize) << " ("
+              << Util::GetPrefixedSize(report.m_FreeSize) << " unused, " << freePercent << "%)\n";
+
+    if (!report.m_IntegrityChecked)
+    {
+      std::cout << "Integrity:     not checked\n";
+    }
+    else if (report.m_IntegrityErrors.empty())
+    {
+      std::cout << "Integrity:     ok\n";
+    }
+    else
+    {
+      std::cout << "Integrity:     " << report.m_IntegrityErrors.size() << " errors, cleanup skipped\n";
+      for (const auto& error : report.m_IntegrityErrors)
+      {
+        std::cout << "  " << error << "\n";
+      }
+    }
+
+    const bool cleanup = !readOnly && report.m_IntegrityChecked && report.m_IntegrityErrors.empty();
+    const std::string action = cleanup ? "deleted" : "found";
+    for (const auto& orphan : report.m_Orphans)
+    {
+      if (orphan.second == 0) continue;
+
+      std::cout << "Orphaned rows: " << orphan.second << " " << orphan.first << " " << action << "\n";
+    }
+
+    for (const auto& staleFolder : report.m_StaleFolders)
+    {
+      std::cout << "Stale folder:  " << staleFolder << " " << action << "\n";
+    }
+
+    if (cleanup)
+    {
+      UiSnapshot::Remove(report.m_StaleFolders);
+      std::cout << "Vacuumed size: " << Util::GetPrefixedSize(report.m_VacuumedDbSize) << "\n";
+    }
+
+    return report.m_IntegrityErrors.empty() ? 0 : 1;
+  }
+
   Util::InitStdErrRedirect(logPath);
 
   Util::SetAddressBookEncrypt(addressBookEncrypt);
@@ -448,6 +569,7 @@ int main(int argc, char* argv[])
   Auth::Init(auth, authEncrypt, pass, isSetup);
 
   std::shared_ptr<Ui> ui = std::make_shared<Ui>(inbox, address, name, prefetchLevel, prefetchAllHeaders);
+  ui->LoadSnapshot(cacheEncrypt);
 
   std::shared_ptr<ImapManager> imapManager =
     std::make_shared<ImapManager>(user, pass, imapHost, imapPort, online,
@@ -456,6 +578,9 @@ int main(int argc, char* argv[])
                                   idleTimeout,
                                   foldersExclude,
                                   sniEnabled,
+                                  imapMaxLineLen,
+                                  imapConnections,
+                                  imapCompress,
                                   std::bind(&Ui::ResponseHandler, ui.get(), std::placeholders::_1,
                                             std::placeholders::_2),
                                   std::bind(&Ui::ResultHandler, ui.get(), std::placeholders::_1,
@@ -528,6 +653,9 @@ static void ShowHelp()
     "\n"
     "Options:\n"
     "   -c,  --cache-encrypt       prompt for cache encryption during oauth2 setup\n"
+    "   -cm, --cache-maintenance   check cache integrity, delete stale data, compact\n"
+    "                              cache and show statistics, then exit\n"
+    "   -cs, --cache-stats         show message cache statistics and exit\n"
     "   -d,  --confdir <DIR>       use a different directory than ~/.config/nmail\n"
     "   -e,  --verbose             enable verbose logging\n"
     "   -ee, --extra-verbose       enable extra verbose logging\n"
@@ -541,6 +669,10 @@ static void ShowHelp()
     "                              outlook-oauth2\n"
     "   -v,  --version             output version information and exit\n"
     "   -x,  --export <DIR>        export cache to specified dir in Maildir format\n"
+    "   -xi, --export-incremental <DIR>\n"
+    "                              export only messages not already exported to\n"
+    "                              specified dir, and update flags of exported\n"
+    "                              messages\n"
     "\n"
     "Examples:\n"
     "   nmail -s gmail             setup nmail for a gmail account\n"
@@ -930,6 +1062,9 @@ void LogSystemInfo()
   const std::string openSSLVersion = Crypto::GetVersion();
   LOG_DEBUG("openssl:   %s", openSSLVersion.c_str());
 
+  const std::string zlibVersion = Compress::GetVersion();
+  LOG_DEBUG("zlib:      %s", zlibVersion.c_str());
+
   const std::string sqliteVersion = Util::GetSQLiteVersion();
   LOG_DEBUG("sqlite:    %s", sqliteVersion.c_str());
 
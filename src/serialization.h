@@ -8,6 +8,10 @@
 #pragma once
 
 #include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
 
 #include <cereal/archives/binary.hpp>
 #include <cereal/types/map.hpp>
@@ -20,35 +24,52 @@ public:
   template<typename T>
   static std::vector<char> ToBytes(const T& p_Data)
   {
+    std::vector<char> bytes;
+    ToBytes(p_Data, bytes);
+    return bytes;
+  }
+
+  // serializes into specified buffer, replacing its content but keeping its capacity for reuse
+  template<typename T>
+  static void ToBytes(const T& p_Data, std::vector<char>& p_Bytes)
+  {
+    p_Bytes.clear();
+
     try
     {
-      std::stringstream sstream;
+      VectorStreamBuf streambuf(p_Bytes);
+      std::ostream ostream(&streambuf);
       {
-        cereal::BinaryOutputArchive outputArchive(sstream);
+        cereal::BinaryOutputArchive outputArchive(ostream);
         outputArchive(p_Data);
       }
-      const std::string& str = sstream.str();
-      return std::vector<char>(str.begin(), str.end());
     }
     catch (...)
     {
       LOG_WARNING("failed to serialize to bytes");
+      p_Bytes.clear();
     }
-
-    return std::vector<char>();
   }
 
   template<typename T>
   static T FromBytes(const std::vector<char>& p_Bytes)
+  {
+    return FromBytes<T>(p_Bytes.data(), p_Bytes.size());
+  }
+
+  // deserializes in place from specified memory, e.g. a blob column owned by sqlite
+  template<typename T>
+  static T FromBytes(const char* p_Data, size_t p_Size)
   {
     T data;
-    if (p_Bytes.empty()) return data;
+    if (p_Size == 0) return data;
 
     try
     {
-      std::stringstream sstream(std::string(p_Bytes.begin(), p_Bytes.end()));
+      MemoryStreamBuf streambuf(p_Data, p_Size);
+      std::istream istream(&streambuf);
       {
-        cereal::BinaryInputArchive inputArchive(sstream);
+        cereal::BinaryInputArchive inputArchive(istream);
         inputArchive(data);
       }
     }
@@ -142,4 +163,46 @@ public:
 
     return data;
   }
+
+private:
+  // read-only stream buffer over existing memory
+  class MemoryStreamBuf : public std::streambuf
+  {
+  public:
+    MemoryStreamBuf(const char* p_Data, size_t p_Size)
+    {
+      char* data = const_cast<char*>(p_Data);
+      setg(data, data, data + p_Size);
+    }
+  };
+
+  // stream buffer appending to a vector
+  class VectorStreamBuf : public std::streambuf
+  {
+  public:
+    explicit VectorStreamBuf(std::vector<char>& p_Bytes)
+      : m_Bytes(p_Bytes)
+    {
+    }
+
+  protected:
+    std::streamsize xsputn(const char* p_Data, std::streamsize p_Size) override
+    {
+      m_Bytes.insert(m_Bytes.end(), p_Data, p_Data + p_Size);
+      return p_Size;
+    }
+
+    int_type overflow(int_type p_Ch) override
+    {
+      if (!traits_type::eq_int_type(p_Ch, traits_type::eof()))
+      {
+        m_Bytes.push_back(traits_type::to_char_type(p_Ch));
+      }
+
+      return traits_type::not_eof(p_Ch);
+    }
+
+  private:
+    std::vector<char>& m_Bytes;
+  };
 };
@@ -35,6 +35,12 @@ void Status::Update(const StatusUpdate& p_StatusUpdate)
   {
     m_Progress = p_StatusUpdate.Progress;
   }
+
+  if (p_StatusUpdate.UncompressedBytes >= 0)
+  {
+    m_CompressedBytes = p_StatusUpdate.CompressedBytes;
+    m_UncompressedBytes = p_StatusUpdate.UncompressedBytes;
+  }
 }
 
 bool Status::IsSet(const Status::Flag& p_Flag)
@@ -102,13 +108,17 @@ std::string Status::ToString()
   {
     str = "Indexing" + GetProgressString();
   }
+  else if (m_Flags & FlagReparsing)
+  {
+    str = "Updating cache" + GetProgressString();
+  }
   else if (m_Flags & FlagIdle)
   {
-    str = "Idle";
+    str = "Idle" + GetCompressString();
   }
   else if (m_Flags & FlagConnected)
   {
-    str = "Connected";
+    str = "Connected" + GetCompressString();
   }
   else if (m_Flags & FlagOffline)
   {
@@ -211,3 +221,11 @@ std::string Status::GetProgressString()
 
   return "";
 }
+
+std::string Status::GetCompressString()
+{
+  if (m_UncompressedBytes <= 0) return "";
+
+  return " (" + Util::GetPrefixedSize(m_UncompressedBytes) + ", " + Util::GetPrefixedSize(m_CompressedBytes) +
+    " compressed)";
+}
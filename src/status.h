@@ -15,6 +15,8 @@ struct StatusUpdate
   uint32_t SetFlags = 0;
   uint32_t ClearFlags = 0;
   float Progress = -1;
+  int64_t CompressedBytes = -1;
+  int64_t UncompressedBytes = -1;
 };
 
 class Status
@@ -40,6 +42,7 @@ public:
     FlagIdle = (1 << 14),
     FlagIndexing = (1 << 15),
     FlagSearching = (1 << 16),
+    FlagReparsing = (1 << 17),
     FlagMax = FlagIndexing,
   };
 
@@ -53,9 +56,12 @@ public:
 
 private:
   std::string GetProgressString();
+  std::string GetCompressString();
 
 private:
   uint32_t m_Flags = 0;
   float m_Progress = 0;
+  int64_t m_CompressedBytes = 0;
+  int64_t m_UncompressedBytes = 0;
   int m_ShowProgress = 1;
 };
@@ -25,6 +25,7 @@
 #include "status.h"
 #include "uikeyconfig.h"
 #include "uikeyinput.h"
+#include "uisnapshot.h"
 #include "version.h"
 
 bool Ui::s_Running = false;
@@ -89,6 +90,7 @@ void Ui::Init()
     { "unwrap_quoted_lines", "1" },
     { "automove_trash_allow", "1" },
     { "top_bar_show_message_count", "0" },
+    { "startup_snapshot", "1" },
   };
   const std::string configPath(Util::GetApplicationDir() + std::string("ui.conf"));
   m_Config = Config(configPath, defaultConfig);
@@ -331,6 +333,11 @@ void Ui::Cleanup()
 {
   m_SleepDetect.reset();
 
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    SaveSnapshots();
+  }
+
   m_Config.Set("plain_text", m_Plaintext ? "1" : "0");
   m_Config.Set("show_rich_header", m_ShowRichHeader ? "1" : "0");
   m_Config.Set("search_show_folder", m_SearchShowFolder ? "1" : "0");
@@ -1126,7 +1133,8 @@ void Ui::DrawFileList()
 
 void Ui::DrawMessageList()
 {
-  if (!m_HasRequestedUids[m_CurrentFolder])
+  // snapshot may be drawn before imap manager is set
+  if (m_ImapManager && !m_HasRequestedUids[m_CurrentFolder])
   {
     ImapManager::Request request;
     request.m_Folder = m_CurrentFolder;
@@ -1141,6 +1149,8 @@ void Ui::DrawMessageList()
   std::set<uint32_t> fetchBodyPriUids;
   std::set<uint32_t> fetchBodySecUids;
   std::set<uint32_t> prefetchBodyUids;
+  bool hasRows = false;
+  bool hasSnapshotRows = false;
 
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
@@ -1148,6 +1158,19 @@ void Ui::DrawMessageList()
     std::map<uint32_t, uint32_t>& flags = m_Flags[m_CurrentFolder];
     const std::map<std::string, uint32_t>& displayUids = GetDisplayUids(m_CurrentFolder);
 
+    // draw snapshot rows until message list is loaded from cache or server, or the folder is known empty
+    const bool isKnownEmpty = m_HasUids[m_CurrentFolder] && m_Uids[m_CurrentFolder].empty();
+    const bool useSnapshot =
+      displayUids.empty() && !isKnownEmpty && m_Snapshot && (m_Snapshot->GetFolder() == m_CurrentFolder);
+    if (!useSnapshot && m_Snapshot)
+    {
+      m_Snapshot.reset();
+    }
+
+    static const std::vector<UiSnapshot::Row> noSnapshotRows;
+    const std::vector<UiSnapshot::Row>& snapshotRows = useSnapshot ? m_Snapshot->GetRows() : noSnapshotRows;
+    const int rowCount = useSnapshot ? (int)snapshotRows.size() : (int)displayUids.size();
+
     std::set<uint32_t>& requestedHeaders = m_RequestedHeaders[m_CurrentFolder];
     std::set<uint32_t>& requestedFlags = m_RequestedFlags[m_CurrentFolder];
     const std::map<uint32_t, Body>& bodys = m_Bodys[m_CurrentFolder];
@@ -1193,14 +1216,18 @@ void Ui::DrawMessageList()
 
     int idxOffs = Util::Bound(0, (int)(m_MessageListCurrentIndex[m_CurrentFolder] -
                                        ((m_MainWinHeight - 1) / 2)),
-                              std::max(0, (int)displayUids.size() - (int)m_MainWinHeight));
-    int idxMax = idxOffs + std::min(m_MainWinHeight, (int)displayUids.size());
+                              std::max(0, rowCount - (int)m_MainWinHeight));
+    int idxMax = idxOffs + std::min(m_MainWinHeight, rowCount);
+    hasRows = (idxMax > idxOffs);
+    hasSnapshotRows = hasRows && useSnapshot;
 
     for (int i = idxOffs; i < idxMax; ++i)
     {
-      uint32_t uid = std::prev(displayUids.end(), i + 1)->second;
+      uint32_t uid = useSnapshot ? snapshotRows.at(i).m_Uid : std::prev(displayUids.end(), i + 1)->second;
 
-      bool isUnread = ((flags.find(uid) != flags.end()) && (!Flag::GetSeen(flags.at(uid))));
+      bool isUnread = useSnapshot
+        ? (snapshotRows.at(i).m_HasFlags && !Flag::GetSeen(snapshotRows.at(i).m_Flags))
+        : ((flags.find(uid) != flags.end()) && (!Flag::GetSeen(flags.at(uid))));
       static const std::wstring wUnreadIndicator = Util::ToWString(m_UnreadIndicator);
       static const int unreadIndicatorWidth = Util::WStringWidth(wUnreadIndicator);
       std::string unreadFlag = isUnread ? std::string(m_UnreadIndicator)
@@ -1233,6 +1260,21 @@ void Ui::DrawMessageList()
                                                   : std::string(indicatorWidth, ' ');
         }
       }
+      else if (useSnapshot)
+      {
+        const UiSnapshot::Row& row = snapshotRows.at(i);
+        shortDate = std::string((row.m_Date == currentDate) ? row.m_Time : row.m_Date);
+        subject = std::string(row.m_Subject);
+        shortFrom = std::string(row.m_Name);
+
+        if (!m_AttachmentIndicator.empty())
+        {
+          static const std::wstring wIndicator = Util::ToWString(m_AttachmentIndicator);
+          static const int indicatorWidth = Util::WStringWidth(wIndicator);
+          attachFlag = row.m_HasAttachments ? std::string(m_AttachmentIndicator)
+                                            : std::string(indicatorWidth, ' ');
+        }
+      }
 
       bool isSelected = (folderSelectedUids.find(uid) != folderSelectedUids.end());
       std::string selectFlag = (isSelected && !hasAttrsSelected) ? "X" : " ";
@@ -1269,6 +1311,9 @@ void Ui::DrawMessageList()
         wattroff(m_MainWin, m_AttrsHighlightedText);
       }
 
+      // bodys are requested once message list is loaded
+      if (useSnapshot) continue;
+
       if (i == m_MessageListCurrentIndex[m_CurrentFolder])
       {
         if ((bodys.find(uid) == bodys.end()) &&
@@ -1400,6 +1445,11 @@ void Ui::DrawMessageList()
   }
 
   wrefresh(m_MainWin);
+
+  if (hasRows)
+  {
+    LogFirstPaint(hasSnapshotRows);
+  }
 }
 
 void Ui::DrawMessageListSearch()
@@ -2052,6 +2102,9 @@ void Ui::Run()
       {
         PerformUiRequest(UiRequestDrawAll);
         uiIdleTime = 0;
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        SaveSnapshots();
       }
 
       continue;
@@ -3958,6 +4011,7 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
       }
 
       m_Uids[p_Response.m_Folder] = p_Response.m_Uids;
+      m_HasUids[p_Response.m_Folder] = true;
       uiRequest |= UiRequestDrawAll;
       updateIndexFromUid = true;
       LOG_DEBUG_VAR("new uids =", newUids);
@@ -4570,6 +4624,28 @@ void Ui::ResetSmtpManager()
   m_SmtpManager.reset();
 }
 
+void Ui::LoadSnapshot(bool p_CacheEncrypt)
+{
+  // snapshot holds names and subjects in plain text, so it is not used with encrypted cache
+  m_SnapshotEnabled = !p_CacheEncrypt && (m_Config.Get("startup_snapshot") == "1");
+  if (!m_SnapshotEnabled)
+  {
+    UiSnapshot::Remove();
+    return;
+  }
+
+  m_Snapshot = UiSnapshot::Load(m_CurrentFolder);
+  if (!m_Snapshot) return;
+
+  if (m_Snapshot->GetSortFilter() != m_SortFilter[m_CurrentFolder])
+  {
+    m_Snapshot.reset();
+    return;
+  }
+
+  DrawAll();
+}
+
 void Ui::SetTrashFolder(const std::string& p_TrashFolder)
 {
   m_TrashFolder = p_TrashFolder;
@@ -5476,6 +5552,7 @@ void Ui::InvalidateUidCache(const std::string& p_Folder)
 {
   // called with lock held
   m_Uids.erase(p_Folder);
+  m_HasUids.erase(p_Folder);
   m_Headers.erase(p_Folder);
   m_Flags.erase(p_Folder);
   m_Bodys.erase(p_Folder);
@@ -7317,3 +7394,74 @@ void Ui::SetCurrentFolder(const std::string& p_Folder)
     m_ImapManager->SetCurrentFolder(m_CurrentFolder);
   }
 }
+
+// must be called with m_Mutex lock held
+void Ui::SaveSnapshots()
+{
+  if (!m_SnapshotEnabled) return;
+
+  static const size_t maxRows = 500;
+  for (const auto& folderDisplayUids : m_DisplayUids)
+  {
+    // only default sorting is used at startup, and only up-to-date display uids are stored
+    const std::string& folder = folderDisplayUids.first;
+    auto displayUidsIt = folderDisplayUids.second.find(SortDefault);
+    if (displayUidsIt == folderDisplayUids.second.end()) continue;
+
+    if (m_DisplayUidsVersion[folder][SortDefault] != m_HeaderUidsVersion[folder]) continue;
+
+    if (displayUidsIt->second.empty())
+    {
+      // remove snapshot of a folder emptied since it was saved, so its rows are not drawn at startup
+      if (m_HasUids[folder] && m_Uids[folder].empty())
+      {
+        UiSnapshot::Remove(std::set<std::string>({ folder }));
+      }
+
+      continue;
+    }
+
+    const std::map<std::string, uint32_t>& displayUids = displayUidsIt->second;
+    const std::map<uint32_t, Header>& headers = m_Headers[folder];
+    const std::map<uint32_t, uint32_t>& flags = m_Flags[folder];
+    const size_t rowCount = std::min(displayUids.size(), maxRows);
+
+    // rows refer to strings stored here, reserved to not be reallocated
+    std::vector<std::string> strs;
+    strs.reserve(rowCount * 4);
+    std::vector<UiSnapshot::Row> rows;
+    rows.reserve(rowCount);
+    for (auto it = displayUids.rbegin(); (it != displayUids.rend()) && (rows.size() < rowCount); ++it)
+    {
+      const uint32_t uid = it->second;
+      auto hit = headers.find(uid);
+      if (hit == headers.end()) continue;
+
+      const Header& header = hit->second;
+      UiSnapshot::Row row;
+      row.m_Uid = uid;
+      auto fit = flags.find(uid);
+      row.m_HasFlags = (fit != flags.end());
+      row.m_Flags = row.m_HasFlags ? fit->second : 0;
+      row.m_HasAttachments = header.GetHasAttachments();
+      row.m_Date = strs.emplace_back(header.GetDate());
+      row.m_Time = strs.emplace_back(header.GetTime());
+      row.m_Name = strs.emplace_back((folder == m_SentFolder) ? header.GetShortTo() : header.GetShortFrom());
+      row.m_Subject = strs.emplace_back(header.GetSubject());
+      rows.push_back(row);
+    }
+
+    UiSnapshot::Save(folder, SortDefault, rows);
+  }
+}
+
+void Ui::LogFirstPaint(bool p_FromSnapshot)
+{
+  bool& painted = p_FromSnapshot ? m_SnapshotPainted : m_CachePainted;
+  if (painted) return;
+
+  painted = true;
+  const int64_t elapsedMs =
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_StartTime).count();
+  LOG_INFO("time to first paint %d ms (%s)", (int)elapsedMs, p_FromSnapshot ? "snapshot" : "cache");
+}
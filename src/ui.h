@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <csignal>
 #include <string>
 #include <vector>
@@ -18,6 +19,7 @@
 #include "smtpmanager.h"
 
 class SleepDetect;
+class UiSnapshot;
 
 class Ui
 {
@@ -114,6 +116,7 @@ public:
   void SetClientStoreSent(bool p_ClientStoreSent);
   void ResetImapManager();
   void ResetSmtpManager();
+  void LoadSnapshot(bool p_CacheEncrypt);
 
   void Run();
 
@@ -263,6 +266,8 @@ private:
   void OnWakeUp();
   void AutoMoveSelectFolder();
   void SetCurrentFolder(const std::string& p_Folder);
+  void SaveSnapshots();
+  void LogFirstPaint(bool p_FromSnapshot);
 
 private:
   std::shared_ptr<ImapManager> m_ImapManager;
@@ -298,6 +303,7 @@ private:
   bool m_HasRequestedFolders = false;
   bool m_HasPrefetchRequestedFolders = false;
   std::map<std::string, bool> m_HasRequestedUids;
+  std::map<std::string, bool> m_HasUids;
   std::map<std::string, std::set<uint32_t>> m_PrefetchedHeaders;
   std::map<std::string, std::set<uint32_t>> m_RequestedHeaders;
 
@@ -573,6 +579,12 @@ private:
 
   std::unique_ptr<SleepDetect> m_SleepDetect;
 
+  bool m_SnapshotEnabled = false;
+  std::unique_ptr<UiSnapshot> m_Snapshot;
+  std::chrono::steady_clock::time_point m_StartTime = std::chrono::steady_clock::now();
+  bool m_SnapshotPainted = false;
+  bool m_CachePainted = false;
+
   bool m_IsLocalSearch = true;
 
 private:
@@ -0,0 +1,216 @@
+// uisnapshot.cpp
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "uisnapshot.h"
+
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cacheutil.h"
+#include "loghelp.h"
+#include "util.h"
+
+// file layout: magic, u32 sort filter, u32 row count, then per row u32 uid, u32 flags, u32 attributes
+// (bit 0 has flags, bit 1 has attachments), u32 date, time, name and subject lengths, followed by the strings
+static const char s_SnapshotMagic[8] = { 'N', 'M', 'U', 'I', 'S', 'N', 'P', '1' };
+static const uint32_t s_AttrHasFlags = (1 << 0);
+static const uint32_t s_AttrHasAttachments = (1 << 1);
+static const size_t s_RowFixedSize = 7 * sizeof(uint32_t);
+
+static void AppendU32(std::string& p_Str, uint32_t p_Val)
+{
+  p_Str.append(reinterpret_cast<const char*>(&p_Val), sizeof(p_Val));
+}
+
+static bool ReadU32(const char* p_Data, size_t p_Size, size_t& p_Offset, uint32_t& p_Val)
+{
+  if ((p_Size - p_Offset) < sizeof(p_Val)) return false;
+
+  memcpy(&p_Val, p_Data + p_Offset, sizeof(p_Val));
+  p_Offset += sizeof(p_Val);
+  return true;
+}
+
+UiSnapshot::UiSnapshot(const std::string& p_Folder)
+  : m_Folder(p_Folder)
+{
+}
+
+UiSnapshot::~UiSnapshot()
+{
+  if (m_Data != nullptr)
+  {
+    munmap(m_Data, m_Size);
+  }
+}
+
+std::unique_ptr<UiSnapshot> UiSnapshot::Load(const std::string& p_Folder)
+{
+  const std::string path = GetSnapshotPath(p_Folder);
+  int fd = open(path.c_str(), O_RDONLY | O_NOCTTY);
+  if (fd == -1) return nullptr;
+
+  std::unique_ptr<UiSnapshot> snapshot(new UiSnapshot(p_Folder));
+  struct stat sb;
+  if ((fstat(fd, &sb) == 0) && (sb.st_size > 0))
+  {
+    void* data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      snapshot->m_Data = data;
+      snapshot->m_Size = sb.st_size;
+    }
+  }
+
+  close(fd);
+
+  if ((snapshot->m_Data == nullptr) || !snapshot->Parse())
+  {
+    LOG_WARNING("invalid snapshot %s", path.c_str());
+    return nullptr;
+  }
+
+  LOG_DEBUG("loaded snapshot %s rows %d", path.c_str(), (int)snapshot->m_Rows.size());
+  return snapshot;
+}
+
+bool UiSnapshot::Save(const std::string& p_Folder, int p_SortFilter, const std::vector<Row>& p_Rows)
+{
+  std::string data(s_SnapshotMagic, sizeof(s_SnapshotMagic));
+  AppendU32(data, p_SortFilter);
+  AppendU32(data, p_Rows.size());
+  for (const auto& row : p_Rows)
+  {
+    AppendU32(data, row.m_Uid);
+    AppendU32(data, row.m_Flags);
+    AppendU32(data, (row.m_HasFlags ? s_AttrHasFlags : 0) | (row.m_HasAttachments ? s_AttrHasAttachments : 0));
+    AppendU32(data, row.m_Date.size());
+    AppendU32(data, row.m_Time.size());
+    AppendU32(data, row.m_Name.size());
+    AppendU32(data, row.m_Subject.size());
+    data.append(row.m_Date);
+    data.append(row.m_Time);
+    data.append(row.m_Name);
+    data.append(row.m_Subject);
+  }
+
+  // write to temporary file and move in place, to not modify a file mapped by another instance
+  Util::MkDir(GetSnapshotDir());
+  const std::string path = GetSnapshotPath(p_Folder);
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream outStream(tmpPath, std::ios::binary);
+  outStream.write(data.data(), data.size());
+  outStream.close();
+  if (!outStream)
+  {
+    LOG_WARNING("failed to write snapshot %s", tmpPath.c_str());
+    Util::DeleteFile(tmpPath);
+    return false;
+  }
+
+  Util::Move(tmpPath, path);
+  return true;
+}
+
+void UiSnapshot::Remove()
+{
+  if (Util::Exists(GetSnapshotDir()))
+  {
+    Util::RmDir(GetSnapshotDir());
+  }
+}
+
+void UiSnapshot::Remove(const std::set<std::string>& p_Folders)
+{
+  for (const auto& folder : p_Folders)
+  {
+    const std::string path = GetSnapshotPath(folder);
+    if (Util::Exists(path))
+    {
+      Util::DeleteFile(path);
+    }
+  }
+}
+
+const std::string& UiSnapshot::GetFolder() const
+{
+  return m_Folder;
+}
+
+int UiSnapshot::GetSortFilter() const
+{
+  return m_SortFilter;
+}
+
+const std::vector<UiSnapshot::Row>& UiSnapshot::GetRows() const
+{
+  return m_Rows;
+}
+
+bool UiSnapshot::Parse()
+{
+  const char* data = static_cast<const char*>(m_Data);
+  if ((m_Size < sizeof(s_SnapshotMagic)) || (memcmp(data, s_SnapshotMagic, sizeof(s_SnapshotMagic)) != 0))
+  {
+    return false;
+  }
+
+  size_t offset = sizeof(s_SnapshotMagic);
+  uint32_t sortFilter = 0;
+  uint32_t rowCount = 0;
+  if (!ReadU32(data, m_Size, offset, sortFilter) || !ReadU32(data, m_Size, offset, rowCount)) return false;
+
+  if (rowCount > ((m_Size - offset) / s_RowFixedSize)) return false;
+
+  m_SortFilter = sortFilter;
+  m_Rows.resize(rowCount);
+  for (auto& row : m_Rows)
+  {
+    uint32_t attrs = 0;
+    uint32_t lens[4] = { 0 };
+    if (!ReadU32(data, m_Size, offset, row.m_Uid) || !ReadU32(data, m_Size, offset, row.m_Flags) ||
+        !ReadU32(data, m_Size, offset, attrs))
+    {
+      return false;
+    }
+
+    for (auto& len : lens)
+    {
+      if (!ReadU32(data, m_Size, offset, len)) return false;
+    }
+
+    std::string_view* fields[4] = { &row.m_Date, &row.m_Time, &row.m_Name, &row.m_Subject };
+    for (int i = 0; i < 4; ++i)
+    {
+      if ((m_Size - offset) < lens[i]) return false;
+
+      *fields[i] = std::string_view(data + offset, lens[i]);
+      offset += lens[i];
+    }
+
+    row.m_HasFlags = (attrs & s_AttrHasFlags);
+    row.m_HasAttachments = (attrs & s_AttrHasAttachments);
+  }
+
+  return true;
+}
+
+std::string UiSnapshot::GetSnapshotDir()
+{
+  return CacheUtil::GetCacheDir() + std::string("uisnapshot/");
+}
+
+std::string UiSnapshot::GetSnapshotPath(const std::string& p_Folder)
+{
+  return GetSnapshotDir() + Util::ToHex(p_Folder);
+}
@@ -0,0 +1,60 @@
+// uisnapshot.h
+//
+// Copyright (c) 2026 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// per-folder snapshot of message list rows, in display order, persisted at exit / when idle and
+// memory mapped at startup so the message list can be drawn before cache and server respond
+class UiSnapshot
+{
+public:
+  struct Row
+  {
+    uint32_t m_Uid = 0;
+    uint32_t m_Flags = 0;
+    bool m_HasFlags = false;
+    bool m_HasAttachments = false;
+    std::string_view m_Date;
+    std::string_view m_Time;
+    std::string_view m_Name;
+    std::string_view m_Subject;
+  };
+
+  UiSnapshot(const UiSnapshot&) = delete;
+  UiSnapshot& operator=(const UiSnapshot&) = delete;
+  ~UiSnapshot();
+
+  static std::unique_ptr<UiSnapshot> Load(const std::string& p_Folder);
+  static bool Save(const std::string& p_Folder, int p_SortFilter, const std::vector<Row>& p_Rows);
+  static void Remove();
+  static void Remove(const std::set<std::string>& p_Folders);
+
+  const std::string& GetFolder() const;
+  int GetSortFilter() const;
+  const std::vector<Row>& GetRows() const;
+
+private:
+  UiSnapshot(const std::string& p_Folder);
+  bool Parse();
+
+  static std::string GetSnapshotDir();
+  static std::string GetSnapshotPath(const std::string& p_Folder);
+
+private:
+  std::string m_Folder;
+  void* m_Data = nullptr;
+  size_t m_Size = 0;
+  int m_SortFilter = 0;
+  std::vector<Row> m_Rows;
+};
@@ -8,6 +8,7 @@
 #include "util.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <csignal>
 #include <cstring>
@@ -16,6 +17,7 @@
 #include <map>
 #include <regex>
 #include <set>
+#include <thread>
 
 #include <cxxabi.h>
 #include <dlfcn.h>
@@ -81,6 +83,8 @@ std::string Util::m_LocalizedSubjectPrefixes;
 bool Util::m_GetCopyToTrash = false;
 bool Util::m_ReadOnly = false;
 bool Util::m_AssertAbort = false;
+int64_t Util::m_CacheMaxSize = 0;
+int64_t Util::m_CacheMaxFolderSize = 0;
 
 bool Util::Exists(const std::string& p_Path)
 {
@@ -2582,6 +2586,22 @@ bool Util::GetReadOnly()
   return m_ReadOnly;
 }
 
+void Util::SetCacheMaxSize(int64_t p_MaxSize, int64_t p_MaxFolderSize)
+{
+  m_CacheMaxSize = p_MaxSize;
+  m_CacheMaxFolderSize = p_MaxFolderSize;
+}
+
+int64_t Util::GetCacheMaxSize()
+{
+  return m_CacheMaxSize;
+}
+
+int64_t Util::GetCacheMaxFolderSize()
+{
+  return m_CacheMaxFolderSize;
+}
+
 void Util::SetAssertAbort(bool p_AssertAbort)
 {
   m_AssertAbort = p_AssertAbort;
@@ -2672,3 +2692,31 @@ int Util::System(const std::string& p_Cmd)
 
   return status;
 }
+
+// runs function for indices 0 to p_Count - 1, using one worker thread per core
+void Util::ParallelFor(size_t p_Count, const std::function<void(size_t)>& p_Func)
+{
+  std::atomic<size_t> nextIndex(0);
+  auto worker = [&]()
+  {
+    size_t index = 0;
+    while ((index = nextIndex++) < p_Count)
+    {
+      p_Func(index);
+    }
+  };
+
+  const size_t workerCount =
+    std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), std::max<size_t>(p_Count, 1));
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i)
+  {
+    workers.emplace_back(worker);
+  }
+
+  worker();
+  for (auto& thread : workers)
+  {
+    thread.join();
+  }
+}
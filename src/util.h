@@ -1,6 +1,6 @@
 // util.h
 //
-// Copyright (c) 2019-2025 Kristofer Berggren
+// Copyright (c) 2019-2026 Kristofer Berggren
 // All rights reserved.
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <csignal>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <set>
@@ -315,11 +316,16 @@ public:
   static void SetReadOnly(bool p_ReadOnly);
   static bool GetReadOnly();
 
+  static void SetCacheMaxSize(int64_t p_MaxSize, int64_t p_MaxFolderSize);
+  static int64_t GetCacheMaxSize();
+  static int64_t GetCacheMaxFolderSize();
+
   static void SetAssertAbort(bool p_AssertAbort);
   static void AssertionFailed();
   static bool IsProcessRunning(pid_t p_Pid);
   static bool IsSelfProcess(pid_t p_Pid);
   static int System(const std::string& p_Cmd);
+  static void ParallelFor(size_t p_Count, const std::function<void(size_t)>& p_Func);
 
 private:
   static std::string m_HtmlToTextConvertCmd;
@@ -343,4 +349,6 @@ private:
   static bool m_GetCopyToTrash;
   static bool m_ReadOnly;
   static bool m_AssertAbort;
+  static int64_t m_CacheMaxSize;
+  static int64_t m_CacheMaxFolderSize;
 };